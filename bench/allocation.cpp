@@ -0,0 +1,128 @@
+// allocation: measures NewPtr/NewHandle and their Dispose counterparts under a few typical workloads.
+//
+// Usage: bench_allocation
+//
+// Build once as is and once with POMME_NO_SLAB_ALLOCATOR to compare the slab allocator against the system allocator.
+// Fails if any block is still alive at the end.
+
+#include "Pomme.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <thread>
+#include <vector>
+
+template<typename F>
+static double TimeMs(F f)
+{
+	auto start = std::chrono::steady_clock::now();
+	f();
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Each frame allocates 500 pointers and handles of mixed sizes (mostly small, a few up to 2 KB)
+// and frees them in random order. One small pointer per frame lives on for 200 frames.
+static void RunFrames(int numFrames, unsigned seed)
+{
+	std::mt19937 rng(seed);
+	std::vector<Ptr> ptrs;
+	std::vector<Handle> handles;
+	std::vector<Ptr> longLived;
+
+	for (int frame = 0; frame < numFrames; frame++)
+	{
+		for (int i = 0; i < 500; i++)
+		{
+			Size size = 8 + (Size) (rng() % (i % 10 == 0 ? 2000 : 120));
+
+			if (i & 1)
+				ptrs.push_back(NewPtr(size));
+			else
+				handles.push_back(NewHandle(size));
+		}
+
+		std::shuffle(ptrs.begin(), ptrs.end(), rng);
+		std::shuffle(handles.begin(), handles.end(), rng);
+
+		for (Ptr p : ptrs)
+			DisposePtr(p);
+		for (Handle h : handles)
+			DisposeHandle(h);
+
+		ptrs.clear();
+		handles.clear();
+
+		longLived.push_back(NewPtrClear(64));
+		if (longLived.size() > 200)
+		{
+			DisposePtr(longLived.front());
+			longLived.erase(longLived.begin());
+		}
+	}
+
+	for (Ptr p : longLived)
+	{
+		DisposePtr(p);
+	}
+}
+
+int main()
+{
+	constexpr int kNumThreads = 4;
+
+	double framesMs = TimeMs([]() { RunFrames(2000, 1); });
+
+	double pairsMs = TimeMs([]()
+	{
+		for (int i = 0; i < 2000000; i++)
+		{
+			Ptr p = NewPtr(24);
+			p[0] = 1;
+			DisposePtr(p);
+		}
+	});
+
+	double threadsMs = TimeMs([]()
+	{
+		std::vector<std::thread> threads;
+		for (int i = 0; i < kNumThreads; i++)
+		{
+			threads.emplace_back(RunFrames, 500, 10 + i);
+		}
+		for (auto& thread : threads)
+		{
+			thread.join();
+		}
+	});
+
+	double crossThreadMs = TimeMs([]()
+	{
+		std::vector<Ptr> blocks;
+		for (int i = 0; i < 200000; i++)
+		{
+			blocks.push_back(NewPtr(i % 300));
+		}
+
+		std::thread([&blocks]()
+		{
+			for (Ptr p : blocks)
+				DisposePtr(p);
+		}).join();
+	});
+
+	printf("2000 frames of 500 mixed-size blocks:    %8.1f ms\n", framesMs);
+	printf("2M NewPtr(24)/DisposePtr pairs:          %8.1f ms\n", pairsMs);
+	printf("%d threads x 500 frames:                  %8.1f ms\n", kNumThreads, threadsMs);
+	printf("200k blocks freed by another thread:     %8.1f ms\n", crossThreadMs);
+
+	long numLeft = Pomme_GetNumAllocs();
+	if (numLeft != 0)
+	{
+		printf("%ld blocks still alive\n", numLeft);
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,169 @@
+// mp3decode: measures how LoadMP3AsResource scales with the number of decoding threads.
+//
+// Usage: bench_mp3decode [file.mp3]
+//
+// Without a file, decodes a synthetic 2-minute stream (MPEG-1 Layer III frames whose main data is noise,
+// and starts in the previous frame through the bit reservoir).
+// Prints the decode time for 1, 2, 4... threads, up to the number of hardware threads (at least 4),
+// and checks that every thread count produces the same samples as a serial decode.
+
+#include "Pomme.h"
+#include "PommeSound.h"
+#include "Utilities/memstream.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <thread>
+#include <vector>
+
+// Appends bits to a byte buffer, most significant bit first
+class BitWriter
+{
+	char* out;
+	int bitPos = 0;
+
+public:
+	explicit BitWriter(char* p) : out(p) {}
+
+	void Put(uint32_t value, int numBits)
+	{
+		for (int i = numBits - 1; i >= 0; i--, bitPos++)
+		{
+			char mask = (char) (0x80 >> (bitPos & 7));
+			if (value & (1u << i))
+				out[bitPos >> 3] |= mask;
+			else
+				out[bitPos >> 3] &= ~mask;
+		}
+	}
+};
+
+// Valid MPEG-1 Layer III frames (128 kbps, 44.1 kHz, stereo) whose Huffman-coded main data is noise.
+// Like in real files, each frame (except the first) starts its main data in the previous frame, using the bit reservoir.
+// So, a segment that starts anywhere but at the first frame needs the data that the previous frame leaves in the reservoir.
+static std::vector<char> MakeSyntheticStream()
+{
+	constexpr int kFrameSize = 417;				// 144 * 128000 / 44100, without padding
+	constexpr int kNumFrames = 4600;			// 2 minutes
+	constexpr int kSideInfoSize = 32;
+	constexpr int kMainDataSize = kFrameSize - 4 - kSideInfoSize;
+	constexpr int kFullGranuleBits = kMainDataSize * 8 / 4;		// granule size if a frame lends as much as it borrows
+	constexpr int kBorrowedBytes = 120;							// main data that each frame keeps in the bit reservoir
+	static const uint8_t kTables[] = {1, 2, 3, 5, 6, 7, 8, 9, 10, 11, 12, 13, 15, 16, 24};
+
+	std::mt19937 rng(1);
+	std::vector<char> stream(size_t(kFrameSize) * kNumFrames);
+
+	// Bytes at the end of the previous frame's main data that belong to this frame
+	int borrowed = 0;
+
+	for (int i = 0; i < kNumFrames; i++)
+	{
+		char* frame = &stream[size_t(kFrameSize) * i];
+
+		for (int j = 4 + kSideInfoSize; j < kFrameSize; j++)
+		{
+			frame[j] = (char) rng();
+		}
+
+		// Leave the end of this frame's main data to the next frame. Frames lend as much as they borrow, so that
+		// their granules keep the bits that their big_values need (the decoder doesn't stop at the end of a granule).
+		const int lent = i + 1 < kNumFrames ? kBorrowedBytes : 0;
+		const int granuleBits = (borrowed + kMainDataSize - lent) * 8 / 4;
+
+		BitWriter bits(frame);
+		bits.Put(0xFFFB9000, 32);				// sync, MPEG-1, Layer III, no CRC, 128 kbps, 44.1 kHz, stereo
+		bits.Put(borrowed, 9);					// main_data_begin
+		bits.Put(0, 3 + 8);						// private bits, scfsi
+
+		for (int granule = 0; granule < 4; granule++)
+		{
+			bits.Put(granuleBits, 12);			// part2_3_length
+			bits.Put(std::min(288, (200 + (int) (rng() % 80)) * granuleBits / kFullGranuleBits), 9);	// big_values
+			bits.Put(140 + rng() % 20, 8);		// global_gain
+			bits.Put(rng() % 16, 4);			// scalefac_compress
+			bits.Put(0, 1);						// long blocks
+			for (int region = 0; region < 3; region++)
+				bits.Put(kTables[rng() % sizeof(kTables)], 5);
+			bits.Put(7, 4);						// region0_count
+			bits.Put(3, 3);						// region1_count
+			bits.Put(rng() % 8, 3);				// preflag, scalefac_scale, count1table_select
+		}
+
+		borrowed = lent;
+	}
+
+	return stream;
+}
+
+static std::vector<char> Decode(const std::vector<char>& stream, unsigned numThreads, double* ms)
+{
+	memstream input((char*) stream.data(), stream.size());
+
+	auto startTime = std::chrono::steady_clock::now();
+	SndListHandle sound = Pomme::Sound::LoadMP3AsResource(input, numThreads);
+	*ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+
+	Pomme::Sound::SampledSoundInfo info = {};
+	Pomme::Sound::GetSoundInfoFromSndResource((Handle) sound, info);
+
+	std::vector<char> samples(info.dataStart, info.dataStart + info.decompressedLength);
+	DisposeHandle((Handle) sound);
+	return samples;
+}
+
+int main(int argc, char** argv)
+{
+	std::vector<char> stream;
+
+	if (argc > 1)
+	{
+		std::ifstream file(argv[1], std::ios::binary);
+		stream.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+	}
+	else
+	{
+		stream = MakeSyntheticStream();
+	}
+
+	const unsigned maxThreads = std::max(4u, std::thread::hardware_concurrency());
+	printf("%zu KB of MP3, %u hardware threads\n", stream.size() / 1024, std::thread::hardware_concurrency());
+	printf("threads      ms   speedup\n");
+
+	double ms = 0;
+	const std::vector<char> reference = Decode(stream, 1, &ms);
+	double serialMs = 0;
+
+	bool ok = true;
+
+	for (unsigned numThreads = 1; numThreads <= maxThreads; numThreads *= 2)
+	{
+		double bestMs = 1e9;
+		for (int run = 0; run < 3; run++)
+		{
+			std::vector<char> samples = Decode(stream, numThreads, &ms);
+			bestMs = std::min(bestMs, ms);
+			ok &= samples == reference;
+		}
+
+		if (numThreads == 1)
+		{
+			serialMs = bestMs;
+		}
+
+		printf("%7u %7.1f %8.2fx\n", numThreads, bestMs, serialMs / bestMs);
+	}
+
+	if (!ok)
+	{
+		printf("FAIL: parallel output differs from a serial decode\n");
+	}
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,137 @@
+// resourcelookup: measures how long GetResource takes to find resources across several open resource forks.
+//
+// Usage: bench_resourcelookup
+//
+// Creates 5 resource forks in the current directory (100 resources of each of 4 types per fork), reopens them
+// read-only, then times 1M lookups that hit (spread over every fork) and 1M lookups that miss (searching all forks).
+// The forks are deleted afterwards.
+
+#include "Pomme.h"
+#include "PommeFiles.h"
+
+#include <chrono>
+#include <cstdio>
+
+static constexpr int kNumForks = 5;
+static constexpr int kNumIDsPerType = 100;
+static constexpr int kNumLookups = 1000000;
+
+static const ResType kTypes[] = {'PICT', 'snd ', 'TEXT', 'ICN#'};
+static constexpr int kNumTypes = sizeof(kTypes) / sizeof(kTypes[0]);
+
+static FSSpec MakeForkSpec(int fork)
+{
+	char path[64];
+	snprintf(path, sizeof(path), ":PommeBenchFork%d", fork);
+
+	FSSpec spec;
+	FSMakeFSSpec(0, 0, path, &spec);
+	return spec;
+}
+
+static bool CreateFork(int fork)
+{
+	FSSpec spec = MakeForkSpec(fork);
+	FSpDelete(&spec);
+	FSpCreateResFile(&spec, 'PomM', 'rsrc', 0);
+
+	short refNum = FSpOpenResFile(&spec, fsRdWrPerm);
+	if (refNum < 0)
+	{
+		return false;
+	}
+
+	for (ResType type : kTypes)
+	{
+		for (int i = 0; i < kNumIDsPerType; i++)
+		{
+			// Each resource holds the number of its fork, so that lookups can check they got the right one
+			Handle h = NewHandle(16);
+			(*h)[0] = (char) fork;
+			AddResource(h, type, (short) (1000 * fork + i), "");
+		}
+	}
+
+	CloseResFile(refNum);
+	return ResError() == noErr;
+}
+
+template<typename F>
+static double TimeMs(F f)
+{
+	auto start = std::chrono::steady_clock::now();
+	f();
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main()
+{
+	Pomme::Files::Init();
+
+	short refNums[kNumForks];
+
+	for (int fork = 0; fork < kNumForks; fork++)
+	{
+		if (!CreateFork(fork))
+		{
+			printf("Couldn't create resource fork %d\n", fork);
+			return 1;
+		}
+	}
+
+	for (int fork = 0; fork < kNumForks; fork++)
+	{
+		FSSpec spec = MakeForkSpec(fork);
+		refNums[fork] = FSpOpenResFile(&spec, fsRdPerm);
+	}
+
+	long numWrongHits = 0;
+	double hitMs = TimeMs([&]()
+	{
+		for (int n = 0; n < kNumLookups; n++)
+		{
+			int fork = n % kNumForks;
+			int i = (n / kNumForks) % kNumIDsPerType;
+
+			Handle h = GetResource(kTypes[(n / 7) % kNumTypes], (short) (1000 * fork + i));
+			if (!h || (*h)[0] != fork)
+			{
+				numWrongHits++;
+				continue;
+			}
+			ReleaseResource(h);
+		}
+	});
+
+	long numWrongMisses = 0;
+	double missMs = TimeMs([&]()
+	{
+		for (int n = 0; n < kNumLookups; n++)
+		{
+			if (GetResource(kTypes[n % kNumTypes], (short) (5000 + n % kNumIDsPerType)))
+			{
+				numWrongMisses++;
+			}
+		}
+	});
+
+	printf("%d lookups over %d forks (%d resources each):\n", kNumLookups, kNumForks, kNumTypes * kNumIDsPerType);
+	printf("hits:   %8.1f ms (%.0f ns per lookup)\n", hitMs, hitMs * 1e6 / kNumLookups);
+	printf("misses: %8.1f ms (%.0f ns per lookup)\n", missMs, missMs * 1e6 / kNumLookups);
+
+	for (int fork = 0; fork < kNumForks; fork++)
+	{
+		CloseResFile(refNums[fork]);
+
+		FSSpec spec = MakeForkSpec(fork);
+		FSpDelete(&spec);
+	}
+
+	if (numWrongHits != 0 || numWrongMisses != 0)
+	{
+		printf("%ld lookups found the wrong resource or none, %ld missing resources were found\n", numWrongHits, numWrongMisses);
+		return 1;
+	}
+
+	return 0;
+}
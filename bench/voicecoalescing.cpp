@@ -0,0 +1,138 @@
+// voicecoalescing: measures a burst of identical compressed sounds started on many channels at once,
+// with voice coalescing off and on (see Pomme_SetVoiceCoalescing).
+//
+// Usage: bench_voicecoalescing
+//
+// Each burst starts the same 1-second IMA4 sound on 48 channels at different volumes, like a game firing
+// a sound effect for every enemy on screen. Prints how long starting a burst takes (every channel decodes
+// its own copy of the sound), and the mixer's load and voice counts while the burst plays.
+// Needs an audio device (SDL_AUDIODRIVER=dummy will do).
+// Fails if coalescing is on but the mixer never merged any voices.
+
+#include "Pomme.h"
+#include "PommeSound.h"
+#include "SoundMixer/cmixer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+static constexpr int kNumChannels = 48;
+static constexpr int kNumBursts = 20;
+static constexpr int kNumPackets = 689;		// 1 second at 22050 Hz
+
+static SndListHandle MakeIMA4Sound()
+{
+	Pomme::Sound::SampledSoundInfo info = {};
+	info.compressionType = 'ima4';
+	info.isCompressed = true;
+	info.nChannels = 1;
+	info.nPackets = kNumPackets;
+	info.codecBitDepth = 16;
+	info.sampleRate = 22050;
+	info.compressedLength = info.nPackets * 34;
+	info.decompressedLength = info.nPackets * 64 * 2;
+	info.baseNote = 60;
+
+	char* data = nullptr;
+	SndListHandle sound = info.MakeStandaloneResource(&data);
+
+	// Each 34-byte packet starts with a 2-byte preamble (predictor and step index), followed by noise
+	for (int i = 0; i < info.compressedLength; i++)
+	{
+		data[i] = (char) (i * 7 + (i >> 5));
+	}
+	for (int packet = 0; packet < kNumPackets; packet++)
+	{
+		data[packet * 34] = 0;
+		data[packet * 34 + 1] = (char) (packet % 40);
+	}
+
+	return sound;
+}
+
+template<typename F>
+static double TimeMs(F f)
+{
+	auto start = std::chrono::steady_clock::now();
+	f();
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static bool RunBursts(short maxVoicesPerGroup, SndListHandle sound, long headerOffset)
+{
+	Pomme::Sound::InitMixer();
+	cmixer::SetAdaptiveQuality(false);		// mix every voice at full quality, so that the load figures are comparable
+	Pomme_SetVoiceCoalescing(maxVoicesPerGroup);
+
+	SndChannelPtr channels[kNumChannels] = {};
+	for (auto& channel : channels)
+	{
+		SndNewChannel(&channel, sampledSynth, initMono, nullptr);
+	}
+
+	double startMs = 0;
+	int maxActiveVoices = 0;
+	int maxCoalescedVoices = 0;
+
+	for (int burst = 0; burst < kNumBursts; burst++)
+	{
+		startMs += TimeMs([&]()
+		{
+			for (int i = 0; i < kNumChannels; i++)
+			{
+				SndCommand cmd = {};
+				cmd.cmd = volumeCmd;
+				cmd.param2 = ((40 + i) << 16) | (60 + (i * 3) % 50);
+				SndDoImmediate(channels[i], &cmd);
+
+				cmd = {};
+				cmd.cmd = bufferCmd;
+				cmd.ptr = (Ptr) *sound + headerOffset;
+				SndDoImmediate(channels[i], &cmd);
+			}
+		});
+
+		// Let the audio device mix a few blocks of the burst
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+		auto stats = cmixer::GetStats();
+		maxActiveVoices = std::max(maxActiveVoices, stats.activeVoices);
+		maxCoalescedVoices = std::max(maxCoalescedVoices, stats.coalescedVoices);
+	}
+
+	auto stats = cmixer::GetStats();
+
+	for (auto& channel : channels)
+	{
+		SndDisposeChannel(channel, true);
+	}
+	Pomme::Sound::ShutdownMixer();
+
+	printf("coalescing %-4s start %d channels: %6.3f ms | mix load: %5.1f%% avg, %5.1f%% peak | voices mixed: %2d, coalesced: %2d\n",
+		maxVoicesPerGroup >= 2 ? "on:" : "off:", kNumChannels, startMs / kNumBursts,
+		100.0 * stats.load, 100.0 * stats.peakLoad, maxActiveVoices, maxCoalescedVoices);
+
+	if (maxVoicesPerGroup >= 2 && stats.callbacks > 0 && stats.coalescedStarts == 0)
+	{
+		printf("No voices were coalesced\n");
+		return false;
+	}
+
+	return true;
+}
+
+int main()
+{
+	SndListHandle sound = MakeIMA4Sound();
+	long headerOffset = 0;
+	GetSoundHeaderOffset(sound, &headerOffset);
+
+	bool ok = RunBursts(0, sound, headerOffset);
+	ok &= RunBursts(kNumChannels, sound, headerOffset);
+
+	DisposeHandle((Handle) sound);
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,162 @@
+// zones: measures loading and tearing down "levels" of many small blocks, with and without a memory zone.
+//
+// Usage: bench_zones
+//
+// Each of 10 levels allocates 60k pointers of mixed sizes (mostly small, 1 in 100 between 20 and 60 KB), then
+// frees them all: one by one without a zone, or with Pomme_DisposeMemoryZone with a zone. Without a zone, a few
+// long-lived pointers are allocated among the level's blocks, like a game would do for its UI or sounds.
+// Afterwards, a different allocation pattern (1 MB and 2-17 KB buffers) checks whether the freed memory can serve it:
+// on Linux, the growth of the process's resident set is reported.
+// Fails if any block is still alive at the end.
+
+#include "Pomme.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+static constexpr int kNumLevels = 10;
+static constexpr int kNumBlocksPerLevel = 60000;
+
+template<typename F>
+static double TimeMs(F f)
+{
+	auto start = std::chrono::steady_clock::now();
+	f();
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Resident set size in KB, or 0 if unknown
+static long GetResidentKB()
+{
+	long residentKB = 0;
+#if __linux__
+	FILE* statm = fopen("/proc/self/statm", "r");
+	if (statm)
+	{
+		long totalPages = 0;
+		long residentPages = 0;
+		if (2 == fscanf(statm, "%ld %ld", &totalPages, &residentPages))
+			residentKB = residentPages * 4;
+		fclose(statm);
+	}
+#endif
+	return residentKB;
+}
+
+static std::vector<Ptr> LoadLevel(std::mt19937& rng, std::vector<Ptr>* longLived)
+{
+	std::vector<Ptr> blocks;
+	blocks.reserve(kNumBlocksPerLevel);
+
+	for (int i = 0; i < kNumBlocksPerLevel; i++)
+	{
+		Size size = i % 100 == 0
+			? 20000 + (Size) (rng() % 40000)
+			: 16 + (Size) (rng() % (i % 3 ? 200 : 1500));
+
+		Ptr p = NewPtr(size);
+		memset(p, 1, size < 64 ? size : 64);
+		blocks.push_back(p);
+
+		if (longLived && i % 500 == 0)
+			longLived->push_back(NewPtr(32 + (Size) (rng() % 200)));
+	}
+
+	return blocks;
+}
+
+static void RunLevels(bool useZones)
+{
+	std::mt19937 rng(1);
+	std::vector<Ptr> longLived;
+	double loadMs = 0;
+	double teardownMs = 0;
+
+	long residentAtStart = GetResidentKB();
+
+	for (int level = 0; level < kNumLevels; level++)
+	{
+		short zoneID = 0;
+		std::vector<Ptr> blocks;
+
+		loadMs += TimeMs([&]()
+		{
+			if (!useZones)
+			{
+				blocks = LoadLevel(rng, &longLived);
+				return;
+			}
+
+			Pomme_OpenMemoryZone(&zoneID);
+			blocks = LoadLevel(rng, nullptr);
+			Pomme_CloseMemoryZone(zoneID);
+
+			// The long-lived blocks are allocated outside the zone
+			for (int i = 0; i < kNumBlocksPerLevel / 500; i++)
+				longLived.push_back(NewPtr(32 + (Size) (rng() % 200)));
+		});
+
+		if (useZones && level == 0)
+		{
+			long numBlocks = 0;
+			Size usedBytes = 0;
+			Size reservedBytes = 0;
+			Pomme_GetMemoryZoneStats(zoneID, &numBlocks, &usedBytes, &reservedBytes);
+			printf("zone:  %ld blocks use %ld of %ld KB reserved (%.1f%% slack)\n",
+				numBlocks, (long) usedBytes / 1024, (long) reservedBytes / 1024, 100.0 * (reservedBytes - usedBytes) / reservedBytes);
+		}
+
+		teardownMs += TimeMs([&]()
+		{
+			if (useZones)
+			{
+				Pomme_DisposeMemoryZone(zoneID);
+				return;
+			}
+
+			for (Ptr p : blocks)
+				DisposePtr(p);
+		});
+	}
+
+	long residentAfterLevels = GetResidentKB();
+
+	std::vector<Ptr> buffers;
+	for (int i = 0; i < 400; i++)
+	{
+		Size size = i % 2 ? 1024 * 1024 : 2048 + i * 37;
+		Ptr p = NewPtr(size);
+		memset(p, 2, size);
+		buffers.push_back(p);
+	}
+
+	long residentAfterBuffers = GetResidentKB();
+
+	for (Ptr p : buffers)
+		DisposePtr(p);
+	for (Ptr p : longLived)
+		DisposePtr(p);
+
+	printf("%-6s %d levels x %dk ptrs: load %7.1f ms, teardown %7.2f ms (%.3f ms per level)\n",
+		useZones ? "zone:" : "plain:", kNumLevels, kNumBlocksPerLevel / 1000, loadMs, teardownMs, teardownMs / kNumLevels);
+	printf("       resident set: +%ld KB after the levels, then +%ld KB for 200 MB of buffers\n",
+		residentAfterLevels - residentAtStart, residentAfterBuffers - residentAfterLevels);
+}
+
+int main()
+{
+	RunLevels(false);
+	RunLevels(true);
+
+	long numLeft = Pomme_GetNumAllocs();
+	if (numLeft != 0)
+	{
+		printf("%ld blocks still alive\n", numLeft);
+		return 1;
+	}
+
+	return 0;
+}
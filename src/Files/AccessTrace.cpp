@@ -0,0 +1,510 @@
+#include "PommeFiles.h"
+#include "PommeDebug.h"
+#include "Files/AccessTrace.h"
+#include "Platform/Posix/PommePosix.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#define LOG POMME_GENLOG(POMME_DEBUG_FILES, "TRCE")
+
+using namespace Pomme::Files;
+using namespace Pomme::Files::AccessTrace;
+
+// A read that starts within this distance of the end of its file's last entry extends that entry,
+// so that a parser reading a file in small pieces produces a single entry
+static constexpr std::streamoff kCoalesceGap = 4096;
+
+// Without OS prefetching, the replay thread reads this much at a time, so that it can be stopped quickly
+static constexpr size_t kReplayChunkSize = 256 * 1024;
+
+static constexpr const char* kTraceMagic = "PommeAccessTrace";
+static constexpr int kTraceVersion = 1;
+
+static void Record(int file, std::streamoff offset, std::streamoff length);
+
+namespace
+{
+	struct TraceEntry
+	{
+		int file;
+		std::streamoff offset;
+		std::streamoff length;
+	};
+
+	// Unbuffered stream buffer that forwards every call to the fork's own buffer and records reads
+	class TracingStreamBuf : public std::streambuf
+	{
+		std::streambuf* inner;
+		int file;
+
+		std::streamoff Tell()
+		{
+			return inner->pubseekoff(0, std::ios::cur, std::ios::in);
+		}
+
+	public:
+		TracingStreamBuf(std::streambuf* theInner, int theFile)
+			: inner(theInner)
+			, file(theFile)
+		{}
+
+		std::streambuf* GetInner() const { return inner; }
+
+	protected:
+		virtual int_type underflow() override
+		{
+			// Only peeks; the byte is recorded when it's consumed
+			return inner->sgetc();
+		}
+
+		virtual int_type uflow() override
+		{
+			std::streamoff offset = Tell();
+			int_type c = inner->sbumpc();
+			if (offset >= 0 && !traits_type::eq_int_type(c, traits_type::eof()))
+				Record(file, offset, 1);
+			return c;
+		}
+
+		virtual std::streamsize xsgetn(char_type* s, std::streamsize n) override
+		{
+			std::streamoff offset = Tell();
+			std::streamsize got = inner->sgetn(s, n);
+			if (offset >= 0 && got > 0)
+				Record(file, offset, got);
+			return got;
+		}
+
+		virtual int_type pbackfail(int_type c) override
+		{
+			return traits_type::eq_int_type(c, traits_type::eof())
+				? inner->sungetc()
+				: inner->sputbackc(traits_type::to_char_type(c));
+		}
+
+		virtual std::streamsize showmanyc() override
+		{
+			return inner->in_avail();
+		}
+
+		virtual int_type overflow(int_type c) override
+		{
+			if (traits_type::eq_int_type(c, traits_type::eof()))
+				return traits_type::not_eof(c);
+			return inner->sputc(traits_type::to_char_type(c));
+		}
+
+		virtual std::streamsize xsputn(const char_type* s, std::streamsize n) override
+		{
+			return inner->sputn(s, n);
+		}
+
+		virtual pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override
+		{
+			return inner->pubseekoff(off, dir, which);
+		}
+
+		virtual pos_type seekpos(pos_type pos, std::ios_base::openmode which) override
+		{
+			return inner->pubseekpos(pos, which);
+		}
+
+		virtual int sync() override
+		{
+			return inner->pubsync();
+		}
+	};
+
+	struct OpenForkTrace
+	{
+		int file;
+		std::unique_ptr<TracingStreamBuf> streamBuf;
+	};
+}
+
+static bool gRecording = false;
+static fs::path gSavePathAtShutdown;
+
+// Guards the tables below
+static std::mutex gTraceMutex;
+static std::vector<std::string> gFiles;
+static std::unordered_map<std::string, int> gFileIndices;
+static std::vector<std::map<std::streamoff, std::streamoff>> gCoverage;		// per file: start -> end of the ranges read so far
+static std::vector<size_t> gLastEntryOfFile;
+static std::vector<TraceEntry> gEntries;
+static std::unordered_map<short, OpenForkTrace> gOpenForks;
+
+static std::thread gReplayThread;
+static std::atomic<bool> gStopReplay = false;
+
+static void StopReplay()
+{
+	gStopReplay = true;
+
+	if (gReplayThread.joinable())
+	{
+		gReplayThread.join();
+	}
+}
+
+// Stops the replay thread on exit if Pomme::Shutdown wasn't called.
+// Declared after the rest of the state so that it's destroyed first.
+namespace
+{
+	struct ExitGuard
+	{
+		~ExitGuard()
+		{
+			StopReplay();
+		}
+	};
+}
+
+static ExitGuard gExitGuard;
+
+//-----------------------------------------------------------------------------
+// Recording
+
+static int GetFileIndex(const fs::path& hostPath)
+{
+	std::error_code ec;
+	fs::path absolutePath = fs::absolute(hostPath, ec);
+	std::string key = (const char*) (ec ? hostPath : absolutePath).u8string().c_str();
+
+	auto [it, inserted] = gFileIndices.emplace(key, (int) gFiles.size());
+	if (inserted)
+	{
+		gFiles.push_back(key);
+		gCoverage.emplace_back();
+		gLastEntryOfFile.push_back(SIZE_MAX);
+	}
+	return it->second;
+}
+
+static void RecordLocked(int file, std::streamoff offset, std::streamoff length)
+{
+	const std::streamoff readEnd = offset + length;
+	auto& coverage = gCoverage[file];
+
+	// Skip data that was already read (e.g. a resource loaded twice): it's warm by the time we get here again
+	auto it = coverage.upper_bound(offset);
+	if (it != coverage.begin() && std::prev(it)->second >= readEnd)
+	{
+		return;
+	}
+
+	std::streamoff start = offset;
+	std::streamoff end = readEnd;
+	if (it != coverage.begin() && std::prev(it)->second >= offset)
+	{
+		--it;
+		start = it->first;
+	}
+	while (it != coverage.end() && it->first <= end)
+	{
+		end = std::max(end, it->second);
+		it = coverage.erase(it);
+	}
+	coverage.emplace(start, end);
+
+	size_t lastIndex = gLastEntryOfFile[file];
+	if (lastIndex != SIZE_MAX)
+	{
+		TraceEntry& last = gEntries[lastIndex];
+		std::streamoff lastEnd = last.offset + last.length;
+		if (offset >= last.offset && offset <= lastEnd + kCoalesceGap)
+		{
+			last.length = std::max(lastEnd, readEnd) - last.offset;
+			return;
+		}
+	}
+
+	gLastEntryOfFile[file] = gEntries.size();
+	gEntries.push_back({file, offset, length});
+}
+
+static void Record(int file, std::streamoff offset, std::streamoff length)
+{
+	std::lock_guard<std::mutex> lock(gTraceMutex);
+	RecordLocked(file, offset, length);
+}
+
+void AccessTrace::StartRecording(const fs::path& savePathAtShutdown)
+{
+	gRecording = true;
+	gSavePathAtShutdown = savePathAtShutdown;
+}
+
+bool AccessTrace::IsRecording()
+{
+	return gRecording;
+}
+
+void AccessTrace::OnOpen(short refNum, ForkHandle& handle)
+{
+	// Only host files can be warmed up by a later run
+	const fs::path* hostPath = handle.GetHostPath();
+	if (!hostPath)
+	{
+		return;
+	}
+
+	auto& stream = handle.GetStream();
+
+	std::lock_guard<std::mutex> lock(gTraceMutex);
+
+	OpenForkTrace& fork = gOpenForks[refNum];
+	fork.file = GetFileIndex(*hostPath);
+	fork.streamBuf = std::make_unique<TracingStreamBuf>(stream.rdbuf(), fork.file);
+
+	// rdbuf() resets the stream state, which is fine on a freshly opened stream
+	stream.rdbuf(fork.streamBuf.get());
+}
+
+void AccessTrace::OnReadAt(short refNum, std::streamoff offset, size_t length)
+{
+	if (length == 0)
+	{
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(gTraceMutex);
+
+	auto it = gOpenForks.find(refNum);
+	if (it != gOpenForks.end())
+	{
+		RecordLocked(it->second.file, offset, (std::streamoff) length);
+	}
+}
+
+void AccessTrace::OnClose(short refNum, ForkHandle& handle)
+{
+	std::lock_guard<std::mutex> lock(gTraceMutex);
+
+	auto it = gOpenForks.find(refNum);
+	if (it == gOpenForks.end())
+	{
+		return;
+	}
+
+	// Give the stream its own buffer back before the handle goes away
+	auto& stream = handle.GetStream();
+	if (stream.rdbuf() == it->second.streamBuf.get())
+	{
+		auto state = stream.rdstate();
+		stream.rdbuf(it->second.streamBuf->GetInner());
+		stream.setstate(state);
+	}
+
+	gOpenForks.erase(it);
+}
+
+// Text format: a header line, then "file <index> <path>" before the first entry that reads a file
+// (files are numbered in that order), and one "read <file index> <offset> <length>" line per entry,
+// in order of first access.
+bool AccessTrace::Save(std::ostream& out)
+{
+	std::lock_guard<std::mutex> lock(gTraceMutex);
+
+	out << kTraceMagic << " " << kTraceVersion << "\n";
+
+	std::vector<int> savedIndices(gFiles.size(), -1);
+	int numSavedFiles = 0;
+
+	for (const TraceEntry& entry : gEntries)
+	{
+		int& savedIndex = savedIndices[entry.file];
+		if (savedIndex < 0)
+		{
+			savedIndex = numSavedFiles++;
+			out << "file " << savedIndex << " " << gFiles[entry.file] << "\n";
+		}
+
+		out << "read " << savedIndex << " " << entry.offset << " " << entry.length << "\n";
+	}
+
+	return out.good();
+}
+
+//-----------------------------------------------------------------------------
+// Replay
+
+static bool LoadTrace(const fs::path& tracePath, std::vector<fs::path>& files, std::vector<TraceEntry>& entries)
+{
+	std::ifstream in(tracePath);
+
+	std::string magic;
+	int version = 0;
+	if (!(in >> magic >> version) || magic != kTraceMagic || version != kTraceVersion)
+	{
+		return false;
+	}
+
+	std::string kind;
+	while (in >> kind)
+	{
+		if (kind == "file")
+		{
+			size_t index = 0;
+			std::string path;
+			in >> index;
+			in.get();
+			std::getline(in, path);
+			if (!in || index != files.size())
+			{
+				return false;
+			}
+
+			files.emplace_back((const char8_t*) path.c_str());
+		}
+		else if (kind == "read")
+		{
+			TraceEntry entry;
+			in >> entry.file >> entry.offset >> entry.length;
+			if (!in
+				|| entry.file < 0
+				|| (size_t) entry.file >= files.size()
+				|| entry.offset < 0
+				|| entry.length <= 0)
+			{
+				return false;
+			}
+
+			entries.push_back(entry);
+		}
+		else
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// Reads a range into a scratch buffer. This costs more CPU time than asking the OS to prefetch it,
+// since the data gets copied, but it works everywhere.
+static void ReadThrough(std::ifstream& stream, const TraceEntry& entry, std::vector<char>& scratch)
+{
+	stream.clear();
+	stream.seekg(entry.offset, std::ios::beg);
+
+	std::streamoff remaining = entry.length;
+	while (remaining > 0 && !gStopReplay)
+	{
+		stream.read(scratch.data(), std::min<std::streamoff>(remaining, (std::streamoff) scratch.size()));
+		std::streamsize got = stream.gcount();
+		if (got <= 0)
+		{
+			break;
+		}
+		remaining -= got;
+	}
+}
+
+static void Replay(std::vector<fs::path> files, std::vector<TraceEntry> entries)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	// Files are opened on first use and kept open for the rest of the replay.
+	// A file that can't be opened may have been deleted since the trace was recorded; it's skipped.
+#if POMME_POSIX_IO
+	using Pomme::Platform::Posix::FileDescriptorBuf;
+	std::vector<std::unique_ptr<FileDescriptorBuf>> prefetchFiles(files.size());
+	bool canPrefetch = true;
+#endif
+	std::vector<std::unique_ptr<std::ifstream>> readFiles(files.size());
+	std::vector<char> scratch;
+	uint64_t bytesWarmed = 0;
+
+	for (const TraceEntry& entry : entries)
+	{
+		if (gStopReplay)
+		{
+			break;
+		}
+
+#if POMME_POSIX_IO
+		// The OS reads the range in the background, so this takes next to no CPU time
+		if (canPrefetch)
+		{
+			auto& file = prefetchFiles[entry.file];
+			if (!file)
+			{
+				file = std::make_unique<FileDescriptorBuf>(files[entry.file], std::ios::in, 4096);
+			}
+
+			if (!file->IsOpen())
+			{
+				continue;
+			}
+
+			canPrefetch = file->Prefetch(entry.offset, entry.length);
+			if (canPrefetch)
+			{
+				bytesWarmed += entry.length;
+				continue;
+			}
+		}
+#endif
+
+		auto& stream = readFiles[entry.file];
+		if (!stream)
+		{
+			stream = std::make_unique<std::ifstream>(files[entry.file], std::ios::binary);
+		}
+
+		if (stream->is_open())
+		{
+			scratch.resize(kReplayChunkSize);
+			ReadThrough(*stream, entry, scratch);
+			bytesWarmed += entry.length;
+		}
+	}
+
+	LOG << "Warmed up " << bytesWarmed << " bytes in "
+		<< (std::chrono::steady_clock::now() - start) / std::chrono::milliseconds(1) << " ms\n";
+}
+
+bool AccessTrace::StartReplay(const fs::path& tracePath)
+{
+	std::vector<fs::path> files;
+	std::vector<TraceEntry> entries;
+
+	if (!LoadTrace(tracePath, files, entries))
+	{
+		return false;
+	}
+
+	StopReplay();
+	gStopReplay = false;
+	gReplayThread = std::thread(Replay, std::move(files), std::move(entries));
+	return true;
+}
+
+void AccessTrace::Shutdown()
+{
+	StopReplay();
+
+	if (!gRecording || gSavePathAtShutdown.empty())
+	{
+		return;
+	}
+
+	std::ofstream out(gSavePathAtShutdown);
+	if (!Save(out))
+	{
+		std::cerr << "Couldn't save access trace to " << gSavePathAtShutdown << "\n";
+	}
+}
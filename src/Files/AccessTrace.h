@@ -0,0 +1,33 @@
+#pragma once
+
+#include "PommeTypes.h"
+#include "Files/Volume.h"
+
+#include <ostream>
+
+namespace Pomme::Files::AccessTrace
+{
+	// Starts recording which ranges of which host files get read, in order of first access.
+	// If savePathAtShutdown isn't empty, the trace is saved there when Pomme shuts down.
+	void StartRecording(const fs::path& savePathAtShutdown);
+
+	bool IsRecording();
+
+	// Starts recording reads done through a freshly opened fork's stream (wraps its stream buffer)
+	void OnOpen(short refNum, ForkHandle& handle);
+
+	// Positional reads and mappings bypass the stream, so they're recorded separately
+	void OnReadAt(short refNum, std::streamoff offset, size_t length);
+
+	// Unwraps the fork's stream buffer; must be called before the handle is destroyed
+	void OnClose(short refNum, ForkHandle& handle);
+
+	bool Save(std::ostream& out);
+
+	// Reads a trace saved by an earlier run, then reads the same ranges on a background thread
+	// to get them into the OS page cache before the game asks for them. Returns false if the trace can't be read.
+	bool StartReplay(const fs::path& tracePath);
+
+	// Stops replaying, and saves the trace to the path given to StartRecording, if any
+	void Shutdown();
+}
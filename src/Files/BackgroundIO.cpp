@@ -0,0 +1,258 @@
+#include "Pomme.h"
+#include "Files/BackgroundIO.h"
+#include "Memory/Zones.h"
+#include "PommeDebug.h"
+#include "Utilities/bigendianstreams.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#define LOG POMME_GENLOG(POMME_DEBUG_FILES, "BGIO")
+
+using namespace Pomme::Files::BackgroundIO;
+
+namespace
+{
+	struct Batch
+	{
+		long token;
+		std::vector<ResourceReadRequest> requests;
+		std::function<void()> task;		// runs instead of the requests if set
+	};
+}
+
+static std::thread gThread;
+static std::mutex gMutex;
+static std::condition_variable gWorkAvailable;
+static std::condition_variable gBatchDone;
+static std::deque<Batch> gQueue;
+static std::vector<ResourceReadResult> gResults;
+static std::atomic<bool> gHaveResults = false;
+static long gLastSubmittedToken = 0;
+static long gLastCompletedToken = 0;
+static bool gQuit = false;
+
+static void StopThread()
+{
+	{
+		std::lock_guard<std::mutex> lock(gMutex);
+		gQuit = true;
+		gWorkAvailable.notify_one();
+	}
+
+	if (gThread.joinable())
+	{
+		gThread.join();
+	}
+}
+
+// Joins the thread on exit if Pomme::Shutdown wasn't called.
+// Declared after the rest of the state so that it's destroyed first.
+// Untaken results are left alone: the memory manager may already be gone by then.
+static struct ExitGuard
+{
+	~ExitGuard()
+	{
+		StopThread();
+	}
+} gExitGuard;
+
+static void ReadResource(std::ifstream& stream, const ResourceReadRequest& request, ResourceReadResult& result)
+{
+	auto f = Pomme::BigEndianIStream(stream);
+	SInt32 size = request.size;
+
+	if (size < 0)
+	{
+		f.Goto(request.dataOffset - 4);
+		size = f.Read<SInt32>();
+		if (size < 0)
+		{
+			throw std::runtime_error("corrupted resource size");
+		}
+	}
+
+	// Hand over a ready-made handle, so that the main thread doesn't have to copy the data.
+	// The Resource Manager owns it from then on, so it mustn't go to a memory zone opened by the game.
+	Pomme::Memory::Zones::BypassScope bypassZones;
+	Handle handle = NewHandle(size);
+
+	try
+	{
+		f.Goto(request.dataOffset);
+		f.Read(*handle, size);
+	}
+	catch (...)
+	{
+		DisposeHandle(handle);
+		throw;
+	}
+
+	result.handle = handle;
+}
+
+static void ThreadLoop()
+{
+	std::unique_lock<std::mutex> lock(gMutex);
+
+	while (true)
+	{
+		gWorkAvailable.wait(lock, [] { return gQuit || !gQueue.empty(); });
+
+		if (gQueue.empty())		// quitting, and nothing left to do
+		{
+			break;
+		}
+
+		Batch batch = std::move(gQueue.front());
+		gQueue.pop_front();
+
+		lock.unlock();
+
+		if (batch.task)
+		{
+			try
+			{
+				batch.task();
+			}
+			catch (const std::exception& e)
+			{
+				std::cerr << "Background I/O: task failed: " << e.what() << "\n";
+			}
+		}
+
+		std::vector<ResourceReadResult> results(batch.requests.size());
+
+		// Batches usually hit the same file over and over, so keep it open until the end of the batch, but no longer:
+		// the file may be replaced or deleted in the meantime (e.g. by CompactResourceFork), and on Windows,
+		// an open file can't be renamed over.
+		std::ifstream stream;
+		fs::path streamPath;
+
+		for (size_t i = 0; i < batch.requests.size(); i++)
+		{
+			const auto& request = batch.requests[i];
+			auto& result = results[i];
+
+			result.key = request.key;
+			result.forkRefNum = request.forkRefNum;
+			result.handle = nullptr;
+
+			try
+			{
+				if (streamPath != request.hostPath || !stream.is_open())
+				{
+					stream = std::ifstream(request.hostPath, std::ios::binary);
+					streamPath = request.hostPath;
+				}
+
+				stream.clear();
+				ReadResource(stream, request, result);
+			}
+			catch (const std::exception& e)
+			{
+				std::cerr << "Background I/O: couldn't read from " << request.hostPath << ": " << e.what() << "\n";
+			}
+		}
+
+		lock.lock();
+
+		for (auto& result : results)
+		{
+			gResults.push_back(std::move(result));
+		}
+		gHaveResults = true;
+
+		gLastCompletedToken = batch.token;
+		gBatchDone.notify_all();
+	}
+}
+
+static long Enqueue(Batch&& batch)
+{
+	std::lock_guard<std::mutex> lock(gMutex);
+
+	if (!gThread.joinable())
+	{
+		gQuit = false;
+		gThread = std::thread(ThreadLoop);
+	}
+
+	batch.token = ++gLastSubmittedToken;
+	long token = batch.token;
+	gQueue.push_back(std::move(batch));
+	gWorkAvailable.notify_one();
+
+	LOG << "submitted batch " << token << "\n";
+	return token;
+}
+
+long Pomme::Files::BackgroundIO::Submit(std::vector<ResourceReadRequest>&& batch)
+{
+	return Enqueue({0, std::move(batch), nullptr});
+}
+
+long Pomme::Files::BackgroundIO::SubmitTask(std::function<void()>&& task)
+{
+	return Enqueue({0, {}, std::move(task)});
+}
+
+bool Pomme::Files::BackgroundIO::IsDone(long token)
+{
+	std::lock_guard<std::mutex> lock(gMutex);
+	return gLastCompletedToken >= token;
+}
+
+void Pomme::Files::BackgroundIO::Wait(long token)
+{
+	std::unique_lock<std::mutex> lock(gMutex);
+	gBatchDone.wait(lock, [token] { return gLastCompletedToken >= token; });
+}
+
+void Pomme::Files::BackgroundIO::WaitAll()
+{
+	long token;
+	{
+		std::lock_guard<std::mutex> lock(gMutex);
+		token = gLastSubmittedToken;
+	}
+	Wait(token);
+}
+
+void Pomme::Files::BackgroundIO::TakeResults(std::vector<ResourceReadResult>& out)
+{
+	if (!gHaveResults)
+	{
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(gMutex);
+
+	for (auto& result : gResults)
+	{
+		out.push_back(std::move(result));
+	}
+	gResults.clear();
+	gHaveResults = false;
+}
+
+void Pomme::Files::BackgroundIO::Shutdown()
+{
+	StopThread();
+
+	for (auto& result : gResults)
+	{
+		if (result.handle)
+		{
+			DisposeHandle(result.handle);
+		}
+	}
+
+	gResults.clear();
+	gHaveResults = false;
+}
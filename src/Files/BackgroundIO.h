@@ -0,0 +1,47 @@
+#pragma once
+
+#include "PommeTypes.h"
+#include "CompilerSupport/filesystem.h"
+
+#include <functional>
+#include <vector>
+
+namespace Pomme::Files::BackgroundIO
+{
+	// Reads a resource's data from a host file on the background I/O thread.
+	// The background thread opens files on its own, so it never disturbs the position of the game's streams.
+	struct ResourceReadRequest
+	{
+		fs::path		hostPath;
+		std::streamoff	dataOffset;
+		SInt32			size;			// if negative, the size is read from the 4 bytes that precede the data
+		const void*		key;			// opaque; passed back in the result
+		short			forkRefNum;
+	};
+
+	struct ResourceReadResult
+	{
+		const void*			key;
+		short				forkRefNum;
+		Handle				handle;		// nullptr if the read failed; whoever takes the result owns the handle
+	};
+
+	// Queues a batch of reads. Returns a token to poll or wait on. Batches are processed in order.
+	long Submit(std::vector<ResourceReadRequest>&& batch);
+
+	// Queues an arbitrary job (e.g. writing out buffered data), in order with the batches. Returns a token like Submit.
+	long SubmitTask(std::function<void()>&& task);
+
+	bool IsDone(long token);
+
+	void Wait(long token);
+
+	// Waits for every batch submitted so far
+	void WaitAll();
+
+	// Moves the results of completed reads to `out`. Cheap when there's nothing new.
+	void TakeResults(std::vector<ResourceReadResult>& out);
+
+	// Disposes of the handles of results that were never taken
+	void Shutdown();
+}
@@ -0,0 +1,225 @@
+#include "Pomme.h"
+#include "PommeMemory.h"
+#include "Files/DecodedResources.h"
+
+#include <atomic>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+// Default budget for decoded objects (see Pomme_SetDecodedResourceCacheBudget). 0 = the cache is off until the game opts in.
+#if !defined(POMME_DECODED_RESOURCE_CACHE_BUDGET)
+	#define POMME_DECODED_RESOURCE_CACHE_BUDGET 0
+#endif
+
+using namespace Pomme::Files;
+using namespace Pomme::Files::DecodedResources;
+
+namespace
+{
+	struct Registration
+	{
+		ResType type;
+		Decoder decoder;
+	};
+
+	struct Key
+	{
+		int slot;
+		const ResourceMetadata* meta;
+
+		bool operator==(const Key& other) const = default;
+	};
+
+	struct KeyHash
+	{
+		size_t operator()(const Key& key) const
+		{
+			return std::hash<const void*>()(key.meta) ^ (size_t(key.slot) * 0x9E3779B97F4A7C15ull);
+		}
+	};
+
+	struct Entry
+	{
+		std::shared_ptr<const void> object;
+		size_t bytes;
+		short forkRefNum;
+		std::list<Key>::iterator lruPos;
+	};
+}
+
+// Guards everything below (gBudget is only written with the lock held, but may be read without it)
+static std::mutex gMutex;
+
+static std::atomic<Size> gBudget = POMME_DECODED_RESOURCE_CACHE_BUDGET;
+static size_t gCachedBytes = 0;
+static long gHits = 0;
+static long gMisses = 0;
+static std::unordered_map<Key, Entry, KeyHash> gEntries;
+static std::list<Key> gLRU;		// most recently used first
+
+// Decoders register themselves during static initialization, so the list must be ready before anything else.
+// Registrations never move, and are never removed.
+static std::deque<Registration>& GetRegistrations()
+{
+	static std::deque<Registration> registrations;
+	return registrations;
+}
+
+static void EraseEntry(std::unordered_map<Key, Entry, KeyHash>::iterator it)
+{
+	gCachedBytes -= it->second.bytes;
+	gLRU.erase(it->second.lruPos);
+	gEntries.erase(it);
+}
+
+static void EvictToBudget(size_t maxBytes)
+{
+	while (gCachedBytes > maxBytes && !gLRU.empty())
+	{
+		EraseEntry(gEntries.find(gLRU.back()));
+	}
+}
+
+int DecodedResources::RegisterDecoder(ResType type, Decoder decoder)
+{
+	std::lock_guard<std::mutex> lock(gMutex);
+
+	auto& registrations = GetRegistrations();
+	registrations.push_back({type, std::move(decoder)});
+	return (int) registrations.size() - 1;
+}
+
+bool DecodedResources::IsEnabled()
+{
+	return gBudget.load(std::memory_order_relaxed) > 0;
+}
+
+std::shared_ptr<const void> DecodedResources::Get(int slot, short id)
+{
+	const Registration* registration;
+	{
+		std::lock_guard<std::mutex> lock(gMutex);
+		registration = &GetRegistrations().at(slot);
+	}
+
+	bool writePending = false;
+	const ResourceMetadata* meta = FindResourceMetadata(registration->type, id, &writePending);
+	if (!meta)
+	{
+		return nullptr;
+	}
+
+	// A resource that's waiting to be written may still be modified through its handle, so it's never cached.
+	// While the cache is off, there's nothing to look up, and hits and misses aren't counted.
+	const bool cacheable = !writePending && IsEnabled();
+	const Key key = {slot, meta};
+
+	if (cacheable)
+	{
+		std::lock_guard<std::mutex> lock(gMutex);
+
+		auto it = gEntries.find(key);
+		if (it != gEntries.end())
+		{
+			gLRU.splice(gLRU.begin(), gLRU, it->second.lruPos);
+			gHits++;
+			return it->second.object;
+		}
+
+		gMisses++;
+	}
+
+	Handle rawResource = GetResource(registration->type, id);
+	if (!rawResource)
+	{
+		return nullptr;
+	}
+
+	// If another thread changed the resource chain in the meantime, GetResource may have found another resource
+	const bool sameResource = Pomme::Memory::BlockDescriptor::HandleToBlock(rawResource)->rezMeta == meta;
+	const short forkRefNum = meta->forkRefNum;
+
+	size_t bytes = 0;
+	std::shared_ptr<const void> object;
+	{
+		Pomme::Memory::ReleaseResourceGuard autoRelease(rawResource);
+		object = registration->decoder(rawResource, id, &bytes);
+	}
+
+	if (!object || !cacheable || !sameResource)
+	{
+		return object;
+	}
+
+	std::lock_guard<std::mutex> lock(gMutex);
+
+	if (bytes > (size_t) gBudget.load())
+	{
+		return object;
+	}
+
+	// Another thread may have decoded the same resource in the meantime
+	auto [it, inserted] = gEntries.try_emplace(key);
+	if (!inserted)
+	{
+		return it->second.object;
+	}
+
+	gLRU.push_front(key);
+	it->second = {object, bytes, forkRefNum, gLRU.begin()};
+	gCachedBytes += bytes;
+	EvictToBudget(gBudget.load());
+
+	return object;
+}
+
+void DecodedResources::Forget(const ResourceMetadata* meta)
+{
+	std::lock_guard<std::mutex> lock(gMutex);
+
+	if (gEntries.empty())
+	{
+		return;
+	}
+
+	for (int slot = 0; slot < (int) GetRegistrations().size(); slot++)
+	{
+		auto it = gEntries.find({slot, meta});
+		if (it != gEntries.end())
+		{
+			EraseEntry(it);
+		}
+	}
+}
+
+void DecodedResources::ForgetFork(short refNum)
+{
+	std::lock_guard<std::mutex> lock(gMutex);
+
+	for (auto it = gEntries.begin(); it != gEntries.end(); )
+	{
+		auto next = std::next(it);
+		if (it->second.forkRefNum == refNum)
+		{
+			EraseEntry(it);
+		}
+		it = next;
+	}
+}
+
+void Pomme_SetDecodedResourceCacheBudget(Size maxBytes)
+{
+	std::lock_guard<std::mutex> lock(gMutex);
+	gBudget = std::max<Size>(0, maxBytes);
+	EvictToBudget(gBudget.load());
+}
+
+void Pomme_GetDecodedResourceCacheStats(long* hits, long* misses, Size* cachedBytes)
+{
+	std::lock_guard<std::mutex> lock(gMutex);
+	if (hits) *hits = gHits;
+	if (misses) *misses = gMisses;
+	if (cachedBytes) *cachedBytes = (Size) gCachedBytes;
+}
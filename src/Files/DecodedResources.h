@@ -0,0 +1,64 @@
+#pragma once
+
+#include "PommeTypes.h"
+#include "PommeFiles.h"
+
+#include <functional>
+#include <memory>
+
+// Cache of objects decoded from resources (string lists, pictures, icons...), so that getting the same
+// resource again skips both the Resource Manager and the decoder. Objects are keyed by decoder and by the
+// resource they came from, i.e. (type, ID, fork), and are dropped when that resource is changed or removed,
+// or when its fork is closed. Least recently used objects are evicted when the cache exceeds its budget.
+// Only the resource passed to the decoder is tracked: if a decoder gets other resources (e.g. icon masks),
+// changes to those don't invalidate the decoded object.
+namespace Pomme::Files::DecodedResources
+{
+	// Decodes a resource's data and sets *decodedBytes to the (approximate) size of the result.
+	// Returns nullptr if the data can't be decoded; nothing is cached then.
+	// Called without any lock held, so it may get other resources.
+	using Decoder = std::function<std::shared_ptr<const void>(Handle rawResource, short id, size_t* decodedBytes)>;
+
+	// Returns the slot to pass to Get
+	int RegisterDecoder(ResType type, Decoder decoder);
+
+	// False while the cache's budget is 0 (the default). Callers that have a cheaper way to get what they need
+	// than decoding the whole resource (e.g. a single string out of a string list) can skip Get then.
+	bool IsEnabled();
+
+	// Decoded form of the resource that GetResource would return right now, or nullptr if there's no such resource
+	std::shared_ptr<const void> Get(int slot, short id);
+
+	// Called by the Resource Manager when a resource's data changes or its metadata is about to go away
+	void Forget(const ResourceMetadata* meta);
+
+	// Called by the Resource Manager when a fork is about to be closed
+	void ForgetFork(short refNum);
+}
+
+namespace Pomme::Files
+{
+	// A kind of object decoded from resources of one type. Declare one per decoder, e.g.:
+	//     static const DecodedResourceType<StringList> gStringLists('STR#', DecodeStringList);
+	template<typename T>
+	class DecodedResourceType
+	{
+		int slot;
+
+	public:
+		using DecodeFunc = std::shared_ptr<const T> (*)(Handle rawResource, short id, size_t* decodedBytes);
+
+		DecodedResourceType(ResType type, DecodeFunc decode)
+			: slot(DecodedResources::RegisterDecoder(type,
+				[decode](Handle rawResource, short id, size_t* decodedBytes) -> std::shared_ptr<const void>
+				{
+					return decode(rawResource, id, decodedBytes);
+				}))
+		{}
+
+		std::shared_ptr<const T> Get(short id) const
+		{
+			return std::static_pointer_cast<const T>(DecodedResources::Get(slot, id));
+		}
+	};
+}
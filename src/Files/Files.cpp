@@ -6,8 +6,19 @@
 #include "PommeFiles.h"
 #include "Files/Volume.h"
 #include "Files/HostVolume.h"
-
+#include "Files/MemoryVolume.h"
+#include "Files/PackVolume.h"
+#include "Files/AccessTrace.h"
+#include "Files/BackgroundIO.h"
+#include "Files/IOStats.h"
+#include "Files/WriteBehind.h"
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
 #include <iostream>
+#include <mutex>
+#include <shared_mutex>
 #include <sstream>
 #include "CompilerSupport/filesystem.h"
 
@@ -25,50 +36,205 @@ using namespace Pomme::Files;
 //-----------------------------------------------------------------------------
 // State
 
+// Guards the allocation of refNums. Hot lookups (GetForkHandle) don't take it: see gForkLookup.
+static std::shared_mutex openFilesMutex;
 static Pomme::GrowablePool<std::unique_ptr<ForkHandle>, SInt16, 0x7FFF> openFiles;
 
+// Lock-free view of openFiles, so that threads loading from forks in parallel don't all hit the same lock.
+// A fork is published once it's fully set up (see OpenFork), and unpublished before it's closed.
+// Pages of entries are allocated on first use and never freed, so that readers never see one go away.
+static constexpr int kForkLookupPageSize = 256;
+static constexpr int kNumForkLookupPages = (0x7FFF + kForkLookupPageSize) / kForkLookupPageSize;
+static std::atomic<std::atomic<ForkHandle*>*> gForkLookup[kNumForkLookupPages];
+
+// Volumes keep caches that aren't thread-safe (e.g. HostVolume's directory listings), so calls into them are serialized.
+static std::recursive_mutex volumesMutex;
 static std::vector<std::unique_ptr<Volume>> volumes;
 
 //-----------------------------------------------------------------------------
 // Utilities
 
+// Call with openFilesMutex held exclusively
+static void PublishForkHandle(short refNum, ForkHandle* handle)
+{
+	auto& page = gForkLookup[refNum / kForkLookupPageSize];
+
+	if (!page.load(std::memory_order_relaxed))
+	{
+		if (!handle)
+		{
+			return;
+		}
+
+		page.store(new std::atomic<ForkHandle*>[kForkLookupPageSize](), std::memory_order_release);
+	}
+
+	page.load(std::memory_order_relaxed)[refNum % kForkLookupPageSize].store(handle, std::memory_order_release);
+}
+
+// Fork handles are heap-allocated, so the reference stays valid until the fork is closed
+static ForkHandle& GetForkHandle(short refNum)
+{
+	ForkHandle* handle = nullptr;
+
+	if (refNum >= 0)
+	{
+		if (auto* page = gForkLookup[refNum / kForkLookupPageSize].load(std::memory_order_acquire))
+		{
+			handle = page[refNum % kForkLookupPageSize].load(std::memory_order_acquire);
+		}
+	}
+
+	if (!handle)
+	{
+		throw std::runtime_error("illegal refNum");
+	}
+
+	return *handle;
+}
+
 bool Pomme::Files::IsRefNumLegal(short refNum)
 {
+	std::shared_lock<std::shared_mutex> lock(openFilesMutex);
 	return openFiles.IsAllocated(refNum);
 }
 
 std::iostream& Pomme::Files::GetStream(short refNum)
 {
-	if (!IsRefNumLegal(refNum))
+	return GetForkHandle(refNum).GetStream();
+}
+
+char* Pomme::Files::MapRange(short refNum, std::streamoff offset, size_t length, void** mappingBase, size_t* mappingLength)
+{
+	ForkHandle& handle = GetForkHandle(refNum);
+
+	// These bypass the stream, so they'd miss pending writes
+	WriteBehind::Flush(refNum);
+
+	if (!IOStats::IsEnabled() && !AccessTrace::IsRecording())
 	{
-		throw std::runtime_error("illegal refNum");
+		return handle.MapRange(offset, length, mappingBase, mappingLength);
 	}
-	return openFiles[refNum]->GetStream();
+
+	auto start = std::chrono::steady_clock::now();
+	char* data = handle.MapRange(offset, length, mappingBase, mappingLength);
+	if (data && IOStats::IsEnabled())
+	{
+		IOStats::OnMapRange(refNum, length, (std::chrono::steady_clock::now() - start) / std::chrono::nanoseconds(1));
+	}
+	if (data && AccessTrace::IsRecording())
+	{
+		AccessTrace::OnReadAt(refNum, offset, length);
+	}
+	return data;
 }
 
-const FSSpec& Pomme::Files::GetSpec(short refNum)
+size_t Pomme::Files::ReadAt(short refNum, std::streamoff offset, char* buffer, size_t length)
 {
-	if (!IsRefNumLegal(refNum))
+	ForkHandle& handle = GetForkHandle(refNum);
+
+	WriteBehind::Flush(refNum);
+
+	if (!IOStats::IsEnabled() && !AccessTrace::IsRecording())
 	{
-		throw std::runtime_error("illegal refNum");
+		return handle.ReadAt(offset, buffer, length);
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	size_t got = handle.ReadAt(offset, buffer, length);
+	if (IOStats::IsEnabled())
+	{
+		IOStats::OnReadAt(refNum, got, (std::chrono::steady_clock::now() - start) / std::chrono::nanoseconds(1));
 	}
-	return openFiles[refNum]->spec;
+	if (AccessTrace::IsRecording())
+	{
+		AccessTrace::OnReadAt(refNum, offset, got);
+	}
+	return got;
+}
+
+bool Pomme::Files::CanForkGrow(short refNum)
+{
+	return GetForkHandle(refNum).CanGrow();
+}
+
+OSErr Pomme::Files::SetForkContentsLength(short refNum, std::streamoff length)
+{
+	return GetForkHandle(refNum).SetContentsLength(length);
+}
+
+OSErr Pomme::Files::ReplaceForkContents(short refNum, const char* data, size_t length)
+{
+	return GetForkHandle(refNum).ReplaceContents(data, length);
+}
+
+fs::path Pomme::Files::GetHostPath(short refNum)
+{
+	const fs::path* path = GetForkHandle(refNum).GetHostPath();
+	return path ? *path : fs::path();
+}
+
+const FSSpec& Pomme::Files::GetSpec(short refNum)
+{
+	return GetForkHandle(refNum).spec;
 }
 
 void Pomme::Files::CloseStream(short refNum)
 {
-	if (!IsRefNumLegal(refNum))
+	std::unique_ptr<ForkHandle> handle;
+
+	// Unhook write-behind before IOStats unhooks its own stream buffer (which sits underneath).
+	// This may wait for a background flush, so do it before taking the lock.
+	std::shared_ptr<WriteBehind::WriteBehindBuf> writeBehind;
+	if (IsRefNumLegal(refNum) && IsStreamOpen(refNum))
 	{
-		throw std::runtime_error("illegal refNum");
+		writeBehind = WriteBehind::Detach(refNum, GetForkHandle(refNum));
 	}
-	openFiles[refNum].reset(nullptr);
-	openFiles.Dispose(refNum);
+
+	{
+		std::unique_lock<std::shared_mutex> lock(openFilesMutex);
+
+		if (!openFiles.IsAllocated(refNum))
+		{
+			throw std::runtime_error("illegal refNum");
+		}
+
+		PublishForkHandle(refNum, nullptr);
+
+		// Stats must be folded before the refNum can be reused by another thread
+		if (IOStats::IsEnabled() && openFiles[refNum])
+		{
+			IOStats::OnClose(refNum, *openFiles[refNum]);
+		}
+
+		// The tracing buffer sits under IOStats' (see OpenFork), so it's unwrapped last
+		if (AccessTrace::IsRecording() && openFiles[refNum])
+		{
+			AccessTrace::OnClose(refNum, *openFiles[refNum]);
+		}
+
+		handle = std::move(openFiles[refNum]);
+		openFiles.Dispose(refNum);
+	}
+
+	if (writeBehind)
+	{
+		// The file is written out and closed on the background thread
+		WriteBehind::CloseAsync(std::move(writeBehind), std::move(handle));
+		LOG << "Stream #" << refNum << " closing in the background\n";
+		return;
+	}
+
+	// Close the file outside the lock (this may flush pending writes)
+	handle.reset();
+
 	LOG << "Stream #" << refNum << " closed\n";
 }
 
 bool Pomme::Files::IsStreamOpen(short refNum)
 {
-	if (!IsRefNumLegal(refNum))
+	std::shared_lock<std::shared_mutex> lock(openFilesMutex);
+	if (!openFiles.IsAllocated(refNum))
 	{
 		throw std::runtime_error("illegal refNum");
 	}
@@ -78,11 +244,7 @@ bool Pomme::Files::IsStreamOpen(short refNum)
 
 bool Pomme::Files::IsStreamPermissionAllowed(short refNum, char perm)
 {
-	if (!IsRefNumLegal(refNum))
-	{
-		throw std::runtime_error("illegal refNum");
-	}
-	return (perm & openFiles[refNum]->permission) == perm;
+	return (perm & GetForkHandle(refNum).permission) == perm;
 }
 
 //-----------------------------------------------------------------------------
@@ -90,6 +252,9 @@ bool Pomme::Files::IsStreamPermissionAllowed(short refNum, char perm)
 
 void Pomme::Files::Init()
 {
+	std::lock_guard<std::recursive_mutex> volumesLock(volumesMutex);
+	std::unique_lock<std::shared_mutex> openFilesLock(openFilesMutex);
+
 	auto hostVolume = std::make_unique<HostVolume>(0);
 	volumes.push_back(std::move(hostVolume));
 
@@ -100,16 +265,27 @@ void Pomme::Files::Init()
 	}
 }
 
+void Pomme::Files::Shutdown()
+{
+	WriteBehind::Shutdown();
+	BackgroundIO::Shutdown();
+	IOStats::Shutdown();
+	AccessTrace::Shutdown();
+}
+
 //-----------------------------------------------------------------------------
 // Implementation
 
 bool IsVolumeLegal(short vRefNum)
 {
+	std::lock_guard<std::recursive_mutex> lock(volumesMutex);
 	return vRefNum >= 0 && (unsigned short) vRefNum < volumes.size();
 }
 
 OSErr FSMakeFSSpec(short vRefNum, long dirID, const char* cstrFileName, FSSpec* spec)
 {
+	std::lock_guard<std::recursive_mutex> lock(volumesMutex);
+
 	if (!IsVolumeLegal(vRefNum))
 		return nsvErr;
 
@@ -120,17 +296,51 @@ OSErr FSMakeFSSpec(short vRefNum, long dirID, const char* cstrFileName, FSSpec*
 
 static OSErr OpenFork(const FSSpec* spec, ForkType forkType, char permission, short* refNum)
 {
-	if (openFiles.IsFull())
-		return tmfoErr;
-	if (!IsVolumeLegal(spec->vRefNum))
-		return nsvErr;
-	short newRefNum = openFiles.Alloc();
-	auto& handlePtr = openFiles[newRefNum];
-	OSErr rc = volumes.at(spec->vRefNum)->OpenFork(spec, forkType, permission, handlePtr);
+	std::unique_ptr<ForkHandle> handle;
+	short newRefNum = -1;
+
+	auto openStart = std::chrono::steady_clock::now();
+	OSErr rc = noErr;
+
+	// A fork closed with write-behind may not be fully written yet
+	WriteBehind::WaitForPendingCloses();
+
+	{
+		std::lock_guard<std::recursive_mutex> lock(volumesMutex);
+		rc = IsVolumeLegal(spec->vRefNum)
+			? volumes.at(spec->vRefNum)->OpenFork(spec, forkType, permission, handle)
+			: (OSErr) nsvErr;
+	}
+
+	if (rc == noErr)
+	{
+		std::unique_lock<std::shared_mutex> lock(openFilesMutex);
+
+		if (openFiles.IsFull())
+		{
+			rc = tmfoErr;
+		}
+		else
+		{
+			newRefNum = openFiles.Alloc();
+			openFiles[newRefNum] = std::move(handle);
+
+			if (AccessTrace::IsRecording())
+			{
+				AccessTrace::OnOpen(newRefNum, *openFiles[newRefNum]);
+			}
+
+			if (IOStats::IsEnabled())
+			{
+				IOStats::OnOpen(newRefNum, *openFiles[newRefNum], (std::chrono::steady_clock::now() - openStart) / std::chrono::nanoseconds(1));
+			}
+
+			PublishForkHandle(newRefNum, openFiles[newRefNum].get());
+		}
+	}
+
 	if (rc != noErr)
 	{
-		openFiles.Dispose(newRefNum);
-		newRefNum = -1;
 		LOG << "Failed to open " << spec->cName << "\n";
 	}
 	else
@@ -231,13 +441,156 @@ OSErr FindFolder(short vRefNum, OSType folderType, Boolean createFolder, short*
 		fs::create_directories(path);
 	}
 
+	std::lock_guard<std::recursive_mutex> lock(volumesMutex);
 	*foundVRefNum = 0;//GetVolumeID(path);
 	*foundDirID = dynamic_cast<HostVolume*>(volumes.at(0).get())->GetDirectoryID(path);
 	return noErr;
 }
 
+OSErr Pomme_MountPackVolume(const char* hostPath, short* vRefNum)
+{
+	if (!hostPath || !vRefNum)
+	{
+		return paramErr;
+	}
+
+	std::lock_guard<std::recursive_mutex> lock(volumesMutex);
+	short newVRefNum = (short) volumes.size();
+
+	try
+	{
+		volumes.push_back(std::make_unique<PackVolume>(newVRefNum, fs::path(hostPath)));
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << __func__ << ": " << hostPath << ": " << e.what() << "\n";
+		return ioErr;
+	}
+
+	*vRefNum = newVRefNum;
+	return noErr;
+}
+
+OSErr Pomme_MountMemoryVolume(short* vRefNum)
+{
+	if (!vRefNum)
+	{
+		return paramErr;
+	}
+
+	std::lock_guard<std::recursive_mutex> lock(volumesMutex);
+	*vRefNum = (short) volumes.size();
+	volumes.push_back(std::make_unique<MemoryVolume>(*vRefNum));
+	return noErr;
+}
+
+OSErr Pomme_AddMemoryVolumeFile(short vRefNum, const char* path,
+	const void* dataFork, Size dataForkLength,
+	const void* resourceFork, Size resourceForkLength)
+{
+	std::lock_guard<std::recursive_mutex> lock(volumesMutex);
+
+	if (!IsVolumeLegal(vRefNum))
+	{
+		return nsvErr;
+	}
+
+	auto* memoryVolume = dynamic_cast<MemoryVolume*>(volumes.at(vRefNum).get());
+
+	if (!memoryVolume || !path
+		|| dataForkLength < 0 || (!dataFork && dataForkLength > 0)
+		|| resourceForkLength < 0 || (!resourceFork && resourceForkLength > 0))
+	{
+		return paramErr;
+	}
+
+	u8string macPath((const char8_t*) path);
+	OSErr err = noErr;
+
+	if (dataFork)
+	{
+		const char* bytes = (const char*) dataFork;
+		err = memoryVolume->AddFork(macPath, DataFork, std::vector<char>(bytes, bytes + dataForkLength));
+	}
+
+	if (resourceFork && err == noErr)
+	{
+		const char* bytes = (const char*) resourceFork;
+		err = memoryVolume->AddFork(macPath, ResourceFork, std::vector<char>(bytes, bytes + resourceForkLength));
+	}
+
+	return err;
+}
+
+void Pomme_StartIOStats(const char* dumpPathAtShutdown)
+{
+	IOStats::Enable(dumpPathAtShutdown ? fs::path(dumpPathAtShutdown) : fs::path());
+}
+
+OSErr Pomme_DumpIOStats(const char* hostPath)
+{
+	if (!hostPath)
+	{
+		IOStats::DumpJSON(std::cerr);
+		return noErr;
+	}
+
+	std::ofstream out(hostPath);
+	IOStats::DumpJSON(out);
+	return out.good() ? noErr : ioErr;
+}
+
+void Pomme_StartAccessTrace(const char* savePathAtShutdown)
+{
+	AccessTrace::StartRecording(savePathAtShutdown ? fs::path(savePathAtShutdown) : fs::path());
+}
+
+OSErr Pomme_SaveAccessTrace(const char* hostPath)
+{
+	if (!hostPath)
+	{
+		return paramErr;
+	}
+
+	std::ofstream out(hostPath);
+	return AccessTrace::Save(out) ? noErr : ioErr;
+}
+
+OSErr Pomme_ReplayAccessTrace(const char* hostPath)
+{
+	if (!hostPath)
+	{
+		return paramErr;
+	}
+
+	return AccessTrace::StartReplay(hostPath) ? noErr : fnfErr;
+}
+
+OSErr Pomme_SetWriteBehind(short refNum, Boolean enable)
+{
+	if (!IsRefNumLegal(refNum)) return rfNumErr;
+	if (!IsStreamOpen(refNum)) return fnOpnErr;
+
+	ForkHandle& handle = GetForkHandle(refNum);
+	return enable
+		? WriteBehind::Enable(refNum, handle)
+		: WriteBehind::Disable(refNum, handle);
+}
+
+OSErr Pomme_SyncFile(short refNum)
+{
+	if (!IsRefNumLegal(refNum)) return rfNumErr;
+	if (!IsStreamOpen(refNum)) return fnOpnErr;
+
+	OSErr err = WriteBehind::Flush(refNum);
+	OSErr syncErr = GetForkHandle(refNum).Sync();
+	return err != noErr ? err : syncErr;
+}
+
 OSErr DirCreate(short vRefNum, long parentDirID, const char* cstrDirectoryName, long* createdDirID)
 {
+	std::lock_guard<std::recursive_mutex> lock(volumesMutex);
+
 	if (!IsVolumeLegal(vRefNum))
 	{
 		return (OSErr)nsvErr;
@@ -251,6 +604,9 @@ OSErr DirCreate(short vRefNum, long parentDirID, const char* cstrDirectoryName,
 
 OSErr FSpCreate(const FSSpec* spec, OSType creator, OSType fileType, ScriptCode scriptTag)
 {
+	WriteBehind::WaitForPendingCloses();
+
+	std::lock_guard<std::recursive_mutex> lock(volumesMutex);
 	return IsVolumeLegal(spec->vRefNum)
 		? volumes.at(spec->vRefNum)->FSpCreate(spec, creator, fileType, scriptTag)
 		: (OSErr)nsvErr;
@@ -258,11 +614,24 @@ OSErr FSpCreate(const FSSpec* spec, OSType creator, OSType fileType, ScriptCode
 
 OSErr FSpDelete(const FSSpec* spec)
 {
+	WriteBehind::WaitForPendingCloses();
+
+	std::lock_guard<std::recursive_mutex> lock(volumesMutex);
 	return IsVolumeLegal(spec->vRefNum)
 		? volumes.at(spec->vRefNum)->FSpDelete(spec)
 		: (OSErr)nsvErr;
 }
 
+OSErr Pomme::Files::CreateResourceFork(const FSSpec* spec, OSType creator, OSType fileType)
+{
+	WriteBehind::WaitForPendingCloses();
+
+	std::lock_guard<std::recursive_mutex> lock(volumesMutex);
+	return IsVolumeLegal(spec->vRefNum)
+		? volumes.at(spec->vRefNum)->CreateResourceFork(spec, creator, fileType)
+		: (OSErr)nsvErr;
+}
+
 OSErr ResolveAlias(const FSSpec* spec, AliasHandle alias, FSSpec* target, Boolean* wasChanged)
 {
 	*wasChanged = false;
@@ -420,5 +789,6 @@ OSErr SetFPos(short refNum, short posMode, long filePos)
 
 FSSpec Pomme::Files::HostPathToFSSpec(const fs::path& fullPath)
 {
+	std::lock_guard<std::recursive_mutex> lock(volumesMutex);
 	return dynamic_cast<HostVolume*>(volumes[0].get())->ToFSSpec(fullPath);
 }
@@ -2,38 +2,313 @@
 #include "PommeDebug.h"
 #include "PommeFiles.h"
 #include "Files/HostVolume.h"
+#include "Platform/Posix/PommePosix.h"
 #include "Utilities/bigendianstreams.h"
 #include "Utilities/StringUtils.h"
 
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <memory>
+#include <mutex>
 
 #define LOG POMME_GENLOG(POMME_DEBUG_FILES, "HOST")
 
 using namespace Pomme;
 using namespace Pomme::Files;
 
+// Where a resource fork lives inside an AppleDouble file
+struct ADFResourceForkEntry
+{
+	std::streamoff offset = 0;
+	std::streamoff length = 0;
+	std::streamoff lengthFieldOffset = -1;		// where `length` is stored in the AppleDouble header
+};
+
+static constexpr UInt32 kADFMagic = 0x00051607;
+static constexpr UInt32 kADFVersion = 0x00020000;
+static constexpr int kADFHeaderSize = 24;		// magic, version, filler; followed by the entry count
+static constexpr int kADFEntrySize = 12;		// ID, offset, length
+
+static UInt32 ReadBE32(const char* p)
+{
+	return (UInt32((Byte) p[0]) << 24) | (UInt32((Byte) p[1]) << 16) | (UInt32((Byte) p[2]) << 8) | UInt32((Byte) p[3]);
+}
+
+static void WriteBE32(char* p, UInt32 value)
+{
+	p[0] = char(value >> 24);
+	p[1] = char(value >> 16);
+	p[2] = char(value >> 8);
+	p[3] = char(value);
+}
+
 struct HostForkHandle : public ForkHandle
 {
+#if POMME_POSIX_IO
+	Pomme::Platform::Posix::FileDescriptorBuf backingBuf;
+	std::iostream backingStream;
+#else
 	std::fstream backingStream;
+#endif
+	fs::path hostPath;
+
+#if POMME_MMAP && !POMME_POSIX_IO
+	// Read-only descriptor used to map resources straight from the file
+	int mappingFD = -1;
+#endif
+
+#if !POMME_POSIX_IO
+	// Without pread, positional reads go through streams of their own, so that they never move backingStream's position.
+	// Each concurrent reader checks one out, and puts it back for the next read.
+	std::mutex readersMutex;
+	std::vector<std::unique_ptr<std::ifstream>> idleReaders;
+#endif
+
+	// Only meaningful for resource forks; data forks span the whole file
+	ADFResourceForkEntry adfEntry;
+	bool hasTrailingADFEntries = false;		// the fork can't grow without overwriting them
+
+	static std::ios::openmode GetOpenMode(char perm)
+	{
+		std::ios::openmode openmode = std::ios::binary;
+		if (perm & fsWrPerm) openmode |= std::ios::out;
+		if (perm & fsRdPerm) openmode |= std::ios::in;
+		return openmode;
+	}
 
 public:
 	HostForkHandle(ForkType theForkType, char perm, fs::path& path, const FSSpec& theSpec)
 		: ForkHandle(theForkType, perm, theSpec)
+#if POMME_POSIX_IO
+		, backingBuf(path, GetOpenMode(perm))
+		, backingStream(&backingBuf)
+#else
+		, backingStream(path, GetOpenMode(perm))
+#endif
+		, hostPath(path)
 	{
-		std::ios::openmode openmode = std::ios::binary;
-		if (permission & fsWrPerm) openmode |= std::ios::out;
-		if (permission & fsRdPerm) openmode |= std::ios::in;
-
-		backingStream = std::fstream(path, openmode);
+#if POMME_POSIX_IO
+		if (!backingBuf.IsOpen())
+		{
+			backingStream.setstate(std::ios::badbit);
+		}
+#elif POMME_MMAP
+		if (!(permission & fsWrPerm))
+		{
+			mappingFD = Pomme::Platform::Posix::OpenFileForMapping(path);
+		}
+#endif
 	}
 
-	virtual ~HostForkHandle() = default;
+	virtual ~HostForkHandle()
+	{
+#if POMME_MMAP && !POMME_POSIX_IO
+		Pomme::Platform::Posix::CloseFileForMapping(mappingFD);
+#endif
+	}
 
 	virtual std::iostream& GetStream() override
 	{
 		return backingStream;
 	}
+
+	virtual const fs::path* GetHostPath() const override
+	{
+		return &hostPath;
+	}
+
+#if POMME_POSIX_IO
+	virtual size_t ReadAt(std::streamoff offset, char* buffer, size_t length) override
+	{
+		return backingBuf.ReadAt(offset, buffer, length);
+	}
+#else
+	virtual size_t ReadAt(std::streamoff offset, char* buffer, size_t length) override
+	{
+		std::unique_ptr<std::ifstream> reader;
+
+		{
+			std::lock_guard<std::mutex> lock(readersMutex);
+			if (!idleReaders.empty())
+			{
+				reader = std::move(idleReaders.back());
+				idleReaders.pop_back();
+			}
+		}
+
+		if (!reader)
+		{
+			reader = std::make_unique<std::ifstream>(hostPath, std::ios::binary);
+		}
+
+		// Writes through backingStream are flushed by whoever makes them (see UpdateResFile), so the reader sees them
+		reader->clear();
+		reader->seekg(offset, std::ios::beg);
+		reader->read(buffer, (std::streamsize) length);
+		size_t got = (size_t) reader->gcount();
+
+		std::lock_guard<std::mutex> lock(readersMutex);
+		idleReaders.push_back(std::move(reader));
+		return got;
+	}
+#endif
+
+#if POMME_MMAP
+	virtual char* MapRange(std::streamoff offset, size_t length, void** mappingBase, size_t* mappingLength) override
+	{
+#if POMME_POSIX_IO
+		// Only map read-only forks, so that the app can't observe its own writes through stale mappings
+		int mappingFD = (permission & fsWrPerm) ? -1 : backingBuf.GetFD();
+#endif
+		return Pomme::Platform::Posix::MapFileRange(mappingFD, offset, length, mappingBase, mappingLength);
+	}
+#endif
+
+	virtual OSErr Sync() override
+	{
+#if POMME_POSIX_IO
+		return backingBuf.SyncToStorage() ? noErr : ioErr;
+#else
+		// std::fstream can't fsync, so this only goes as far as the OS
+		backingStream.flush();
+		return backingStream.bad() ? ioErr : noErr;
+#endif
+	}
+
+	void SetADFResourceForkEntry(const ADFResourceForkEntry& entry)
+	{
+		adfEntry = entry;
+
+		std::error_code ec;
+		auto fileSize = (std::streamoff) fs::file_size(hostPath, ec);
+		hasTrailingADFEntries = !ec && fileSize > entry.offset + entry.length;
+	}
+
+	virtual bool CanGrow() const override
+	{
+		return (permission & fsWrPerm) && !hasTrailingADFEntries;
+	}
+
+	virtual OSErr SetContentsLength(std::streamoff length) override
+	{
+		if (!(permission & fsWrPerm))
+		{
+			return wrPermErr;
+		}
+
+		if (forkType == ResourceFork)
+		{
+			char lengthField[4];
+			WriteBE32(lengthField, (UInt32) length);
+
+			backingStream.seekp(adfEntry.lengthFieldOffset, std::ios::beg);
+			backingStream.write(lengthField, sizeof(lengthField));
+			backingStream.flush();
+			adfEntry.length = length;
+		}
+
+		return backingStream.good() ? noErr : ioErr;
+	}
+
+	virtual OSErr ReplaceContents(const char* data, size_t length) override
+	{
+		if (!(permission & fsWrPerm))
+		{
+			return wrPermErr;
+		}
+
+		backingStream.flush();
+
+		// Keep whatever surrounds the contents: the AppleDouble header before, other entries after
+		std::error_code ec;
+		std::streamoff fileSize = (std::streamoff) fs::file_size(hostPath, ec);
+		std::streamoff contentsEnd = forkType == ResourceFork ? adfEntry.offset + adfEntry.length : fileSize;
+
+		if (ec || contentsEnd > fileSize)
+		{
+			return ioErr;
+		}
+
+		std::string prefix(adfEntry.offset, '\0');
+		std::string suffix(fileSize - contentsEnd, '\0');
+		if (ReadAt(0, prefix.data(), prefix.size()) != prefix.size()
+			|| ReadAt(contentsEnd, suffix.data(), suffix.size()) != suffix.size())
+		{
+			return ioErr;
+		}
+
+		if (forkType == ResourceFork)
+		{
+			// Entries stored after the resource fork move by however much the fork grows or shrinks
+			std::streamoff delta = std::streamoff(length) - adfEntry.length;
+			int numEntries = (Byte(prefix[kADFHeaderSize]) << 8) | Byte(prefix[kADFHeaderSize + 1]);
+
+			for (int i = 0; i < numEntries; i++)
+			{
+				char* entry = prefix.data() + kADFHeaderSize + 2 + i * kADFEntrySize;
+				UInt32 entryOffset = ReadBE32(entry + 4);
+				bool isResourceFork = entry + 8 == prefix.data() + adfEntry.lengthFieldOffset;
+				if (entryOffset >= contentsEnd && !isResourceFork)
+				{
+					WriteBE32(entry + 4, UInt32(entryOffset + delta));
+				}
+			}
+
+			WriteBE32(prefix.data() + adfEntry.lengthFieldOffset, (UInt32) length);
+		}
+
+		// Write the new file next to the old one, then swap it in
+		fs::path tempPath = hostPath;
+		tempPath += ".pommetmp";
+
+		{
+			std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+			out.write(prefix.data(), prefix.size());
+			out.write(data, length);
+			out.write(suffix.data(), suffix.size());
+
+			if (!out.good())
+			{
+				out.close();
+				fs::remove(tempPath, ec);
+				return ioErr;
+			}
+		}
+
+#if !POMME_POSIX_IO
+		// The readers still point to the old file (and on Windows, they'd keep it from being replaced)
+		{
+			std::lock_guard<std::mutex> lock(readersMutex);
+			idleReaders.clear();
+		}
+#endif
+
+		fs::rename(tempPath, hostPath, ec);
+		if (ec)
+		{
+			fs::remove(tempPath, ec);
+			return ioErr;
+		}
+
+		// Our descriptor still points to the old file
+#if POMME_POSIX_IO
+		if (!backingBuf.Reopen(hostPath, GetOpenMode(permission)))
+		{
+			backingStream.setstate(std::ios::badbit);
+			return ioErr;
+		}
+		backingStream.clear();
+#else
+		backingStream.close();
+		backingStream.clear();
+		backingStream.open(hostPath, GetOpenMode(permission));
+#endif
+
+		adfEntry.length = (std::streamoff) length;
+		backingStream.seekg(adfEntry.offset, std::ios::beg);
+		return backingStream.good() ? noErr : ioErr;
+	}
 };
 
 
@@ -41,7 +316,13 @@ HostVolume::HostVolume(short vRefNum)
 	: Volume(vRefNum)
 {
 	// default directory (ID 0)
-	directories.push_back(fs::current_path());
+	GetDirectoryID(fs::current_path());
+}
+
+// Key under which a directory is cached, so that "a/b" and "a/b/" share an entry
+static fs::path::string_type DirectoryKey(const fs::path& dirPath)
+{
+	return (dirPath / "").lexically_normal().native();
 }
 
 //-----------------------------------------------------------------------------
@@ -49,20 +330,24 @@ HostVolume::HostVolume(short vRefNum)
 
 long HostVolume::GetDirectoryID(const fs::path& dirPath)
 {
-	if (fs::exists(dirPath) && !fs::is_directory(dirPath))
+	auto key = DirectoryKey(dirPath);
+
+	auto it = directoryIDs.find(key);
+	if (it != directoryIDs.end())
 	{
-		std::cerr << "Warning: GetDirectoryID should only be used on directories! " << dirPath << "\n";
+		return it->second;
 	}
 
-	auto it = std::find(directories.begin(), directories.end(), dirPath);
-	if (it != directories.end())
+	if (fs::exists(dirPath) && !fs::is_directory(dirPath))
 	{
-		return std::distance(directories.begin(), it);
+		std::cerr << "Warning: GetDirectoryID should only be used on directories! " << dirPath << "\n";
 	}
 
+	long dirID = (long) directories.size();
 	directories.emplace_back(dirPath);
-	LOG << "directory " << directories.size() - 1 << ": " << dirPath << "\n";
-	return (long) directories.size() - 1;
+	directoryIDs.emplace(std::move(key), dirID);
+	LOG << "directory " << dirID << ": " << dirPath << "\n";
+	return dirID;
 }
 
 //-----------------------------------------------------------------------------
@@ -92,11 +377,11 @@ FSSpec HostVolume::ToFSSpec(const fs::path& fullPath)
 	return spec;
 }
 
-static void ADFJumpToResourceFork(std::istream& stream)
+static ADFResourceForkEntry ADFJumpToResourceFork(std::istream& stream)
 {
 	auto f = Pomme::BigEndianIStream(stream);
 
-	if (0x0005160700020000ULL != f.Read<UInt64>())
+	if (((UInt64(kADFMagic) << 32) | kADFVersion) != f.Read<UInt64>())
 	{
 		throw std::runtime_error("No ADF magic");
 	}
@@ -107,12 +392,15 @@ static void ADFJumpToResourceFork(std::istream& stream)
 	{
 		auto entryID = f.Read<UInt32>();
 		auto offset = f.Read<UInt32>();
-		f.Skip(4); // length
+		ADFResourceForkEntry entry;
+		entry.lengthFieldOffset = f.Tell();
+		entry.length = f.Read<UInt32>();
 		if (entryID == 2)
 		{
 			// Found entry ID 2 (resource fork)
+			entry.offset = offset;
 			f.Goto(offset);
-			return;
+			return entry;
 		}
 	}
 
@@ -127,12 +415,6 @@ OSErr HostVolume::OpenFork(const FSSpec* spec, ForkType forkType, char permissio
 		return unimpErr;
 	}
 
-	if ((permission & fsWrPerm) && forkType != ForkType::DataFork)
-	{
-		// TODO: opening resource fork for writing isn't implemented yet
-		return unimpErr;
-	}
-
 	auto path = ToPath(spec->parID, spec->cName);
 
 	if (forkType == DataFork)
@@ -151,12 +433,18 @@ OSErr HostVolume::OpenFork(const FSSpec* spec, ForkType forkType, char permissio
 		{
 			return fnfErr;
 		}
-		handle = std::make_unique<HostForkHandle>(ResourceFork, permission, path, *spec);
-		if (!handle->GetStream().good())
+		// The AppleDouble header must stay intact, so never truncate the file
+		if (permission & fsWrPerm)
+		{
+			permission |= fsRdPerm;
+		}
+		auto hostHandle = std::make_unique<HostForkHandle>(ResourceFork, permission, path, *spec);
+		if (!hostHandle->GetStream().good())
 		{
 			return ioErr;
 		}
-		ADFJumpToResourceFork(handle->GetStream());
+		hostHandle->SetADFResourceForkEntry(ADFJumpToResourceFork(hostHandle->GetStream()));
+		handle = std::move(hostHandle);
 	}
 
 	if (!handle->GetStream().good())
@@ -167,10 +455,63 @@ OSErr HostVolume::OpenFork(const FSSpec* spec, ForkType forkType, char permissio
 	return noErr;
 }
 
-static bool CaseInsensitiveAppendToPath(fs::path& path, const u8string& element, bool skipFiles = false)
+const HostVolume::DirectoryListing* HostVolume::GetDirectoryListing(const fs::path& dirPath)
+{
+	std::error_code ec;
+	auto mtime = fs::last_write_time(dirPath, ec);
+
+	if (ec || !fs::is_directory(dirPath, ec))
+	{
+		return nullptr;
+	}
+
+	auto [it, inserted] = listings.try_emplace(DirectoryKey(dirPath));
+	DirectoryListing& listing = it->second;
+
+	if (!inserted && listing.mtime == mtime)
+	{
+		return &listing;
+	}
+
+	listing = {};
+	listing.mtime = mtime;
+
+	for (const auto& candidate : fs::directory_iterator(dirPath, ec))
+	{
+		fs::path candidateFilename = candidate.path().filename();
+		listing.exactNames.insert(candidateFilename.u8string());
+
+		bool isDirectory = candidate.is_directory(ec);
+
+		// It might be an AppleDouble resource fork ("file.rsrc")
+		if (!isDirectory && candidateFilename.extension() == ".rsrc")
+		{
+			candidateFilename.replace_extension("");
+		}
+
+		// Uppercase filename for case-insensitive comparisons
+		u8string uppercaseFilename = UppercaseCopy(candidateFilename.u8string());
+
+		if (isDirectory)
+		{
+			listing.uppercaseDirectoryNames.emplace(uppercaseFilename, candidateFilename);
+		}
+		listing.uppercaseNames.emplace(std::move(uppercaseFilename), std::move(candidateFilename));
+	}
+
+	return &listing;
+}
+
+void HostVolume::InvalidateDirectoryListing(const fs::path& dirPath)
+{
+	listings.erase(DirectoryKey(dirPath));
+}
+
+bool HostVolume::CaseInsensitiveAppendToPath(fs::path& path, const u8string& element, bool skipFiles)
 {
 	fs::path naiveConcat = path / element;
 
+#if POMME_CASE_SENSITIVE_FSSPEC
 	if (!fs::exists(path))
 	{
 		path = naiveConcat;
@@ -183,7 +524,6 @@ static bool CaseInsensitiveAppendToPath(fs::path& path, const u8string& element,
 		return true;
 	}
 
-#if POMME_CASE_SENSITIVE_FSSPEC
 	if (!skipFiles)
 	{
 		fs::path candidateResourcePath = naiveConcat;
@@ -195,32 +535,35 @@ static bool CaseInsensitiveAppendToPath(fs::path& path, const u8string& element,
 		}
 	}
 #else
-	// Convert path element to uppercase for case-insensitive comparisons
-	const auto uppercaseElement = UppercaseCopy(element);
+	const DirectoryListing* listing = GetDirectoryListing(path);
 
-	for (const auto& candidate : fs::directory_iterator(path))
+	if (!listing)
 	{
-		if (skipFiles && !candidate.is_directory())
-		{
-			continue;
-		}
+		path = naiveConcat;
+		return false;
+	}
 
-		fs::path candidateFilename = candidate.path().filename();
+	if (listing->exactNames.contains(element))
+	{
+		path = naiveConcat;
+		return true;
+	}
 
-		// It might be an AppleDouble resource fork ("file.rsrc")
-		if (candidate.is_regular_file() && candidateFilename.extension() == ".rsrc")
-		{
-			candidateFilename.replace_extension("");
-		}
+	// Case-insensitive lookup
+	const auto& candidates = skipFiles ? listing->uppercaseDirectoryNames : listing->uppercaseNames;
+	auto it = candidates.find(UppercaseCopy(element));
 
-		// Convert candidate filename to uppercase for case-insensitive comparison
-		const u8string uppercaseCandidateFilename = UppercaseCopy(candidateFilename.u8string());
+	if (it != candidates.end())
+	{
+		path /= it->second;
+		return true;
+	}
 
-		if (uppercaseElement == uppercaseCandidateFilename)
-		{
-			path /= candidateFilename;
-			return true;
-		}
+	// The host filesystem may still know better (e.g. Unicode normalization)
+	if (fs::exists(naiveConcat))
+	{
+		path = naiveConcat;
+		return true;
 	}
 #endif
 
@@ -304,6 +647,8 @@ OSErr HostVolume::DirCreate(long parentDirID, const u8string& directoryName, lon
 		return ioErr;
 	}
 
+	InvalidateDirectoryListing(path.parent_path());
+
 	if (createdDirID)
 	{
 		*createdDirID = GetDirectoryID(path);
@@ -319,16 +664,82 @@ OSErr HostVolume::FSpCreate(const FSSpec* spec, OSType creator, OSType fileType,
 	(void) fileType;
 	(void) scriptTag;
 
-	std::ofstream df(ToPath(spec->parID, spec->cName));
+	auto path = ToPath(spec->parID, spec->cName);
+	std::ofstream df(path);
 	df.close();
+	InvalidateDirectoryListing(path.parent_path());
 	// TODO: we could write an AppleDouble file to save the creator/filetype.
 	return noErr;
 }
 
+OSErr HostVolume::CreateResourceFork(const FSSpec* spec, OSType creator, OSType fileType)
+{
+	auto path = ToPath(spec->parID, spec->cName);
+	auto rsrcPath = path;
+	rsrcPath += ".rsrc";
+
+	if (fs::exists(rsrcPath))
+	{
+		return dupFNErr;
+	}
+
+	if (!fs::exists(path))
+	{
+		std::ofstream df(path);
+		if (!df.good())
+		{
+			return ioErr;
+		}
+	}
+
+	// AppleDouble file with a Finder info entry (9) holding the type and creator,
+	// followed by an empty resource fork entry (2). The resource fork comes last so that it can grow in place.
+	constexpr int numEntries = 2;
+	constexpr int finderInfoOffset = kADFHeaderSize + 2 + numEntries * kADFEntrySize;
+	constexpr int finderInfoLength = 32;
+	constexpr int resourceForkOffset = finderInfoOffset + finderInfoLength;
+
+	char adf[resourceForkOffset] = {};
+	WriteBE32(adf + 0, kADFMagic);
+	WriteBE32(adf + 4, kADFVersion);
+	adf[kADFHeaderSize + 1] = numEntries;
+
+	char* entry = adf + kADFHeaderSize + 2;
+	WriteBE32(entry + 0, 9);
+	WriteBE32(entry + 4, finderInfoOffset);
+	WriteBE32(entry + 8, finderInfoLength);
+	entry += kADFEntrySize;
+	WriteBE32(entry + 0, 2);
+	WriteBE32(entry + 4, resourceForkOffset);
+	WriteBE32(entry + 8, 0);
+
+	WriteBE32(adf + finderInfoOffset + 0, fileType);
+	WriteBE32(adf + finderInfoOffset + 4, creator);
+
+	std::ofstream rf(rsrcPath, std::ios::binary);
+	rf.write(adf, sizeof(adf));
+	if (!rf.good())
+	{
+		return ioErr;
+	}
+
+	InvalidateDirectoryListing(path.parent_path());
+	LOG << __func__ << ": created " << rsrcPath << "\n";
+	return noErr;
+}
+
 OSErr HostVolume::FSpDelete(const FSSpec* spec)
 {
 	auto path = ToPath(spec->parID, spec->cName);
 
+	InvalidateDirectoryListing(path.parent_path());
+
+	// Take the resource fork along, if any
+	auto rsrcPath = path;
+	rsrcPath += ".rsrc";
+	std::error_code ec;
+	fs::remove(rsrcPath, ec);
+
 	if (fs::remove(path))
 		return noErr;
 	else
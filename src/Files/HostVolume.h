@@ -3,6 +3,8 @@
 #include "Files/Volume.h"
 #include "CompilerSupport/filesystem.h"
 #include "Utilities/StringUtils.h"
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 namespace Pomme::Files
@@ -13,11 +15,30 @@ namespace Pomme::Files
 	 */
 	class HostVolume : public Volume
 	{
+		// Contents of a host directory, for case-insensitive lookups without rescanning it every time
+		struct DirectoryListing
+		{
+			fs::file_time_type mtime;
+			std::unordered_set<u8string> exactNames;
+			std::unordered_map<u8string, fs::path> uppercaseNames;		// ".rsrc" stripped from AppleDouble files
+			std::unordered_map<u8string, fs::path> uppercaseDirectoryNames;
+		};
+
 		std::vector<fs::path> directories;
+		std::unordered_map<fs::path::string_type, long> directoryIDs;
+		std::unordered_map<fs::path::string_type, DirectoryListing> listings;
 
 		fs::path ToPath(long parID, const char* name);
 		fs::path ToPath(long parID, const u8string& name);
 
+		// Returns nullptr if the directory doesn't exist.
+		// Listings are reused until the directory's modification time changes.
+		const DirectoryListing* GetDirectoryListing(const fs::path& dirPath);
+
+		void InvalidateDirectoryListing(const fs::path& dirPath);
+
+		bool CaseInsensitiveAppendToPath(fs::path& path, const u8string& element, bool skipFiles = false);
+
 	public:
 		explicit HostVolume(short vRefNum);
 
@@ -39,6 +60,8 @@ namespace Pomme::Files
 
 		OSErr FSpCreate(const FSSpec* spec, OSType creator, OSType fileType, ScriptCode scriptTag) override;
 
+		OSErr CreateResourceFork(const FSSpec* spec, OSType creator, OSType fileType) override;
+
 		OSErr FSpDelete(const FSSpec* spec) override;
 
 		OSErr DirCreate(long parentDirID, const u8string& directoryName, long* createdDirID) override;
@@ -0,0 +1,362 @@
+#include "PommeFiles.h"
+#include "Files/IOStats.h"
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <unordered_map>
+
+using namespace Pomme::Files;
+using namespace Pomme::Files::IOStats;
+
+namespace
+{
+	// Times a forwarded stream buffer call
+	class ScopedTimer
+	{
+		uint64_t& total;
+		std::chrono::steady_clock::time_point start;
+
+	public:
+		explicit ScopedTimer(uint64_t& theTotal)
+			: total(theTotal)
+			, start(std::chrono::steady_clock::now())
+		{}
+
+		~ScopedTimer()
+		{
+			total += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+		}
+	};
+
+	// Unbuffered stream buffer that forwards every call to the fork's own buffer and counts it.
+	// It keeps no get/put area of its own, so each parser read shows up as a separate call.
+	class CountingStreamBuf : public std::streambuf
+	{
+		std::streambuf* inner;
+		FileStats& stats;
+
+	public:
+		CountingStreamBuf(std::streambuf* theInner, FileStats& theStats)
+			: inner(theInner)
+			, stats(theStats)
+		{}
+
+		std::streambuf* GetInner() const { return inner; }
+
+	protected:
+		virtual int_type underflow() override
+		{
+			ScopedTimer timer(stats.ioNanoseconds);
+			return inner->sgetc();
+		}
+
+		virtual int_type uflow() override
+		{
+			ScopedTimer timer(stats.ioNanoseconds);
+			int_type c = inner->sbumpc();
+			stats.readCalls++;
+			if (!traits_type::eq_int_type(c, traits_type::eof()))
+				stats.bytesRead++;
+			return c;
+		}
+
+		virtual std::streamsize xsgetn(char_type* s, std::streamsize n) override
+		{
+			ScopedTimer timer(stats.ioNanoseconds);
+			std::streamsize got = inner->sgetn(s, n);
+			stats.readCalls++;
+			stats.bytesRead += got;
+			return got;
+		}
+
+		virtual int_type pbackfail(int_type c) override
+		{
+			return traits_type::eq_int_type(c, traits_type::eof())
+				? inner->sungetc()
+				: inner->sputbackc(traits_type::to_char_type(c));
+		}
+
+		virtual std::streamsize showmanyc() override
+		{
+			return inner->in_avail();
+		}
+
+		virtual int_type overflow(int_type c) override
+		{
+			if (traits_type::eq_int_type(c, traits_type::eof()))
+				return traits_type::not_eof(c);
+
+			ScopedTimer timer(stats.ioNanoseconds);
+			stats.writeCalls++;
+			int_type result = inner->sputc(traits_type::to_char_type(c));
+			if (!traits_type::eq_int_type(result, traits_type::eof()))
+				stats.bytesWritten++;
+			return result;
+		}
+
+		virtual std::streamsize xsputn(const char_type* s, std::streamsize n) override
+		{
+			ScopedTimer timer(stats.ioNanoseconds);
+			std::streamsize written = inner->sputn(s, n);
+			stats.writeCalls++;
+			stats.bytesWritten += written;
+			return written;
+		}
+
+		virtual pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override
+		{
+			if (off == 0 && dir == std::ios_base::cur)
+			{
+				stats.tells++;
+				return inner->pubseekoff(off, dir, which);
+			}
+
+			ScopedTimer timer(stats.ioNanoseconds);
+			stats.seeks++;
+			return inner->pubseekoff(off, dir, which);
+		}
+
+		virtual pos_type seekpos(pos_type pos, std::ios_base::openmode which) override
+		{
+			ScopedTimer timer(stats.ioNanoseconds);
+			stats.seeks++;
+			return inner->pubseekpos(pos, which);
+		}
+
+		virtual int sync() override
+		{
+			ScopedTimer timer(stats.ioNanoseconds);
+			return inner->pubsync();
+		}
+	};
+
+	struct OpenForkStats
+	{
+		std::string path;
+		ForkType forkType;
+		FileStats stats;
+		std::unique_ptr<CountingStreamBuf> streamBuf;
+	};
+}
+
+static bool gEnabled = false;
+static fs::path gDumpPathAtShutdown;
+
+// Guards the tables below. The counters of an open fork are updated by its stream buffer without
+// locking, since a fork's stream is only ever used by one thread at a time.
+static std::mutex gStatsMutex;
+static std::unordered_map<short, OpenForkStats> gOpenForks;
+static std::map<std::pair<std::string, ForkType>, FileStats> gClosedForkTotals;
+
+FileStats& FileStats::operator+=(const FileStats& other)
+{
+	opens				+= other.opens;
+	openNanoseconds		+= other.openNanoseconds;
+	readCalls			+= other.readCalls;
+	bytesRead			+= other.bytesRead;
+	writeCalls			+= other.writeCalls;
+	bytesWritten		+= other.bytesWritten;
+	seeks				+= other.seeks;
+	tells				+= other.tells;
+	mappedRanges		+= other.mappedRanges;
+	bytesMapped			+= other.bytesMapped;
+	ioNanoseconds		+= other.ioNanoseconds;
+	return *this;
+}
+
+// Host path if there's one, otherwise a path-like description of the FSSpec
+static std::string DescribeFork(const ForkHandle& handle)
+{
+	if (const fs::path* hostPath = handle.GetHostPath())
+	{
+		return (const char*) hostPath->u8string().c_str();
+	}
+
+	return "volume " + std::to_string(handle.spec.vRefNum)
+		+ ", directory " + std::to_string(handle.spec.parID)
+		+ ", " + handle.spec.cName;
+}
+
+static void WriteJSONString(std::ostream& out, const std::string& s)
+{
+	out << '"';
+	for (unsigned char c : s)
+	{
+		if (c == '"' || c == '\\')
+		{
+			out << '\\' << c;
+		}
+		else if (c < 0x20)
+		{
+			static const char* hex = "0123456789abcdef";
+			out << "\\u00" << hex[c >> 4] << hex[c & 15];
+		}
+		else
+		{
+			out << c;
+		}
+	}
+	out << '"';
+}
+
+static void WriteJSONStats(std::ostream& out, const FileStats& s)
+{
+	out << "\"opens\": " << s.opens
+		<< ", \"openMicroseconds\": " << s.openNanoseconds / 1000
+		<< ", \"readCalls\": " << s.readCalls
+		<< ", \"bytesRead\": " << s.bytesRead
+		<< ", \"writeCalls\": " << s.writeCalls
+		<< ", \"bytesWritten\": " << s.bytesWritten
+		<< ", \"seeks\": " << s.seeks
+		<< ", \"tells\": " << s.tells
+		<< ", \"mappedRanges\": " << s.mappedRanges
+		<< ", \"bytesMapped\": " << s.bytesMapped
+		<< ", \"ioMicroseconds\": " << s.ioNanoseconds / 1000;
+}
+
+//-----------------------------------------------------------------------------
+
+void IOStats::Enable(const fs::path& dumpPathAtShutdown)
+{
+	gEnabled = true;
+	gDumpPathAtShutdown = dumpPathAtShutdown;
+}
+
+bool IOStats::IsEnabled()
+{
+	return gEnabled;
+}
+
+void IOStats::OnOpen(short refNum, ForkHandle& handle, uint64_t openNanoseconds)
+{
+	auto& stream = handle.GetStream();
+
+	std::lock_guard<std::mutex> lock(gStatsMutex);
+
+	OpenForkStats& fork = gOpenForks[refNum];
+	fork.path = DescribeFork(handle);
+	fork.forkType = handle.forkType;
+	fork.stats = {};
+	fork.stats.opens = 1;
+	fork.stats.openNanoseconds = openNanoseconds;
+	fork.streamBuf = std::make_unique<CountingStreamBuf>(stream.rdbuf(), fork.stats);
+
+	// rdbuf() resets the stream state, which is fine on a freshly opened stream
+	stream.rdbuf(fork.streamBuf.get());
+}
+
+void IOStats::OnMapRange(short refNum, size_t length, uint64_t nanoseconds)
+{
+	std::lock_guard<std::mutex> lock(gStatsMutex);
+
+	auto it = gOpenForks.find(refNum);
+	if (it != gOpenForks.end())
+	{
+		it->second.stats.mappedRanges++;
+		it->second.stats.bytesMapped += length;
+		it->second.stats.ioNanoseconds += nanoseconds;
+	}
+}
+
+void IOStats::OnReadAt(short refNum, size_t length, uint64_t nanoseconds)
+{
+	std::lock_guard<std::mutex> lock(gStatsMutex);
+
+	auto it = gOpenForks.find(refNum);
+	if (it != gOpenForks.end())
+	{
+		it->second.stats.readCalls++;
+		it->second.stats.bytesRead += length;
+		it->second.stats.ioNanoseconds += nanoseconds;
+	}
+}
+
+void IOStats::OnClose(short refNum, ForkHandle& handle)
+{
+	std::lock_guard<std::mutex> lock(gStatsMutex);
+
+	auto it = gOpenForks.find(refNum);
+	if (it == gOpenForks.end())
+	{
+		return;
+	}
+
+	OpenForkStats& fork = it->second;
+
+	// Give the stream its own buffer back before the handle goes away
+	auto& stream = handle.GetStream();
+	if (stream.rdbuf() == fork.streamBuf.get())
+	{
+		auto state = stream.rdstate();
+		stream.rdbuf(fork.streamBuf->GetInner());
+		stream.setstate(state);
+	}
+
+	gClosedForkTotals[{fork.path, fork.forkType}] += fork.stats;
+	gOpenForks.erase(it);
+}
+
+void IOStats::DumpJSON(std::ostream& out)
+{
+	std::lock_guard<std::mutex> lock(gStatsMutex);
+
+	// Per file: closed forks plus the forks that are still open
+	auto totals = gClosedForkTotals;
+	std::map<short, const OpenForkStats*> openForks;
+
+	for (const auto& [refNum, fork] : gOpenForks)
+	{
+		totals[{fork.path, fork.forkType}] += fork.stats;
+		openForks[refNum] = &fork;
+	}
+
+	out << "{\n\t\"files\": [";
+
+	const char* separator = "\n";
+	for (const auto& [key, stats] : totals)
+	{
+		out << separator << "\t\t{\"path\": ";
+		WriteJSONString(out, key.first);
+		out << ", \"fork\": \"" << (key.second == DataFork ? "data" : "resource") << "\", ";
+		WriteJSONStats(out, stats);
+		out << "}";
+		separator = ",\n";
+	}
+
+	out << "\n\t],\n\t\"openForks\": [";
+
+	separator = "\n";
+	for (const auto& [refNum, fork] : openForks)
+	{
+		out << separator << "\t\t{\"refNum\": " << refNum << ", \"path\": ";
+		WriteJSONString(out, fork->path);
+		out << ", \"fork\": \"" << (fork->forkType == DataFork ? "data" : "resource") << "\", ";
+		WriteJSONStats(out, fork->stats);
+		out << "}";
+		separator = ",\n";
+	}
+
+	out << "\n\t]\n}\n";
+}
+
+void IOStats::Shutdown()
+{
+	if (!gEnabled || gDumpPathAtShutdown.empty())
+	{
+		return;
+	}
+
+	std::ofstream out(gDumpPathAtShutdown);
+	DumpJSON(out);
+
+	if (!out.good())
+	{
+		std::cerr << "Couldn't write I/O stats to " << gDumpPathAtShutdown << "\n";
+	}
+}
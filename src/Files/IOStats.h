@@ -0,0 +1,49 @@
+#pragma once
+
+#include "PommeTypes.h"
+#include "Files/Volume.h"
+
+#include <cstdint>
+#include <ostream>
+
+namespace Pomme::Files::IOStats
+{
+	// Per-file I/O counters. Reads, writes and seeks are counted at the stream level, so they include
+	// everything the parsers do through GetStream, not only FSRead/FSWrite calls.
+	struct FileStats
+	{
+		uint64_t	opens = 0;
+		uint64_t	openNanoseconds = 0;
+		uint64_t	readCalls = 0;
+		uint64_t	bytesRead = 0;
+		uint64_t	writeCalls = 0;
+		uint64_t	bytesWritten = 0;
+		uint64_t	seeks = 0;				// repositionings (tellg/tellp aren't counted)
+		uint64_t	tells = 0;
+		uint64_t	mappedRanges = 0;
+		uint64_t	bytesMapped = 0;
+		uint64_t	ioNanoseconds = 0;		// time spent in reads, writes, seeks and mappings
+
+		FileStats& operator+=(const FileStats& other);
+	};
+
+	void Enable(const fs::path& dumpPathAtShutdown);
+
+	bool IsEnabled();
+
+	// Starts counting I/O on a freshly opened fork (wraps its stream buffer)
+	void OnOpen(short refNum, ForkHandle& handle, uint64_t openNanoseconds);
+
+	void OnMapRange(short refNum, size_t length, uint64_t nanoseconds);
+
+	// Positional reads bypass the stream, so they're counted separately
+	void OnReadAt(short refNum, size_t length, uint64_t nanoseconds);
+
+	// Folds the fork's counters into its file's totals; must be called before the handle is destroyed
+	void OnClose(short refNum, ForkHandle& handle);
+
+	void DumpJSON(std::ostream& out);
+
+	// Dumps the stats to the path given to Enable, if any
+	void Shutdown();
+}
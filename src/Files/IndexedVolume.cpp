@@ -0,0 +1,152 @@
+#include "PommeEnums.h"
+#include "PommeDebug.h"
+#include "PommeFiles.h"
+#include "Files/IndexedVolume.h"
+
+#include <stdexcept>
+
+#define LOG POMME_GENLOG(POMME_DEBUG_FILES, "IVOL")
+
+using namespace Pomme;
+using namespace Pomme::Files;
+
+IndexedVolume::IndexedVolume(short vRefNum)
+	: Volume(vRefNum)
+{
+	// Root directory (ID 0)
+	directories.emplace_back();
+	directoryIDs[u8string()] = 0;
+	nodes[u8string()].isDirectory = true;
+}
+
+//-----------------------------------------------------------------------------
+// Path utilities
+
+u8string IndexedVolume::JoinPath(const u8string& parent, const u8string& element)
+{
+	return parent.empty() ? element : parent + u8"/" + element;
+}
+
+u8string IndexedVolume::ParentPath(const u8string& path)
+{
+	auto slash = path.rfind('/');
+	return slash == u8string::npos ? u8string() : path.substr(0, slash);
+}
+
+u8string IndexedVolume::LeafName(const u8string& path)
+{
+	auto slash = path.rfind('/');
+	return slash == u8string::npos ? path : path.substr(slash + 1);
+}
+
+//-----------------------------------------------------------------------------
+// Node index
+
+IndexedVolume::Node& IndexedVolume::AddNode(const u8string& path, bool isDirectory)
+{
+	if (!path.empty())
+	{
+		AddNode(ParentPath(path), true);
+	}
+
+	auto [it, inserted] = nodes.try_emplace(UppercaseCopy(path));
+	Node& node = it->second;
+
+	if (inserted)
+	{
+		node.canonicalPath = path;
+	}
+
+	node.isDirectory |= isDirectory;
+	return node;
+}
+
+const IndexedVolume::Node* IndexedVolume::FindNode(const u8string& path) const
+{
+	auto it = nodes.find(UppercaseCopy(path));
+	return it == nodes.end() ? nullptr : &it->second;
+}
+
+const IndexedVolume::Node* IndexedVolume::FindNode(const FSSpec* spec) const
+{
+	if (spec->parID < 0 || (unsigned long) spec->parID >= directories.size())
+	{
+		return nullptr;
+	}
+
+	return FindNode(JoinPath(directories[spec->parID], u8string((const char8_t*) spec->cName)));
+}
+
+bool IndexedVolume::RemoveNode(const u8string& path)
+{
+	return !path.empty() && nodes.erase(UppercaseCopy(path)) != 0;
+}
+
+long IndexedVolume::GetDirectoryID(const u8string& path)
+{
+	u8string key = UppercaseCopy(path);
+
+	auto it = directoryIDs.find(key);
+	if (it != directoryIDs.end())
+	{
+		return it->second;
+	}
+
+	long dirID = (long) directories.size();
+	directories.push_back(path);
+	directoryIDs[key] = dirID;
+	LOG << "directory " << dirID << ": " << (const char*) path.c_str() << "\n";
+	return dirID;
+}
+
+//-----------------------------------------------------------------------------
+// Implementation
+
+OSErr IndexedVolume::FSMakeFSSpec(long dirID, const u8string& fileName, FSSpec* spec)
+{
+	if (dirID < 0 || (unsigned long) dirID >= directories.size())
+	{
+		throw std::runtime_error("IndexedVolume::FSMakeFSSpec: directory ID not registered.");
+	}
+
+	u8string path = directories.at(dirID);
+	bool exists = FindNode(path) != nullptr;
+	u8string::size_type begin = (!fileName.empty() && fileName.at(0) == ':') ? 1 : 0;
+
+	// Iterate on path elements between colons
+	while (begin < fileName.length())
+	{
+		auto end = fileName.find(':', begin);
+
+		bool isLeaf = end == u8string::npos; // no ':' found => end of path
+		if (isLeaf) end = fileName.length();
+
+		if (end == begin) // "::" => parent directory
+		{
+			path = ParentPath(path);
+		}
+		else
+		{
+			path = JoinPath(path, fileName.substr(begin, end - begin));
+
+			// Case-insensitive lookup; adopt the case stored in the index
+			const Node* node = FindNode(path);
+			exists = node && (isLeaf || node->isDirectory);
+			if (node)
+			{
+				path = node->canonicalPath;
+			}
+		}
+
+		// +1: jump over current colon
+		begin = end + 1;
+	}
+
+	LOG << (const char*) path.c_str() << "\n";
+
+	spec->vRefNum = volumeID;
+	spec->parID = GetDirectoryID(ParentPath(path));
+	snprintf(spec->cName, 256, "%s", (const char*) LeafName(path).c_str());
+
+	return exists ? noErr : fnfErr;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "Files/Volume.h"
+#include "Utilities/StringUtils.h"
+
+#include <unordered_map>
+#include <vector>
+
+namespace Pomme::Files
+{
+	/**
+	 * Base class for volumes whose whole directory tree is held in memory (e.g. PackVolume, MemoryVolume).
+	 * Paths are relative to the root of the volume, use '/' as the separator, and are matched case-insensitively.
+	 * Subclasses own the fork contents; nodes refer to them by index.
+	 */
+	class IndexedVolume : public Volume
+	{
+	protected:
+		struct Node
+		{
+			u8string	canonicalPath;		// path with its original case
+			bool		isDirectory = false;
+			int			dataFork = -1;		// subclass-defined fork index
+			int			resourceFork = -1;	// subclass-defined fork index
+		};
+
+		std::unordered_map<u8string, Node> nodes;			// key: uppercase path
+		std::vector<u8string> directories;					// directory ID -> canonical path ("" is the root)
+		std::unordered_map<u8string, long> directoryIDs;	// uppercase path -> directory ID
+
+		// Registers a node along with all its parent directories
+		Node& AddNode(const u8string& path, bool isDirectory);
+
+		const Node* FindNode(const u8string& path) const;
+
+		const Node* FindNode(const FSSpec* spec) const;
+
+		bool RemoveNode(const u8string& path);
+
+		long GetDirectoryID(const u8string& path);
+
+		static u8string JoinPath(const u8string& parent, const u8string& element);
+
+		static u8string ParentPath(const u8string& path);
+
+		static u8string LeafName(const u8string& path);
+
+	public:
+		IndexedVolume(short vRefNum);
+
+		virtual ~IndexedVolume() = default;
+
+		//-----------------------------------------------------------------------------
+		// Toolbox API Implementation
+
+		OSErr FSMakeFSSpec(long dirID, const u8string& fileName, FSSpec* spec) override;
+	};
+}
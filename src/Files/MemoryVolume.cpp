@@ -0,0 +1,188 @@
+#include "PommeEnums.h"
+#include "PommeDebug.h"
+#include "PommeFiles.h"
+#include "Files/MemoryVolume.h"
+#include "Utilities/memstream.h"
+
+#include <algorithm>
+#include <cstring>
+
+#define LOG POMME_GENLOG(POMME_DEBUG_FILES, "MVOL")
+
+using namespace Pomme;
+using namespace Pomme::Files;
+
+struct MemoryForkHandle : public ForkHandle
+{
+	std::shared_ptr<std::vector<char>> contents;
+	memstream stream;
+
+public:
+	MemoryForkHandle(ForkType theForkType, char perm, const FSSpec& theSpec, const std::shared_ptr<std::vector<char>>& theContents)
+		: ForkHandle(theForkType, perm, theSpec)
+		, contents(theContents)
+		, stream(*contents)
+	{
+	}
+
+	virtual std::iostream& GetStream() override
+	{
+		return stream;
+	}
+
+	virtual size_t ReadAt(std::streamoff offset, char* dst, size_t length) override
+	{
+		if (offset < 0 || size_t(offset) >= contents->size())
+		{
+			return 0;
+		}
+
+		length = std::min(length, contents->size() - size_t(offset));
+		memcpy(dst, contents->data() + offset, length);
+		return length;
+	}
+};
+
+MemoryVolume::MemoryVolume(short vRefNum)
+	: IndexedVolume(vRefNum)
+{
+}
+
+OSErr MemoryVolume::AddFork(const u8string& macPath, ForkType forkType, std::vector<char> contents)
+{
+	u8string path = macPath.starts_with(u8":") ? macPath.substr(1) : macPath;
+
+	if (path.empty() || path.ends_with(u8":") || path.find(u8"::") != u8string::npos || path.find('/') != u8string::npos)
+	{
+		return bdNamErr;
+	}
+
+	std::replace(path.begin(), path.end(), char8_t(':'), char8_t('/'));
+
+	const Node* existing = FindNode(path);
+	if (existing && existing->isDirectory)
+	{
+		return bdNamErr;
+	}
+
+	Node& node = AddNode(path, false);
+	int& forkIndex = forkType == DataFork ? node.dataFork : node.resourceFork;
+
+	if (forkIndex >= 0)
+	{
+		forks[forkIndex].reset();
+	}
+
+	forkIndex = (int) forks.size();
+	forks.push_back(std::make_shared<std::vector<char>>(std::move(contents)));
+
+	LOG << (const char*) path.c_str() << (forkType == DataFork ? " (data fork): " : " (resource fork): ")
+		<< forks.back()->size() << " bytes\n";
+
+	return noErr;
+}
+
+//-----------------------------------------------------------------------------
+// Implementation
+
+OSErr MemoryVolume::OpenFork(const FSSpec* spec, ForkType forkType, char permission, std::unique_ptr<ForkHandle>& handle)
+{
+	if (permission & fsWrPerm)
+	{
+		return wPrErr;
+	}
+
+	const Node* node = FindNode(spec);
+	int forkIndex = !node ? -1 : (forkType == DataFork ? node->dataFork : node->resourceFork);
+
+	if (forkIndex < 0)
+	{
+		return fnfErr;
+	}
+
+	handle = std::make_unique<MemoryForkHandle>(forkType, permission, *spec, forks[forkIndex]);
+	return noErr;
+}
+
+OSErr MemoryVolume::FSpCreate(const FSSpec* spec, OSType creator, OSType fileType, ScriptCode scriptTag)
+{
+	(void) creator;
+	(void) fileType;
+	(void) scriptTag;
+
+	if (FindNode(spec))
+	{
+		return dupFNErr;
+	}
+
+	if (spec->parID < 0 || (unsigned long) spec->parID >= directories.size())
+	{
+		return dirNFErr;
+	}
+
+	u8string path = JoinPath(directories[spec->parID], u8string((const char8_t*) spec->cName));
+	if (!FindNode(ParentPath(path)))
+	{
+		return dirNFErr;
+	}
+
+	Node& node = AddNode(path, false);
+	node.dataFork = (int) forks.size();
+	forks.push_back(std::make_shared<std::vector<char>>());
+	return noErr;
+}
+
+OSErr MemoryVolume::FSpDelete(const FSSpec* spec)
+{
+	const Node* node = FindNode(spec);
+
+	if (!node)
+	{
+		return fnfErr;
+	}
+
+	if (node->isDirectory)
+	{
+		// Only delete empty directories
+		const u8string prefix = UppercaseCopy(node->canonicalPath) + u8"/";
+		for (const auto& [key, other] : nodes)
+		{
+			if (key.starts_with(prefix))
+			{
+				return fBsyErr;
+			}
+		}
+	}
+
+	if (node->dataFork >= 0) forks[node->dataFork].reset();
+	if (node->resourceFork >= 0) forks[node->resourceFork].reset();
+
+	const u8string path = node->canonicalPath;
+	return RemoveNode(path) ? noErr : fnfErr;
+}
+
+OSErr MemoryVolume::DirCreate(long parentDirID, const u8string& directoryName, long* createdDirID)
+{
+	if (parentDirID < 0 || (unsigned long) parentDirID >= directories.size()
+		|| !FindNode(directories[parentDirID]))
+	{
+		return dirNFErr;
+	}
+
+	u8string path = JoinPath(directories[parentDirID], directoryName);
+
+	const Node* existing = FindNode(path);
+	if (existing && !existing->isDirectory)
+	{
+		return bdNamErr;
+	}
+
+	AddNode(path, true);
+
+	if (createdDirID)
+	{
+		*createdDirID = GetDirectoryID(FindNode(path)->canonicalPath);
+	}
+
+	return noErr;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "Files/IndexedVolume.h"
+#include "Utilities/StringUtils.h"
+
+#include <memory>
+#include <vector>
+
+namespace Pomme::Files
+{
+	/**
+	 * Volume whose files live in RAM. Files are registered programmatically with AddFork,
+	 * which lets tests and benchmarks run the file and resource loaders without touching the disk.
+	 * Forks are read-only once registered; opening one streams straight from its buffer without copying.
+	 */
+	class MemoryVolume : public IndexedVolume
+	{
+		// Fork contents; nodes' fork indices point here. Open fork handles share ownership,
+		// so deleting or replacing a file doesn't pull the rug from under them.
+		std::vector<std::shared_ptr<std::vector<char>>> forks;
+
+	public:
+		MemoryVolume(short vRefNum);
+
+		virtual ~MemoryVolume() = default;
+
+		// Registers (or replaces) a fork. `path` is relative to the root of the volume,
+		// with ':' as the separator (a leading ':' is optional); missing folders are created.
+		// Resource forks are raw (not wrapped in AppleDouble).
+		OSErr AddFork(const u8string& path, ForkType forkType, std::vector<char> contents);
+
+		//-----------------------------------------------------------------------------
+		// Toolbox API Implementation
+
+		OSErr OpenFork(const FSSpec* spec, ForkType forkType, char permission, std::unique_ptr<ForkHandle>& handle) override;
+
+		OSErr FSpCreate(const FSSpec* spec, OSType creator, OSType fileType, ScriptCode scriptTag) override;
+
+		OSErr FSpDelete(const FSSpec* spec) override;
+
+		OSErr DirCreate(long parentDirID, const u8string& directoryName, long* createdDirID) override;
+	};
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+// Layout of a Pomme pack file (see PackVolume.h). All integers are little-endian.
+//
+//   PackHeader
+//   entry data           each uncompressed entry starts on a kAlignment boundary so it can be mapped
+//   index                numEntries records: PackIndexRecord, then `pathLength` bytes of UTF-8 path
+//
+// Paths are relative to the root of the pack, with '/' as the separator.
+// A file's data fork and resource fork are separate entries with the same path.
+// Resource forks are stored raw (not wrapped in AppleDouble).
+
+namespace Pomme::Files::Pack
+{
+	static constexpr char kMagic[8] = {'P', 'O', 'M', 'M', 'E', 'P', 'A', 'K'};
+	static constexpr uint32_t kVersion = 1;
+	static constexpr uint64_t kAlignment = 4096;
+
+	enum EntryFlags : uint32_t
+	{
+		kEntryResourceFork	= 1 << 0,
+		kEntryCompressed	= 1 << 1,		// compressed with Pomme::LZ
+	};
+
+	struct PackHeader
+	{
+		char		magic[8];
+		uint32_t	version;
+		uint32_t	numEntries;
+		uint64_t	indexOffset;
+		uint64_t	indexLength;
+
+		static constexpr size_t kSize = 32;
+	};
+
+	struct PackIndexRecord
+	{
+		uint64_t	offset;				// absolute offset of the entry's data in the pack
+		uint64_t	storedLength;		// length of the data in the pack
+		uint64_t	length;				// length of the fork once decompressed
+		uint32_t	flags;				// EntryFlags
+		uint32_t	pathLength;
+
+		static constexpr size_t kSize = 32;
+	};
+
+	inline uint32_t ReadLE32(const char* p)
+	{
+		const uint8_t* b = (const uint8_t*) p;
+		return uint32_t(b[0]) | (uint32_t(b[1]) << 8) | (uint32_t(b[2]) << 16) | (uint32_t(b[3]) << 24);
+	}
+
+	inline uint64_t ReadLE64(const char* p)
+	{
+		return uint64_t(ReadLE32(p)) | (uint64_t(ReadLE32(p + 4)) << 32);
+	}
+
+	inline void AppendLE32(std::string& out, uint32_t v)
+	{
+		for (int i = 0; i < 4; i++)
+			out.push_back(char(v >> (8 * i)));
+	}
+
+	inline void AppendLE64(std::string& out, uint64_t v)
+	{
+		AppendLE32(out, uint32_t(v));
+		AppendLE32(out, uint32_t(v >> 32));
+	}
+
+	inline PackHeader DecodeHeader(const char* p)
+	{
+		PackHeader h;
+		memcpy(h.magic, p, 8);
+		h.version		= ReadLE32(p + 8);
+		h.numEntries	= ReadLE32(p + 12);
+		h.indexOffset	= ReadLE64(p + 16);
+		h.indexLength	= ReadLE64(p + 24);
+		return h;
+	}
+
+	inline std::string EncodeHeader(const PackHeader& h)
+	{
+		std::string out(h.magic, 8);
+		AppendLE32(out, h.version);
+		AppendLE32(out, h.numEntries);
+		AppendLE64(out, h.indexOffset);
+		AppendLE64(out, h.indexLength);
+		return out;
+	}
+
+	inline PackIndexRecord DecodeIndexRecord(const char* p)
+	{
+		PackIndexRecord r;
+		r.offset		= ReadLE64(p);
+		r.storedLength	= ReadLE64(p + 8);
+		r.length		= ReadLE64(p + 16);
+		r.flags			= ReadLE32(p + 24);
+		r.pathLength	= ReadLE32(p + 28);
+		return r;
+	}
+
+	inline void AppendIndexRecord(std::string& out, const PackIndexRecord& r)
+	{
+		AppendLE64(out, r.offset);
+		AppendLE64(out, r.storedLength);
+		AppendLE64(out, r.length);
+		AppendLE32(out, r.flags);
+		AppendLE32(out, r.pathLength);
+	}
+}
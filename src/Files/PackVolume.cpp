@@ -0,0 +1,279 @@
+#include "PommeEnums.h"
+#include "PommeDebug.h"
+#include "PommeFiles.h"
+#include "Files/PackVolume.h"
+#include "Files/PackFormat.h"
+#include "Platform/Posix/PommePosix.h"
+#include "Utilities/LZ.h"
+#include "Utilities/memstream.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#define LOG POMME_GENLOG(POMME_DEBUG_FILES, "PACK")
+
+using namespace Pomme;
+using namespace Pomme::Files;
+
+struct PackForkHandle : public ForkHandle
+{
+	std::vector<char> buffer;		// fork contents, unless they're mapped
+	void* mappingBase;
+	size_t mappingLength;
+	char* contents;
+	size_t contentsLength;
+	memstream stream;
+	int mappingFD;
+	uint64_t entryOffset;			// -1 if the entry can't be mapped
+
+public:
+	PackForkHandle(
+		ForkType theForkType,
+		char perm,
+		const FSSpec& theSpec,
+		std::vector<char>&& theBuffer,
+		char* data,
+		size_t length,
+		void* theMappingBase,
+		size_t theMappingLength,
+		int theMappingFD,
+		uint64_t theEntryOffset)
+		: ForkHandle(theForkType, perm, theSpec)
+		, buffer(std::move(theBuffer))
+		, mappingBase(theMappingBase)
+		, mappingLength(theMappingLength)
+		, contents(data)
+		, contentsLength(length)
+		, stream(data, length)
+		, mappingFD(theMappingFD)
+		, entryOffset(theEntryOffset)
+	{
+	}
+
+	virtual ~PackForkHandle()
+	{
+#if POMME_MMAP
+		if (mappingBase)
+		{
+			Pomme::Platform::Posix::UnmapFileRange(mappingBase, mappingLength);
+		}
+#endif
+	}
+
+	virtual std::iostream& GetStream() override
+	{
+		return stream;
+	}
+
+	virtual size_t ReadAt(std::streamoff offset, char* dst, size_t length) override
+	{
+		if (offset < 0 || size_t(offset) >= contentsLength)
+		{
+			return 0;
+		}
+
+		length = std::min(length, contentsLength - size_t(offset));
+		memcpy(dst, contents + offset, length);
+		return length;
+	}
+
+#if POMME_MMAP
+	virtual char* MapRange(std::streamoff offset, size_t length, void** outMappingBase, size_t* outMappingLength) override
+	{
+		if (entryOffset == UINT64_MAX)
+		{
+			return nullptr;
+		}
+		return Pomme::Platform::Posix::MapFileRange(mappingFD, entryOffset + offset, length, outMappingBase, outMappingLength);
+	}
+#endif
+};
+
+//-----------------------------------------------------------------------------
+// Index
+
+PackVolume::PackVolume(short vRefNum, const fs::path& thePackPath)
+	: IndexedVolume(vRefNum)
+	, packPath(thePackPath)
+	, packStream(thePackPath, std::ios::binary)
+{
+	if (!packStream.good())
+	{
+		throw std::runtime_error("PackVolume: can't open pack file");
+	}
+
+	char headerBytes[Pack::PackHeader::kSize];
+	packStream.read(headerBytes, sizeof(headerBytes));
+	auto header = Pack::DecodeHeader(headerBytes);
+
+	if (!packStream.good()
+		|| 0 != memcmp(header.magic, Pack::kMagic, sizeof(Pack::kMagic))
+		|| header.version != Pack::kVersion)
+	{
+		throw std::runtime_error("PackVolume: not a Pomme pack, or unsupported version");
+	}
+
+	std::vector<char> index(header.indexLength);
+	packStream.seekg(header.indexOffset, std::ios::beg);
+	packStream.read(index.data(), index.size());
+
+	if (!packStream.good())
+	{
+		throw std::runtime_error("PackVolume: truncated index");
+	}
+
+	entries.reserve(header.numEntries);
+	size_t pos = 0;
+
+	for (uint32_t i = 0; i < header.numEntries; i++)
+	{
+		if (pos + Pack::PackIndexRecord::kSize > index.size())
+		{
+			throw std::runtime_error("PackVolume: corrupted index");
+		}
+
+		auto record = Pack::DecodeIndexRecord(&index[pos]);
+		pos += Pack::PackIndexRecord::kSize;
+
+		if (pos + record.pathLength > index.size())
+		{
+			throw std::runtime_error("PackVolume: corrupted index");
+		}
+
+		u8string path((const char8_t*) &index[pos], record.pathLength);
+		pos += record.pathLength;
+
+		Node& node = AddNode(path, false);
+		int& forkIndex = (record.flags & Pack::kEntryResourceFork) ? node.resourceFork : node.dataFork;
+		forkIndex = (int) entries.size();
+
+		entries.push_back({record.offset, record.storedLength, record.length, record.flags});
+	}
+
+#if POMME_MMAP
+	mappingFD = Pomme::Platform::Posix::OpenFileForMapping(packPath);
+#endif
+
+	LOG << "Mounted " << packPath << ": " << entries.size() << " forks\n";
+}
+
+PackVolume::~PackVolume()
+{
+#if POMME_MMAP
+	Pomme::Platform::Posix::CloseFileForMapping(mappingFD);
+#endif
+}
+
+void PackVolume::ReadEntry(const Entry& entry, std::vector<char>& buffer)
+{
+	std::vector<char> stored(entry.storedLength);
+
+	packStream.clear();
+	packStream.seekg(entry.offset, std::ios::beg);
+	packStream.read(stored.data(), stored.size());
+
+	if (!packStream.good())
+	{
+		throw std::runtime_error("PackVolume: can't read entry");
+	}
+
+	if (!(entry.flags & Pack::kEntryCompressed))
+	{
+		buffer = std::move(stored);
+		return;
+	}
+
+	buffer.resize(entry.length);
+
+	if (!Pomme::LZ::Decompress(stored.data(), stored.size(), buffer.data(), buffer.size()))
+	{
+		throw std::runtime_error("PackVolume: corrupted compressed entry");
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Implementation
+
+OSErr PackVolume::OpenFork(const FSSpec* spec, ForkType forkType, char permission, std::unique_ptr<ForkHandle>& handle)
+{
+	if (permission & fsWrPerm)
+	{
+		return wPrErr;
+	}
+
+	const Node* node = FindNode(spec);
+	int entryIndex = !node ? -1 : (forkType == DataFork ? node->dataFork : node->resourceFork);
+
+	if (entryIndex < 0)
+	{
+		return fnfErr;
+	}
+
+	const Entry& entry = entries[entryIndex];
+	const bool compressed = entry.flags & Pack::kEntryCompressed;
+
+	std::vector<char> buffer;
+	char* data = nullptr;
+	void* mappingBase = nullptr;
+	size_t mappingLength = 0;
+
+#if POMME_MMAP
+	if (!compressed)
+	{
+		data = Pomme::Platform::Posix::MapFileRange(mappingFD, entry.offset, entry.length, &mappingBase, &mappingLength);
+	}
+#endif
+
+	if (!data)
+	{
+		try
+		{
+			ReadEntry(entry, buffer);
+		}
+		catch (const std::exception& e)
+		{
+			std::cerr << e.what() << ": " << spec->cName << "\n";
+			return ioErr;
+		}
+
+		data = buffer.data();
+	}
+
+	handle = std::make_unique<PackForkHandle>(
+		forkType,
+		permission,
+		*spec,
+		std::move(buffer),
+		data,
+		(size_t) entry.length,
+		mappingBase,
+		mappingLength,
+		mappingFD,
+		compressed ? UINT64_MAX : entry.offset);
+
+	return noErr;
+}
+
+OSErr PackVolume::FSpCreate(const FSSpec* spec, OSType creator, OSType fileType, ScriptCode scriptTag)
+{
+	(void) spec;
+	(void) creator;
+	(void) fileType;
+	(void) scriptTag;
+	return wPrErr;
+}
+
+OSErr PackVolume::FSpDelete(const FSSpec* spec)
+{
+	(void) spec;
+	return wPrErr;
+}
+
+OSErr PackVolume::DirCreate(long parentDirID, const u8string& directoryName, long* createdDirID)
+{
+	(void) parentDirID;
+	(void) directoryName;
+	(void) createdDirID;
+	return wPrErr;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "Files/IndexedVolume.h"
+#include "CompilerSupport/filesystem.h"
+#include "Utilities/StringUtils.h"
+
+#include <fstream>
+#include <vector>
+
+namespace Pomme::Files
+{
+	/**
+	 * Read-only volume backed by a single Pomme pack file (see PackFormat.h; build one with tools/pommepack).
+	 * The whole directory tree is indexed in memory when the volume is mounted, so looking up files and
+	 * opening them never scans host directories. Uncompressed entries are mapped straight from the pack.
+	 */
+	class PackVolume : public IndexedVolume
+	{
+	public:
+		struct Entry
+		{
+			uint64_t	offset;
+			uint64_t	storedLength;
+			uint64_t	length;
+			uint32_t	flags;
+		};
+
+	private:
+		fs::path packPath;
+		std::ifstream packStream;
+		int mappingFD = -1;
+
+		std::vector<Entry> entries;		// nodes' fork indices point here
+
+		void ReadEntry(const Entry& entry, std::vector<char>& buffer);
+
+	public:
+		PackVolume(short vRefNum, const fs::path& packPath);
+
+		virtual ~PackVolume();
+
+		//-----------------------------------------------------------------------------
+		// Toolbox API Implementation
+
+		OSErr OpenFork(const FSSpec* spec, ForkType forkType, char permission, std::unique_ptr<ForkHandle>& handle) override;
+
+		OSErr FSpCreate(const FSSpec* spec, OSType creator, OSType fileType, ScriptCode scriptTag) override;
+
+		OSErr FSpDelete(const FSSpec* spec) override;
+
+		OSErr DirCreate(long parentDirID, const u8string& directoryName, long* createdDirID) override;
+	};
+}
@@ -1,12 +1,22 @@
 #include "Pomme.h"
 #include "PommeFiles.h"
 #include "PommeMemory.h"
+#include "Files/BackgroundIO.h"
+#include "Files/DecodedResources.h"
+#include "Memory/Zones.h"
+#include "Platform/Posix/PommePosix.h"
 #include "Utilities/bigendianstreams.h"
 
 #include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <cstring>
+#include <list>
+#include <mutex>
+#include <span>
+#include <sstream>
+#include <unordered_map>
+#include <unordered_set>
 #include "CompilerSupport/filesystem.h"
 
 #if _DEBUG
@@ -15,32 +25,1402 @@
 
 #define LOG POMME_GENLOG(POMME_DEBUG_RESOURCES, "RSRC")
 
+// Resources at least this big are mapped straight from the resource file (copy-on-write)
+// instead of being read into a fresh handle, if the volume supports it.
+// Smaller resources aren't worth a mapping of their own.
+#if !defined(POMME_MIN_MAPPED_RESOURCE_SIZE)
+	#define POMME_MIN_MAPPED_RESOURCE_SIZE (64 * 1024)
+#endif
+
 using namespace Pomme;
 using namespace Pomme::Files;
 
-//-----------------------------------------------------------------------------
-// State
+//-----------------------------------------------------------------------------
+// State
+
+// Resource Manager calls may come from several threads (e.g. parallel level loading).
+// Each thread sees the error of its own last call, like each thread would see its own errno.
+static thread_local OSErr gLastResError = noErr;
+
+// Guards all the state below. It's recursive because DisposeHandle may call back into the
+// Resource Manager (see OnResourceHandleDisposed) while the lock is held.
+// GetResource drops the lock while it reads resource data, so loads from several threads overlap.
+// The fork stack is shared by all threads, so UseResFile on one thread affects the others,
+// and a fork must not be closed while other threads are still loading from it.
+static std::recursive_mutex gResMutex;
+
+using ResLock = std::lock_guard<std::recursive_mutex>;
+
+static std::vector<ResourceFork> gResForkStack;
+
+static int gResForkStackIndex = 0;
+
+// refNum -> position in gResForkStack
+static FlatHashMap<uint64_t, int> gResForkStackPositions;
+
+// Result of searching the fork stack for a (type, id) from gResForkStackIndex downward.
+// nullptr means the resource isn't in any fork. Flushed whenever the stack or the current fork changes.
+static FlatHashMap<uint64_t, const ResourceMetadata*> gResLookupCache;
+
+// Interned resource names. Set nodes never move, so the c_str() pointers stay valid.
+static std::unordered_set<std::string> gResNames;
+
+namespace
+{
+	struct CachedResource
+	{
+		Handle handle;
+		Size size;			// as accounted for in gResCacheBytes (the handle may be resized while it's cached)
+		int refCount;
+		std::list<const ResourceMetadata*>::iterator purgeablePos;	// only valid when refCount == 0
+	};
+}
+
+// Resource cache (see Pomme_SetResourceCacheBudget). A budget of 0 disables the cache.
+static Size gResCacheBudget = 0;
+static Size gResCacheBytes = 0;
+static long gResCacheHits = 0;
+static long gResCacheMisses = 0;
+static long gResCachePurges = 0;
+static std::unordered_map<const ResourceMetadata*, CachedResource> gResCache;
+static std::list<const ResourceMetadata*> gResCachePurgeable;	// unreferenced resources, least recently released first
+
+// Resources read ahead of time by Pomme_PrefetchResources, waiting to be claimed by GetResource
+static std::unordered_map<const ResourceMetadata*, Handle> gPrefetchedResources;
+
+// Resources whose read is queued or running on the background I/O thread
+static std::unordered_set<const ResourceMetadata*> gInFlightPrefetches;
+
+// Resources passed to ChangedResource or AddResource, waiting for WriteResource or UpdateResFile
+static std::unordered_map<const ResourceMetadata*, Handle> gPendingResourceWrites;
+
+//-----------------------------------------------------------------------------
+// Internal
+
+static void ResourceAssert(bool condition, const char* message)
+{
+	if (!condition)
+	{
+		throw std::runtime_error(message);
+	}
+}
+
+static ResourceFork& GetCurRF()
+{
+	return gResForkStack[gResForkStackIndex];
+}
+
+// Reads a big-endian value from an in-memory resource map
+template<typename T>
+static T MapRead(std::span<const uint8_t> map, size_t offset)
+{
+	ResourceAssert(offset + sizeof(T) <= map.size(), "FSpOpenResFile: Offset past end of resource map");
+
+	uint8_t b[sizeof(T)];
+	memcpy(b, &map[offset], sizeof(T));
+#if !(__BIG_ENDIAN__)
+	std::reverse(b, b + sizeof(T));
+#endif
+	T value;
+	memcpy(&value, b, sizeof(T));
+	return value;
+}
+
+// Writes a big-endian value into an in-memory resource fork
+template<typename T>
+static void MapWrite(std::span<char> buf, size_t offset, T value)
+{
+	ResourceAssert(offset + sizeof(T) <= buf.size(), "UpdateResFile: Offset past end of buffer");
+
+	char b[sizeof(T)];
+	memcpy(b, &value, sizeof(T));
+#if !(__BIG_ENDIAN__)
+	std::reverse(b, b + sizeof(T));
+#endif
+	memcpy(&buf[offset], b, sizeof(T));
+}
+
+// The size of each resource is stored in the data section, right before the resource's data.
+// FSpOpenResFile doesn't read it to avoid seeking all over the file; it's fetched on first access instead.
+// This doesn't touch any shared state, so it may be called without holding gResMutex.
+static SInt32 ReadResourceSize(const ResourceMetadata& meta)
+{
+	uint8_t sizeBytes[4];
+	size_t got = Pomme::Files::ReadAt(meta.forkRefNum, meta.dataOffset - 4, (char*) sizeBytes, sizeof(sizeBytes));
+	ResourceAssert(got == sizeof(sizeBytes), "GetResource: Resource size past end of fork");
+
+	SInt32 size = MapRead<SInt32>(sizeBytes, 0);
+	ResourceAssert(size >= 0, "GetResource: Corrupted resource size");
+	return size;
+}
+
+static SInt32 GetResourceSize(const ResourceMetadata& meta)
+{
+	if (meta.size < 0)
+	{
+		meta.size = ReadResourceSize(meta);
+	}
+
+	return meta.size;
+}
+
+static const char* InternResourceName(std::string&& name)
+{
+	return gResNames.insert(std::move(name)).first->c_str();
+}
+
+static void OnResForkStackChanged()
+{
+	gResForkStackPositions.Clear();
+	for (size_t i = 0; i < gResForkStack.size(); i++)
+	{
+		gResForkStackPositions.Insert(gResForkStack[i].fileRefNum, (int) i);
+	}
+
+	gResLookupCache.Clear();
+}
+
+static bool HasUnloadedIndexEntries(const ResourceFork& fork);
+
+static const ResourceMetadata* FindInResourceIndex(ResourceFork& fork, ResType theType, short theID);
+
+static const ResourceMetadata* FindResource(ResType theType, short theID)
+{
+	const uint64_t key = ResourceKey(theType, theID);
+
+	if (auto* cached = gResLookupCache.Find(key))
+	{
+		return *cached;
+	}
+
+	const ResourceMetadata* meta = nullptr;
+
+	for (int i = gResForkStackIndex; i >= 0 && !meta; i--)
+	{
+		auto& fork = gResForkStack[i];
+
+		if (auto* found = fork.index.Find(key))
+		{
+			meta = *found;
+		}
+		else if (HasUnloadedIndexEntries(fork))
+		{
+			meta = FindInResourceIndex(fork, theType, theID);
+		}
+	}
+
+	gResLookupCache.Insert(key, meta);
+	return meta;
+}
+
+// Returns nullptr if the resource can't be mapped
+static Handle NewHandleFromMappedResource(const ResourceMetadata& meta, SInt32 size)
+{
+	if (size < POMME_MIN_MAPPED_RESOURCE_SIZE)
+	{
+		return nullptr;
+	}
+
+	void* mappingBase = nullptr;
+	size_t mappingLength = 0;
+	char* data = Pomme::Files::MapRange(meta.forkRefNum, meta.dataOffset, size, &mappingBase, &mappingLength);
+
+	if (!data)
+	{
+		return nullptr;
+	}
+
+	auto* block = Pomme::Memory::BlockDescriptor::AllocateMapped(data, size, mappingBase, mappingLength);
+	return &block->ptrToData;
+}
+
+// Maps or reads a resource's data into a new handle.
+// Called without holding gResMutex: it only reads the fork with positional reads, never through its stream.
+// Pass a negative size if it isn't known yet.
+static Handle LoadResourceData(const ResourceMetadata& meta, SInt32 size)
+{
+	// The Resource Manager may keep the handle around (in the cache, or as a pending write)
+	// longer than the memory zone that's open right now
+	Pomme::Memory::Zones::BypassScope bypassZones;
+
+	if (size < 0)
+	{
+		size = ReadResourceSize(meta);
+	}
+
+	// Map big resources straight from the file if possible
+	if (Handle handle = NewHandleFromMappedResource(meta, size))
+	{
+		return handle;
+	}
+
+	// Otherwise, allocate handle and read the data into it
+	Handle handle = NewHandle(size);
+
+	size_t got = Pomme::Files::ReadAt(meta.forkRefNum, meta.dataOffset, *handle, size);
+	if (got != (size_t) size)
+	{
+		DisposeHandle(handle);
+		ResourceAssert(false, "GetResource: Resource data past end of fork");
+	}
+
+	return handle;
+}
+
+static const ResourceMetadata* AddResourceToFork(ResourceFork& fork, const ResourceMetadata& meta)
+{
+	auto& storedMetadata = fork.resourceMap[meta.type][meta.id];
+	storedMetadata = meta;
+	fork.index.Insert(ResourceKey(meta.type, meta.id), &storedMetadata);
+	return &storedMetadata;
+}
+
+// Invalidates `meta`
+static void RemoveResourceFromFork(ResourceFork& fork, const ResourceMetadata* meta)
+{
+	const ResType type = meta->type;
+	fork.index.Erase(ResourceKey(type, meta->id));
+
+	auto& idsToResources = fork.resourceMap.at(type);
+	idsToResources.erase(meta->id);
+	if (idsToResources.empty())
+	{
+		fork.resourceMap.erase(type);
+	}
+
+	fork.mapChanged = true;
+	gResLookupCache.Clear();
+}
+
+static ResourceFork* FindFork(short refNum)
+{
+	auto* position = gResForkStackPositions.Find(refNum);
+	return position ? &gResForkStack[*position] : nullptr;
+}
+
+static ResourceFork* FindWritableFork(const ResourceMetadata* meta)
+{
+	ResourceFork* fork = meta ? FindFork(meta->forkRefNum) : nullptr;
+	return fork && fork->writable ? fork : nullptr;
+}
+
+//-----------------------------------------------------------------------------
+// Resource index cache
+//
+// An index holds everything FSpOpenResFile would otherwise get from the resource map
+// (types, IDs, names, offsets, and the sizes known when it was written), in native byte order.
+// It's only valid for the exact host file it was built from: size, mtime, and resource fork header
+// must all match. The index is a local cache, so it isn't portable across machines.
+//
+// A fork opened from an index keeps the index mapped, and looks its resources up in place
+// (the entries are sorted by type and ID): resourceMap only holds the resources found so far.
+
+static fs::path gResIndexFolder;
+
+namespace
+{
+	struct ResourceIndexHeader
+	{
+		uint32_t	magic;
+		uint32_t	version;
+		uint64_t	hostFileSize;
+		int64_t		hostFileTime;
+		uint64_t	forkHeaderHash;
+		uint32_t	numResources;
+		uint32_t	namesLength;
+		uint64_t	contentHash;	// hash of the entries and names that follow the header
+	};
+
+	struct ResourceIndexEntry
+	{
+		int64_t		dataOffset;
+		OSType		type;
+		SInt32		size;			// -1 if unknown (see GetResourceSize)
+		uint32_t	nameOffset;		// into the name blob that follows the entries
+		SInt16		id;
+		Byte		flags;
+		Byte		nameLength;
+	};
+}
+
+struct Pomme::Files::ResourceIndexMapping
+{
+	std::span<const ResourceIndexEntry> entries;
+	const char* names = nullptr;
+
+#if POMME_MMAP
+	void* mappingBase = nullptr;
+	size_t mappingLength = 0;
+
+	~ResourceIndexMapping()
+	{
+		if (mappingBase)
+		{
+			Pomme::Platform::Posix::UnmapFileRange(mappingBase, mappingLength);
+		}
+	}
+#else
+	std::vector<uint8_t> data;
+#endif
+};
+
+static constexpr uint32_t kResourceIndexMagic = 'PIDX';
+static constexpr uint32_t kResourceIndexVersion = 2;
+
+// The entries are used in place, right after the header
+static_assert(sizeof(ResourceIndexHeader) % alignof(ResourceIndexEntry) == 0);
+
+static uint64_t HashBytes(const void* data, size_t length, uint64_t hash = 0xCBF29CE484222325ull)
+{
+	// FNV-1a
+	const uint8_t* bytes = (const uint8_t*) data;
+	for (size_t i = 0; i < length; i++)
+	{
+		hash = (hash ^ bytes[i]) * 0x100000001B3ull;
+	}
+	return hash;
+}
+
+static fs::path GetResourceIndexPath(short forkRefNum)
+{
+	if (gResIndexFolder.empty())
+	{
+		return {};
+	}
+
+	fs::path hostPath = Pomme::Files::GetHostPath(forkRefNum);
+	if (hostPath.empty())
+	{
+		return {};
+	}
+
+	// Disambiguate forks with the same name in different folders
+	std::error_code ec;
+	const auto absolutePath = fs::absolute(hostPath, ec).u8string();
+	uint64_t pathHash = HashBytes(absolutePath.data(), absolutePath.size());
+
+	char suffix[32];
+	snprintf(suffix, sizeof(suffix), ".%016llx.pidx", (unsigned long long) pathHash);
+
+	fs::path indexPath = gResIndexFolder / hostPath.filename();
+	indexPath += suffix;
+	return indexPath;
+}
+
+static ResourceIndexHeader MakeResourceIndexHeader(
+	short forkRefNum,
+	std::streamoff dataSectionOff,
+	std::streamoff mapSectionOff,
+	UInt32 mapSectionLen)
+{
+	const fs::path hostPath = Pomme::Files::GetHostPath(forkRefNum);
+
+	std::error_code ec;
+	ResourceIndexHeader header = {};
+	header.magic = kResourceIndexMagic;
+	header.version = kResourceIndexVersion;
+	header.hostFileSize = (uint64_t) fs::file_size(hostPath, ec);
+	header.hostFileTime = (int64_t) fs::last_write_time(hostPath, ec).time_since_epoch().count();
+
+	const int64_t forkHeader[3] = {dataSectionOff, mapSectionOff, mapSectionLen};
+	header.forkHeaderHash = HashBytes(forkHeader, sizeof(forkHeader));
+
+	return header;
+}
+
+static bool ParseResourceIndex(std::span<const uint8_t> index, const ResourceIndexHeader& expected, ResourceIndexMapping& mapping)
+{
+	ResourceIndexHeader header;
+
+	if (index.size() < sizeof(header))
+	{
+		return false;
+	}
+
+	memcpy(&header, index.data(), sizeof(header));
+
+	if (header.magic != expected.magic
+		|| header.version != expected.version
+		|| header.hostFileSize != expected.hostFileSize
+		|| header.hostFileTime != expected.hostFileTime
+		|| header.forkHeaderHash != expected.forkHeaderHash)
+	{
+		return false;
+	}
+
+	const size_t entriesLength = header.numResources * sizeof(ResourceIndexEntry);
+	const auto content = index.subspan(sizeof(header));
+
+	if (content.size() != entriesLength + header.namesLength
+		|| header.contentHash != HashBytes(content.data(), content.size()))
+	{
+		return false;
+	}
+
+	const std::span<const ResourceIndexEntry> entries((const ResourceIndexEntry*) content.data(), header.numResources);
+
+	for (size_t i = 0; i < entries.size(); i++)
+	{
+		const auto& entry = entries[i];
+
+		if (entry.nameOffset + entry.nameLength > header.namesLength)
+		{
+			return false;
+		}
+
+		// Lookups rely on the order
+		if (i > 0 && std::pair(entries[i - 1].type, entries[i - 1].id) >= std::pair(entry.type, entry.id))
+		{
+			return false;
+		}
+	}
+
+	mapping.entries = entries;
+	mapping.names = (const char*) content.data() + entriesLength;
+	return true;
+}
+
+static bool LoadResourceIndex(const fs::path& indexPath, const ResourceIndexHeader& expected, ResourceFork& fork)
+{
+	std::error_code ec;
+	const size_t indexLength = (size_t) fs::file_size(indexPath, ec);
+
+	if (ec || indexLength < sizeof(ResourceIndexHeader))
+	{
+		return false;
+	}
+
+	auto mapping = std::make_shared<ResourceIndexMapping>();
+
+#if POMME_MMAP
+	int fd = Pomme::Platform::Posix::OpenFileForMapping(indexPath);
+	const char* data = Pomme::Platform::Posix::MapFileRange(fd, 0, indexLength, &mapping->mappingBase, &mapping->mappingLength);
+	Pomme::Platform::Posix::CloseFileForMapping(fd);	// the mapping outlives the descriptor
+
+	if (!data)
+	{
+		return false;
+	}
+
+	bool ok = ParseResourceIndex({(const uint8_t*) data, indexLength}, expected, *mapping);
+#else
+	mapping->data.resize(indexLength);
+	std::ifstream file(indexPath, std::ios::binary);
+	file.read((char*) mapping->data.data(), (std::streamsize) mapping->data.size());
+
+	bool ok = file.good() && ParseResourceIndex(mapping->data, expected, *mapping);
+#endif
+
+	if (ok)
+	{
+		fork.mappedIndex = std::move(mapping);
+	}
+
+	return ok;
+}
+
+static ResourceMetadata MakeResourceMetadata(const ResourceFork& fork, const ResourceIndexEntry& entry)
+{
+	ResourceMetadata meta;
+	meta.forkRefNum = fork.fileRefNum;
+	meta.type       = entry.type;
+	meta.id         = entry.id;
+	meta.flags      = entry.flags;
+	meta.dataOffset = entry.dataOffset;
+	meta.size       = entry.size;
+	meta.name       = InternResourceName(std::string(fork.mappedIndex->names + entry.nameOffset, entry.nameLength));
+	return meta;
+}
+
+// Forks opened from an index are read-only, so every resource in resourceMap came from the index
+static bool HasUnloadedIndexEntries(const ResourceFork& fork)
+{
+	return fork.mappedIndex && fork.index.Size() < fork.mappedIndex->entries.size();
+}
+
+static const ResourceIndexEntry* FindIndexEntry(const ResourceIndexMapping& mapping, ResType theType, short theID)
+{
+	const auto key = std::pair<ResType, SInt16>(theType, theID);
+
+	auto it = std::lower_bound(mapping.entries.begin(), mapping.entries.end(), key,
+		[](const ResourceIndexEntry& entry, const auto& k) { return std::pair(entry.type, entry.id) < k; });
+
+	if (it == mapping.entries.end() || it->type != theType || it->id != theID)
+	{
+		return nullptr;
+	}
+
+	return &*it;
+}
+
+// Copies the resource from the fork's index to its resourceMap. Returns nullptr if the index doesn't have it.
+static const ResourceMetadata* FindInResourceIndex(ResourceFork& fork, ResType theType, short theID)
+{
+	const ResourceIndexEntry* entry = FindIndexEntry(*fork.mappedIndex, theType, theID);
+	return entry ? AddResourceToFork(fork, MakeResourceMetadata(fork, *entry)) : nullptr;
+}
+
+// For the calls that need the fork's whole resourceMap (e.g. to count or enumerate its resources)
+static void LoadWholeResourceIndex(ResourceFork& fork)
+{
+	if (!HasUnloadedIndexEntries(fork))
+	{
+		return;
+	}
+
+	for (const auto& entry : fork.mappedIndex->entries)
+	{
+		if (!fork.index.Find(ResourceKey(entry.type, entry.id)))
+		{
+			AddResourceToFork(fork, MakeResourceMetadata(fork, entry));
+		}
+	}
+}
+
+static void SaveResourceIndex(const fs::path& indexPath, ResourceIndexHeader header, const ResourceFork& fork)
+{
+	std::vector<ResourceIndexEntry> entries;
+	std::string names;
+
+	// Resources that are still only in the old index keep their entries
+	if (HasUnloadedIndexEntries(fork))
+	{
+		for (const auto& oldEntry : fork.mappedIndex->entries)
+		{
+			if (!fork.index.Find(ResourceKey(oldEntry.type, oldEntry.id)))
+			{
+				ResourceIndexEntry entry = oldEntry;
+				entry.nameOffset = (uint32_t) names.size();
+				names.append(fork.mappedIndex->names + oldEntry.nameOffset, oldEntry.nameLength);
+				entries.push_back(entry);
+			}
+		}
+	}
+
+	for (const auto& [type, resourcesOfType] : fork.resourceMap)
+	{
+		for (const auto& [id, meta] : resourcesOfType)
+		{
+			ResourceIndexEntry entry = {};
+			entry.dataOffset = meta.dataOffset;
+			entry.type       = meta.type;
+			entry.size       = meta.size;		// don't seek into the data section for sizes nobody asked for yet
+			entry.nameOffset = (uint32_t) names.size();
+			entry.id         = meta.id;
+			entry.flags      = meta.flags;
+			entry.nameLength = (Byte) std::min<size_t>(strlen(meta.name), 255);
+			names.append(meta.name, entry.nameLength);
+			entries.push_back(entry);
+		}
+	}
+
+	std::sort(entries.begin(), entries.end(),
+		[](const auto& a, const auto& b) { return std::pair(a.type, a.id) < std::pair(b.type, b.id); });
+
+	header.numResources = (uint32_t) entries.size();
+	header.namesLength = (uint32_t) names.size();
+	header.contentHash = HashBytes(entries.data(), entries.size() * sizeof(ResourceIndexEntry));
+	header.contentHash = HashBytes(names.data(), names.size(), header.contentHash);
+
+	// Write to a temporary file first so that a concurrent run never sees a half-written index
+	fs::path tempPath = indexPath;
+	tempPath += ".tmp";
+
+	std::error_code ec;
+	fs::create_directories(indexPath.parent_path(), ec);
+
+	{
+		std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+		file.write((const char*) &header, sizeof(header));
+		file.write((const char*) entries.data(), (std::streamsize) (entries.size() * sizeof(ResourceIndexEntry)));
+		file.write(names.data(), (std::streamsize) names.size());
+
+		if (!file.good())
+		{
+			std::cerr << "Couldn't write resource index " << tempPath << "\n";
+			file.close();
+			fs::remove(tempPath, ec);
+			return;
+		}
+	}
+
+	fs::rename(tempPath, indexPath, ec);
+
+	if (ec)
+	{
+		std::cerr << "Couldn't write resource index " << indexPath << ": " << ec.message() << "\n";
+		fs::remove(tempPath, ec);
+		return;
+	}
+
+	LOG << "Saved resource index " << indexPath << "\n";
+}
+
+static bool HasSizesMissingFromIndex(const ResourceFork& fork)
+{
+	for (const auto& [type, resourcesOfType] : fork.resourceMap)
+	{
+		for (const auto& [id, meta] : resourcesOfType)
+		{
+			if (meta.size < 0)
+			{
+				continue;
+			}
+
+			const ResourceIndexEntry* entry = fork.mappedIndex ? FindIndexEntry(*fork.mappedIndex, type, id) : nullptr;
+			if (!entry || entry->size < 0)
+			{
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+// A read-only fork learns the sizes of the resources it loads. When it's closed, they go into its index,
+// so that the next run can skip fetching them from the data section.
+static void RefreshResourceIndex(const ResourceFork& fork)
+{
+	if (fork.writable)
+	{
+		return;
+	}
+
+	const fs::path indexPath = GetResourceIndexPath(fork.fileRefNum);
+
+	if (!indexPath.empty() && HasSizesMissingFromIndex(fork))
+	{
+		auto header = MakeResourceIndexHeader(fork.fileRefNum, fork.dataSectionOff, fork.mapSectionOff, fork.mapSectionLen);
+		SaveResourceIndex(indexPath, header, fork);
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Resource cache
+//
+// When enabled, GetResource hands out the same handle for the same resource until it's purged,
+// like on a real Mac where resources stay loaded. Each GetResource takes a reference and each
+// ReleaseResource drops one; a resource nobody references stays in memory, but it's purgeable.
+// Purgeable resources are disposed of, least recently released first, when the cache goes over budget.
+
+static void UncacheResource(const ResourceMetadata* meta, bool disposeHandle)
+{
+	auto it = gResCache.find(meta);
+	if (it == gResCache.end())
+	{
+		return;
+	}
+
+	Handle handle = it->second.handle;
+
+	if (it->second.refCount == 0)
+	{
+		gResCachePurgeable.erase(it->second.purgeablePos);
+	}
+
+	gResCacheBytes -= it->second.size;
+	gResCache.erase(it);
+
+	// Erase the entry first so that DisposeHandle doesn't come back to us
+	if (disposeHandle)
+	{
+		DisposeHandle(handle);
+	}
+}
+
+static void PurgeResourceCache(Size budget)
+{
+	while (gResCacheBytes > budget && !gResCachePurgeable.empty())
+	{
+		UncacheResource(gResCachePurgeable.front(), true);
+		gResCachePurges++;
+	}
+}
+
+static Handle AcquireCachedResource(const ResourceMetadata* meta)
+{
+	auto it = gResCache.find(meta);
+	if (it == gResCache.end())
+	{
+		gResCacheMisses++;
+		return nullptr;
+	}
+
+	gResCacheHits++;
+
+	if (it->second.refCount == 0)
+	{
+		gResCachePurgeable.erase(it->second.purgeablePos);
+	}
+
+	it->second.refCount++;
+	return it->second.handle;
+}
+
+static void AddToResourceCache(const ResourceMetadata* meta, Handle handle)
+{
+	const Size size = GetHandleSize(handle);
+	gResCache[meta] = {handle, size, 1, {}};
+	gResCacheBytes += size;
+	PurgeResourceCache(gResCacheBudget);
+}
+
+// Returns false if the handle isn't in the cache
+static bool ReleaseCachedResource(Handle handle)
+{
+	if (!handle || gResCache.empty())
+	{
+		return false;
+	}
+
+	const auto* meta = Pomme::Memory::BlockDescriptor::HandleToBlock(handle)->rezMeta;
+
+	auto it = gResCache.find(meta);
+	if (it == gResCache.end() || it->second.handle != handle)
+	{
+		return false;
+	}
+
+	if (it->second.refCount > 0 && --it->second.refCount == 0)
+	{
+		it->second.purgeablePos = gResCachePurgeable.insert(gResCachePurgeable.end(), meta);
+		PurgeResourceCache(gResCacheBudget);
+	}
+
+	return true;
+}
+
+// Removes the handle from the cache without disposing of it
+static void ForgetCachedResource(Handle handle, const ResourceMetadata* meta)
+{
+	if (gResCache.empty())
+	{
+		return;
+	}
+
+	auto it = gResCache.find(meta);
+	if (it != gResCache.end() && it->second.handle == handle)
+	{
+		UncacheResource(meta, false);
+	}
+}
+
+// Called by DisposeHandle: the cache must not hand out a handle that the game has disposed of,
+// and a change that was never written is lost
+void Pomme::Files::OnResourceHandleDisposed(Handle handle, const ResourceMetadata* meta)
+{
+	ResLock lock(gResMutex);
+	ForgetCachedResource(handle, meta);
+
+	auto it = gPendingResourceWrites.find(meta);
+	if (it != gPendingResourceWrites.end() && it->second == handle)
+	{
+		gPendingResourceWrites.erase(it);
+
+		// An added resource that never made it to disk has nothing to fall back on
+		if (meta->dataOffset < 0)
+		{
+			RemoveResourceFromFork(*FindFork(meta->forkRefNum), meta);
+		}
+	}
+}
+
+// The resource's metadata is about to go away, so it can't stay in the cache
+static void UncacheDoomedResource(const ResourceMetadata* meta)
+{
+	auto it = gResCache.find(meta);
+	if (it == gResCache.end())
+	{
+		return;
+	}
+
+	bool inUse = it->second.refCount > 0;
+
+	if (inUse)
+	{
+		// Someone's still using it: leave it to them as a detached handle
+		Pomme::Memory::BlockDescriptor::HandleToBlock(it->second.handle)->rezMeta = nullptr;
+	}
+
+	UncacheResource(meta, !inUse);
+}
+
+// When a fork is closed, its metadata goes away, so its resources can't stay in the cache
+static void UncacheResourcesFromFork(short refNum)
+{
+	std::vector<const ResourceMetadata*> doomed;
+
+	for (const auto& [meta, cachedResource] : gResCache)
+	{
+		if (meta->forkRefNum == refNum)
+		{
+			doomed.push_back(meta);
+		}
+	}
+
+	for (const auto* meta : doomed)
+	{
+		UncacheDoomedResource(meta);
+	}
+}
+
+const ResourceMetadata* Pomme::Files::FindResourceMetadata(ResType theType, short theID, bool* writePending)
+{
+	ResLock lock(gResMutex);
+
+	const ResourceMetadata* meta = FindResource(theType, theID);
+	*writePending = meta && gPendingResourceWrites.contains(meta);
+	return meta;
+}
+
+void Pomme_SetResourceCacheBudget(Size maxBytes)
+{
+	ResLock lock(gResMutex);
+	gResCacheBudget = std::max<Size>(0, maxBytes);
+	PurgeResourceCache(gResCacheBudget);
+}
+
+void Pomme_GetResourceCacheStats(long* hits, long* misses, long* purges, Size* cachedBytes)
+{
+	ResLock lock(gResMutex);
+	if (hits) *hits = gResCacheHits;
+	if (misses) *misses = gResCacheMisses;
+	if (purges) *purges = gResCachePurges;
+	if (cachedBytes) *cachedBytes = gResCacheBytes;
+}
+
+//-----------------------------------------------------------------------------
+// Resource prefetching
+//
+// Pomme_PrefetchResources reads resources on the background I/O thread (see BackgroundIO.h).
+// The background thread reads the data straight into a handle, which waits in gPrefetchedResources
+// until GetResource claims it (and puts it in the cache, if enabled).
+
+static void CollectPrefetchedResources()
+{
+	std::vector<BackgroundIO::ResourceReadResult> results;
+	BackgroundIO::TakeResults(results);
+
+	for (auto& result : results)
+	{
+		auto* meta = (const ResourceMetadata*) result.key;
+		gInFlightPrefetches.erase(meta);
+
+		if (result.handle && !gPrefetchedResources.try_emplace(meta, result.handle).second)
+		{
+			DisposeHandle(result.handle);
+		}
+	}
+}
+
+// The resource's data is about to change or go away: its prefetched data, if any, is stale
+static void DropPrefetchedResource(const ResourceMetadata* meta)
+{
+	// A read that's still in flight would otherwise deliver stale data (or data keyed by a dangling pointer) later on
+	if (gInFlightPrefetches.contains(meta))
+	{
+		BackgroundIO::WaitAll();
+		CollectPrefetchedResources();
+	}
+
+	auto it = gPrefetchedResources.find(meta);
+	if (it != gPrefetchedResources.end())
+	{
+		DisposeHandle(it->second);
+		gPrefetchedResources.erase(it);
+	}
+}
+
+// Returns nullptr if the resource hasn't been prefetched
+static Handle NewHandleFromPrefetchedResource(const ResourceMetadata& meta)
+{
+	CollectPrefetchedResources();
+
+	auto it = gPrefetchedResources.find(&meta);
+	if (it == gPrefetchedResources.end())
+	{
+		return nullptr;
+	}
+
+	Handle handle = it->second;
+	gPrefetchedResources.erase(it);
+
+	// The background thread may have learned the size before we did
+	meta.size = (SInt32) GetHandleSize(handle);
+
+	return handle;
+}
+
+// A fork's metadata is about to go away: make sure no read for this fork is still in flight, and drop its prefetched data
+static void DropPrefetchedResourcesFromFork(short refNum)
+{
+	BackgroundIO::WaitAll();
+	CollectPrefetchedResources();
+
+	std::erase_if(gPrefetchedResources, [refNum](const auto& kv)
+	{
+		if (kv.first->forkRefNum != refNum)
+		{
+			return false;
+		}
+
+		DisposeHandle(kv.second);
+		return true;
+	});
+}
+
+long Pomme_PrefetchResources(ResType theType, const short* ids, int numIDs)
+{
+	ResLock lock(gResMutex);
+
+	std::vector<BackgroundIO::ResourceReadRequest> batch;
+
+	CollectPrefetchedResources();
+
+	for (int i = 0; i < numIDs; i++)
+	{
+		const ResourceMetadata* meta = FindResource(theType, ids[i]);
+
+		if (!meta
+			|| meta->dataOffset < 0
+			|| gResCache.contains(meta)
+			|| gPrefetchedResources.contains(meta)
+			|| gInFlightPrefetches.contains(meta)
+			|| gPendingResourceWrites.contains(meta))
+		{
+			continue;
+		}
+
+		// We can only read files that exist on the host
+		fs::path hostPath = Pomme::Files::GetHostPath(meta->forkRefNum);
+		if (hostPath.empty())
+		{
+			continue;
+		}
+
+		batch.push_back({std::move(hostPath), meta->dataOffset, meta->size, meta, meta->forkRefNum});
+		gInFlightPrefetches.insert(meta);
+	}
+
+	if (batch.empty())
+	{
+		return 0;
+	}
+
+	return BackgroundIO::Submit(std::move(batch));
+}
+
+Boolean Pomme_IsPrefetchDone(long token)
+{
+	return token <= 0 || BackgroundIO::IsDone(token);
+}
+
+void Pomme_WaitForPrefetch(long token)
+{
+	if (token > 0)
+	{
+		BackgroundIO::Wait(token);
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Resource map parsing
+
+static void ParseResourceMap(
+	BigEndianIStream& f,
+	ResourceFork& fork,
+	std::streamoff dataSectionOff,
+	std::streamoff mapSectionOff,
+	UInt32 mapSectionLen)
+{
+	// Read the entire map in one go, then parse it from memory
+	std::vector<uint8_t> mapBuf(mapSectionLen);
+	f.Goto(mapSectionOff);
+	f.Read((char*) mapBuf.data(), mapBuf.size());
+	const std::span<const uint8_t> map(mapBuf);
+
+	// map header
+	// skip junk (16 + 4 + 2) and UInt16 fileAttr (2)
+	size_t typeListOff = MapRead<UInt16>(map, 24);
+	size_t resNameListOff = MapRead<UInt16>(map, 26);
+
+	fork.mapAttributes = MapRead<UInt16>(map, 22);
+
+	// all resource types (an empty map stores 0xFFFF)
+	int nResTypes = (1 + MapRead<UInt16>(map, typeListOff)) & 0xFFFF;
+	for (int i = 0; i < nResTypes; i++)
+	{
+		size_t typeEntryOff = typeListOff + 2 + 8 * i;
+		OSType resType = MapRead<OSType>(map, typeEntryOff);
+		int    resCount = MapRead<UInt16>(map, typeEntryOff + 4) + 1;
+		size_t resRefListOff = MapRead<UInt16>(map, typeEntryOff + 6) + typeListOff;
+
+		for (int j = 0; j < resCount; j++)
+		{
+			size_t refOff = resRefListOff + 12 * j;
+			SInt16 resID = MapRead<SInt16>(map, refOff);
+			UInt16 resNameRelativeOff = MapRead<UInt16>(map, refOff + 2);
+			UInt32 resPackedAttr = MapRead<UInt32>(map, refOff + 4);
+			// skip 4 bytes of junk
+
+			// unpack attributes
+			Byte   resFlags = (resPackedAttr & 0xFF000000) >> 24;
+			std::streamoff resDataOff = (resPackedAttr & 0x00FFFFFF) + dataSectionOff;
+
+			// Check compressed flag
+			ResourceAssert(!(resFlags & 1), "FSpOpenResFile: Compressed resources not supported yet");
+
+			// Fetch name
+			std::string name;
+			if (resNameRelativeOff != 0xFFFF)
+			{
+				size_t nameOff = resNameListOff + resNameRelativeOff;
+				size_t nameLength = MapRead<Byte>(map, nameOff);
+				ResourceAssert(nameOff + 1 + nameLength <= map.size(), "FSpOpenResFile: Resource name past end of map");
+				name.assign((const char*) &map[nameOff + 1], nameLength);
+			}
+
+			// Don't fetch the size yet; it lives in the data section (see GetResourceSize)
+			ResourceMetadata resMetadata;
+			resMetadata.forkRefNum = fork.fileRefNum;
+			resMetadata.type       = resType;
+			resMetadata.id         = resID;
+			resMetadata.flags      = resFlags;
+			resMetadata.dataOffset = resDataOff + 4;
+			resMetadata.size       = -1;
+			resMetadata.name       = InternResourceName(std::move(name));
+
+			AddResourceToFork(fork, resMetadata);
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Resource writing
+//
+// Changed and added resources are appended past the end of the fork, followed by a fresh copy of the map.
+// The fork header is only pointed at the new map once everything else is on disk, so an interrupted save
+// leaves the previous version of the fork intact, and a save costs the changed bytes plus the map.
+// The superseded data and maps stay in the fork as dead space until the fork is compacted: rewritten whole
+// and atomically swapped in. That happens once dead space takes up over half the fork, or if the fork
+// can't grow in place.
+// Don't write to a fork while other threads are loading resources from it.
+
+static constexpr std::streamoff kResourceForkHeaderSize = 256;		// header (16) + system (112) and app (128) reserved data
+static constexpr std::streamoff kMaxResourceDataOffset = 0xFFFFFF;	// data offsets in the map are 24-bit
+static constexpr std::streamoff kMinDeadSpaceBeforeCompaction = 32 * 1024;
+
+// Serializes the fork's resource map. `dataOffsets` holds each resource's data offset, relative to the data section,
+// in the order of fork.resourceMap.
+static std::string BuildResourceMap(const ResourceFork& fork, const std::vector<UInt32>& dataOffsets)
+{
+	size_t numResources = 0;
+	for (const auto& [type, idsToResources] : fork.resourceMap)
+	{
+		numResources += idsToResources.size();
+	}
+
+	const size_t typeListOff = 28;
+	const size_t typeListLen = 2 + 8 * fork.resourceMap.size();
+	const size_t nameListOff = typeListOff + typeListLen + 12 * numResources;
+
+	std::ostringstream mapBuf;
+	std::string nameList;
+	auto f = Pomme::BigEndianOStream(mapBuf);
+
+	// map header: copy of the fork header (16), next map handle (4), file ref num (2) are all junk on disk
+	for (int i = 0; i < 22; i++)
+	{
+		f.Write<Byte>(0);
+	}
+	f.Write<UInt16>(fork.mapAttributes);
+	f.Write<UInt16>((UInt16) typeListOff);
+	f.Write<UInt16>((UInt16) nameListOff);
+
+	// type list
+	f.Write<UInt16>(UInt16(fork.resourceMap.size() - 1));		// 0xFFFF if there are no types
+	size_t refListOff = typeListLen;
+	for (const auto& [type, idsToResources] : fork.resourceMap)
+	{
+		f.Write<OSType>(type);
+		f.Write<UInt16>(UInt16(idsToResources.size() - 1));
+		f.Write<UInt16>((UInt16) refListOff);
+		refListOff += 12 * idsToResources.size();
+	}
+
+	// reference lists
+	size_t i = 0;
+	for (const auto& [type, idsToResources] : fork.resourceMap)
+	{
+		for (const auto& [id, meta] : idsToResources)
+		{
+			UInt16 nameOff = 0xFFFF;
+			if (meta.name[0])
+			{
+				ResourceAssert(nameList.size() < 0xFFFF, "UpdateResFile: Too many resource names");
+				nameOff = (UInt16) nameList.size();
+				std::string name(meta.name, std::min<size_t>(strlen(meta.name), 255));
+				nameList += char(name.size());
+				nameList += name;
+			}
+
+			f.Write<SInt16>(id);
+			f.Write<UInt16>(nameOff);
+			f.Write<UInt32>((UInt32(meta.flags & ~resChanged) << 24) | dataOffsets.at(i++));
+			f.Write<UInt32>(0);		// handle
+		}
+	}
+
+	f.WriteRawString(nameList);
+	return mapBuf.str();
+}
+
+static std::vector<UInt32> GetRelativeDataOffsets(const ResourceFork& fork)
+{
+	std::vector<UInt32> dataOffsets;
+	for (const auto& [type, idsToResources] : fork.resourceMap)
+	{
+		for (const auto& [id, meta] : idsToResources)
+		{
+			dataOffsets.push_back(UInt32(meta.dataOffset - 4 - fork.dataSectionOff));
+		}
+	}
+	return dataOffsets;
+}
+
+static void WriteResourceForkHeader(BigEndianOStream& f, std::streamoff dataOff, std::streamoff mapOff, UInt32 mapLen)
+{
+	f.Write<UInt32>(UInt32(dataOff));
+	f.Write<UInt32>(UInt32(mapOff));
+	f.Write<UInt32>(UInt32(mapOff - dataOff));
+	f.Write<UInt32>(mapLen);
+}
 
-static OSErr gLastResError = noErr;
+static SInt32 GetPendingOrStoredSize(const ResourceMetadata& meta)
+{
+	auto it = gPendingResourceWrites.find(&meta);
+	return it != gPendingResourceWrites.end() ? (SInt32) GetHandleSize(it->second) : GetResourceSize(meta);
+}
 
-static std::vector<ResourceFork> gResForkStack;
+// Whether `length` more bytes of resource data fit at the end of the fork without compacting it
+static bool CanAppendResourceData(const ResourceFork& fork, std::streamoff length)
+{
+	return Pomme::Files::CanForkGrow(fork.fileRefNum)
+		&& fork.forkEnd + length - fork.dataSectionOff <= kMaxResourceDataOffset;
+}
 
-static int gResForkStackIndex = 0;
+static OSErr AppendResourceData(ResourceFork& fork, const ResourceMetadata* metaPtr, Handle handle)
+{
+	auto& meta = fork.resourceMap.at(metaPtr->type).at(metaPtr->id);
+	const SInt32 size = (SInt32) GetHandleSize(handle);
 
-//-----------------------------------------------------------------------------
-// Internal
+	auto& stream = Pomme::Files::GetStream(fork.fileRefNum);
+	auto f = Pomme::BigEndianOStream(stream);
+	f.Goto(fork.forkEnd);
+	f.Write<SInt32>(size);
+	f.Write(*handle, size);
+	stream.flush();
 
-static void ResourceAssert(bool condition, const char* message)
+	if (!stream.good())
+	{
+		stream.clear();
+		return ioErr;
+	}
+
+	meta.dataOffset = fork.forkEnd + 4;
+	meta.size = size;
+	fork.forkEnd += 4 + size;
+	fork.mapChanged = true;
+	return noErr;
+}
+
+// Rewrites the whole fork without dead space, writing out all pending resources
+static OSErr CompactResourceFork(ResourceFork& fork)
 {
-	if (!condition)
+	const short refNum = fork.fileRefNum;
+
+	std::vector<char> contents(kResourceForkHeaderSize);
+
+	// Keep the reserved data
+	Pomme::Files::ReadAt(refNum, fork.forkOffset + 16, contents.data() + 16, kResourceForkHeaderSize - 16);
+
+	std::vector<UInt32> dataOffsets;
+	std::vector<SInt32> sizes;
+
+	for (const auto& [type, idsToResources] : fork.resourceMap)
 	{
-		throw std::runtime_error(message);
+		for (const auto& [id, meta] : idsToResources)
+		{
+			const SInt32 size = GetPendingOrStoredSize(meta);
+			const size_t start = contents.size();
+			ResourceAssert(start - kResourceForkHeaderSize <= kMaxResourceDataOffset, "UpdateResFile: Resource fork too big");
+
+			dataOffsets.push_back(UInt32(start - kResourceForkHeaderSize));
+			sizes.push_back(size);
+			contents.resize(start + 4 + size);
+			MapWrite<SInt32>(contents, start, size);
+
+			auto pending = gPendingResourceWrites.find(&meta);
+			if (pending != gPendingResourceWrites.end())
+			{
+				memcpy(contents.data() + start + 4, *pending->second, size);
+			}
+			else if (Pomme::Files::ReadAt(refNum, meta.dataOffset, contents.data() + start + 4, size) != (size_t) size)
+			{
+				return ioErr;
+			}
+		}
+	}
+
+	const std::streamoff mapOff = (std::streamoff) contents.size();
+	const std::string map = BuildResourceMap(fork, dataOffsets);
+	contents.insert(contents.end(), map.begin(), map.end());
+
+	MapWrite<UInt32>(contents, 0, UInt32(kResourceForkHeaderSize));
+	MapWrite<UInt32>(contents, 4, UInt32(mapOff));
+	MapWrite<UInt32>(contents, 8, UInt32(mapOff - kResourceForkHeaderSize));
+	MapWrite<UInt32>(contents, 12, UInt32(map.size()));
+
+	OSErr err = Pomme::Files::ReplaceForkContents(refNum, contents.data(), contents.size());
+	if (err != noErr)
+	{
+		return err;
+	}
+
+	// Point the metadata at the new layout
+	size_t i = 0;
+	fork.dataSectionOff = fork.forkOffset + kResourceForkHeaderSize;
+	for (auto& [type, idsToResources] : fork.resourceMap)
+	{
+		for (auto& [id, meta] : idsToResources)
+		{
+			meta.dataOffset = fork.dataSectionOff + dataOffsets[i] + 4;
+			meta.size = sizes[i];
+			gPendingResourceWrites.erase(&meta);
+			i++;
+		}
 	}
+
+	fork.mapSectionOff = fork.forkOffset + mapOff;
+	fork.mapSectionLen = (UInt32) map.size();
+	fork.forkEnd = fork.forkOffset + (std::streamoff) contents.size();
+	fork.mapChanged = false;
+
+	LOG << "Compacted resource fork #" << refNum << ": " << contents.size() << " bytes\n";
+	return noErr;
 }
 
-static ResourceFork& GetCurRF()
+static OSErr UpdateResourceFork(ResourceFork& fork)
 {
-	return gResForkStack[gResForkStackIndex];
+	if (!fork.writable)
+	{
+		return noErr;
+	}
+
+	std::vector<std::pair<const ResourceMetadata*, Handle>> pending;
+	std::streamoff pendingBytes = 0;
+	std::streamoff liveBytes = kResourceForkHeaderSize;
+	size_t numResources = 0;
+
+	for (const auto& [type, idsToResources] : fork.resourceMap)
+	{
+		for (const auto& [id, meta] : idsToResources)
+		{
+			auto it = gPendingResourceWrites.find(&meta);
+			if (it != gPendingResourceWrites.end())
+			{
+				pending.emplace_back(&meta, it->second);
+				pendingBytes += 4 + GetHandleSize(it->second);
+			}
+
+			liveBytes += 4 + GetPendingOrStoredSize(meta);
+			numResources++;
+		}
+	}
+
+	if (pending.empty() && !fork.mapChanged)
+	{
+		return noErr;
+	}
+
+	// Prefetches captured the data offsets they read from when they were submitted, and we're about to move data around
+	DropPrefetchedResourcesFromFork(fork.fileRefNum);
+
+	// The map's size doesn't depend on where the data goes
+	const std::streamoff mapLen = (std::streamoff) BuildResourceMap(fork, std::vector<UInt32>(numResources, 0)).size();
+	const std::streamoff appendedSize = fork.forkEnd + pendingBytes + mapLen - fork.forkOffset;
+	const std::streamoff deadSpace = appendedSize - liveBytes - mapLen;
+
+	const bool mustCompact = !CanAppendResourceData(fork, pendingBytes);
+	const bool shouldCompact = deadSpace >= kMinDeadSpaceBeforeCompaction && 2 * deadSpace > appendedSize;
+
+	if (mustCompact || shouldCompact)
+	{
+		OSErr err = CompactResourceFork(fork);
+		if (err == noErr || mustCompact)
+		{
+			return err;
+		}
+	}
+
+	for (const auto& [meta, handle] : pending)
+	{
+		OSErr err = AppendResourceData(fork, meta, handle);
+		if (err != noErr)
+		{
+			return err;
+		}
+		gPendingResourceWrites.erase(meta);
+	}
+
+	// Write the new map past the data, then commit by pointing the header at it
+	const std::string map = BuildResourceMap(fork, GetRelativeDataOffsets(fork));
+	const std::streamoff mapOff = fork.forkEnd;
+
+	auto& stream = Pomme::Files::GetStream(fork.fileRefNum);
+	auto f = Pomme::BigEndianOStream(stream);
+	f.Goto(mapOff);
+	f.WriteRawString(map);
+	stream.flush();
+
+	OSErr err = stream.good()
+		? Pomme::Files::SetForkContentsLength(fork.fileRefNum, mapOff + (std::streamoff) map.size() - fork.forkOffset)
+		: (OSErr) ioErr;
+
+	if (err == noErr)
+	{
+		f.Goto(fork.forkOffset);
+		WriteResourceForkHeader(f, fork.dataSectionOff - fork.forkOffset, mapOff - fork.forkOffset, (UInt32) map.size());
+		stream.flush();
+		err = stream.good() ? (OSErr) noErr : (OSErr) ioErr;
+	}
+
+	if (err != noErr)
+	{
+		stream.clear();
+		return err;
+	}
+
+	fork.mapSectionOff = mapOff;
+	fork.mapSectionLen = (UInt32) map.size();
+	fork.forkEnd = mapOff + (std::streamoff) map.size();
+	fork.mapChanged = false;
+	return noErr;
+}
+
+// The handles of a closing fork's unwritten resources go back to the caller as plain handles
+static void DropPendingResourceWritesFromFork(short refNum)
+{
+	std::erase_if(gPendingResourceWrites, [refNum](const auto& kv)
+	{
+		if (kv.first->forkRefNum != refNum)
+		{
+			return false;
+		}
+		Pomme::Memory::BlockDescriptor::HandleToBlock(kv.second)->rezMeta = nullptr;
+		return true;
+	});
 }
 
 //-----------------------------------------------------------------------------
@@ -51,10 +1431,25 @@ OSErr ResError(void)
 	return gLastResError;
 }
 
+void Pomme_SetResourceIndexFolder(const char* hostPath)
+{
+	ResLock lock(gResMutex);
+	gResIndexFolder = hostPath ? fs::path(hostPath) : fs::path();
+}
+
 short FSpOpenResFile(const FSSpec* spec, char permission)
 {
+	ResLock lock(gResMutex);
+
 	short slot;
 
+	// The Resource Manager must be able to read a fork it writes to
+	const bool writable = permission & fsWrPerm;
+	if (writable)
+	{
+		permission = fsRdWrPerm;
+	}
+
 	gLastResError = FSpOpenRF(spec, permission, &slot);
 
 	if (noErr != gLastResError)
@@ -72,82 +1467,91 @@ short FSpOpenResFile(const FSSpec* spec, char permission)
 	gResForkStackIndex = int(gResForkStack.size() - 1);
 	GetCurRF().fileRefNum = slot;
 	GetCurRF().resourceMap.clear();
+	OnResForkStackChanged();
 
 	// -------------------
 	// Resource Header
 	std::streamoff dataSectionOff = f.Read<UInt32>() + resForkOff;
 	std::streamoff mapSectionOff = f.Read<UInt32>() + resForkOff;
-	f.Skip(4); // UInt32 dataSectionLen
-	f.Skip(4); // UInt32 mapSectionLen
+	UInt32 dataSectionLen = f.Read<UInt32>();
+	UInt32 mapSectionLen = f.Read<UInt32>();
 	f.Skip(112 + 128); // system- (112) and app- (128) reserved data
 
 	ResourceAssert(f.Tell() == dataSectionOff, "FSpOpenResFile: Unexpected data offset");
 
-	f.Goto(mapSectionOff);
+	auto& fork = GetCurRF();
+	fork.writable = writable;
+	fork.forkOffset = resForkOff;
+	fork.dataSectionOff = dataSectionOff;
+	fork.mapSectionOff = mapSectionOff;
+	fork.mapSectionLen = mapSectionLen;
+	fork.forkEnd = std::max(dataSectionOff + dataSectionLen, mapSectionOff + mapSectionLen);
 
-	// map header
-	f.Skip(16 + 4 + 2); // junk
-	f.Skip(2); // UInt16 fileAttr
-	std::streamoff typeListOff = f.Read<UInt16>() + mapSectionOff;
-	std::streamoff resNameListOff = f.Read<UInt16>() + mapSectionOff;
+	// -------------------
+	// Resource map: skip parsing it if we have an up-to-date index for this fork
+	// (the index doesn't keep the map attributes, which a writable fork must preserve)
+	fs::path indexPath = writable ? fs::path() : GetResourceIndexPath(slot);
+	ResourceIndexHeader indexHeader = {};
 
-	// all resource types
-	int nResTypes = 1 + f.Read<UInt16>();
-	for (int i = 0; i < nResTypes; i++)
+	if (!indexPath.empty())
 	{
-		OSType resType = f.Read<OSType>();
-		int    resCount = f.Read<UInt16>() + 1;
-		std::streamoff resRefListOff = f.Read<UInt16>() + typeListOff;
+		indexHeader = MakeResourceIndexHeader(slot, dataSectionOff, mapSectionOff, mapSectionLen);
 
-		// The guard will rewind the file cursor to the pos in the next iteration
-		auto guard1 = f.GuardPos();
+		if (LoadResourceIndex(indexPath, indexHeader, GetCurRF()))
+		{
+			LOG << "Loaded resource index " << indexPath << "\n";
+			return slot;
+		}
+	}
 
-		f.Goto(resRefListOff);
+	ParseResourceMap(f, GetCurRF(), dataSectionOff, mapSectionOff, mapSectionLen);
 
-		for (int j = 0; j < resCount; j++)
-		{
-			SInt16 resID = f.Read<UInt16>();
-			UInt16 resNameRelativeOff = f.Read<UInt16>();
-			UInt32 resPackedAttr = f.Read<UInt32>();
-			f.Skip(4); // junk
+	if (!indexPath.empty())
+	{
+		SaveResourceIndex(indexPath, indexHeader, GetCurRF());
+	}
 
-			// The guard will rewind the file cursor to the pos in the next iteration
-			auto guard2 = f.GuardPos();
+	//PrintStack(__func__);
 
-			// unpack attributes
-			Byte   resFlags = (resPackedAttr & 0xFF000000) >> 24;
-			std::streamoff resDataOff = (resPackedAttr & 0x00FFFFFF) + dataSectionOff;
+	return slot;
+}
 
-			// Check compressed flag
-			ResourceAssert(!(resFlags & 1), "FSpOpenResFile: Compressed resources not supported yet");
+void FSpCreateResFile(const FSSpec* spec, OSType creator, OSType fileType, ScriptCode scriptTag)
+{
+	(void) scriptTag;
 
-			// Fetch name
-			std::string name;
-			if (resNameRelativeOff != 0xFFFF)
-			{
-				f.Goto(resNameListOff + resNameRelativeOff);
-				name = f.ReadPascalString();
-			}
+	ResLock lock(gResMutex);
 
-			// Fetch size
-			f.Goto(resDataOff);
-			SInt32 size = f.Read<SInt32>();
+	gLastResError = Pomme::Files::CreateResourceFork(spec, creator, fileType);
+	if (gLastResError != noErr)
+	{
+		return;
+	}
 
-			ResourceMetadata resMetadata;
-			resMetadata.forkRefNum = slot;
-			resMetadata.type       = resType;
-			resMetadata.id         = resID;
-			resMetadata.flags      = resFlags;
-			resMetadata.dataOffset = resDataOff + 4;
-			resMetadata.size       = size;
-			resMetadata.name       = name;
-			GetCurRF().resourceMap[resType][resID] = resMetadata;
-		}
+	short refNum;
+	gLastResError = FSpOpenRF(spec, fsRdWrPerm, &refNum);
+	if (gLastResError != noErr)
+	{
+		return;
 	}
 
-	//PrintStack(__func__);
+	// Header followed by an empty map
+	const std::string map = BuildResourceMap(ResourceFork(), {});
 
-	return slot;
+	auto& stream = Pomme::Files::GetStream(refNum);
+	std::streamoff forkOffset = stream.tellg();
+	auto f = Pomme::BigEndianOStream(stream);
+	f.Goto(forkOffset);
+	WriteResourceForkHeader(f, kResourceForkHeaderSize, kResourceForkHeaderSize, (UInt32) map.size());
+	f.WriteRawString(std::string(kResourceForkHeaderSize - 16, '\0'));
+	f.WriteRawString(map);
+	stream.flush();
+
+	gLastResError = stream.good()
+		? Pomme::Files::SetForkContentsLength(refNum, kResourceForkHeaderSize + (std::streamoff) map.size())
+		: (OSErr) ioErr;
+
+	Pomme::Files::CloseStream(refNum);
 }
 
 short OpenResFile(const char* cName)
@@ -161,20 +1565,23 @@ void UseResFile(short refNum)
 {
 	// See MoreMacintoshToolbox:1-69
 
+	ResLock lock(gResMutex);
+
 	gLastResError = unimpErr;
 
 	ResourceAssert(refNum != 0, "UseResFile: Using the System file's resource fork is not implemented.");
 	ResourceAssert(refNum >= 0, "UseResFile: Illegal refNum");
 	ResourceAssert(IsStreamOpen(refNum), "UseResFile: Resource stream not open");
 
-	for (size_t i = 0; i < gResForkStack.size(); i++)
+	if (auto* position = gResForkStackPositions.Find(refNum))
 	{
-		if (gResForkStack[i].fileRefNum == refNum)
+		gLastResError = noErr;
+		if (gResForkStackIndex != *position)
 		{
-			gLastResError = noErr;
-			gResForkStackIndex = (int) i;
-			return;
+			gResForkStackIndex = *position;
+			gResLookupCache.Clear();
 		}
+		return;
 	}
 
 	std::cerr << "no RF open with refNum " << rfNumErr << "\n";
@@ -183,16 +1590,38 @@ void UseResFile(short refNum)
 
 short CurResFile()
 {
+	ResLock lock(gResMutex);
 	return GetCurRF().fileRefNum;
 }
 
+void UpdateResFile(short refNum)
+{
+	ResLock lock(gResMutex);
+
+	ResourceFork* fork = FindFork(refNum);
+
+	gLastResError = fork ? UpdateResourceFork(*fork) : (OSErr) resFNotFound;
+}
+
 void CloseResFile(short refNum)
 {
+	ResLock lock(gResMutex);
+
 	ResourceAssert(refNum != 0, "CloseResFile: Closing the System file's resource fork is not implemented.");
 	ResourceAssert(refNum >= 0, "CloseResFile: Illegal refNum");
 	ResourceAssert(IsStreamOpen(refNum), "CloseResFile: Resource stream not open");
 
-	//UpdateResFile(refNum); // MMT:1-110
+	UpdateResFile(refNum); // MMT:1-110
+	DropPendingResourceWritesFromFork(refNum);
+
+	if (ResourceFork* fork = FindFork(refNum))
+	{
+		RefreshResourceIndex(*fork);
+	}
+
+	DropPrefetchedResourcesFromFork(refNum);
+	UncacheResourcesFromFork(refNum);
+	DecodedResources::ForgetFork(refNum);
 	Pomme::Files::CloseStream(refNum);
 
 	auto it = gResForkStack.begin();
@@ -205,12 +1634,17 @@ void CloseResFile(short refNum)
 	}
 
 	gResForkStackIndex = std::min(gResForkStackIndex, (int) gResForkStack.size() - 1);
+	OnResForkStackChanged();
 }
 
 short Count1Resources(ResType theType)
 {
+	ResLock lock(gResMutex);
+
 	gLastResError = noErr;
 
+	LoadWholeResourceIndex(GetCurRF());
+
 	try
 	{
 		return (short) GetCurRF().resourceMap.at(theType).size();
@@ -223,11 +1657,16 @@ short Count1Resources(ResType theType)
 
 short Count1Types()
 {
+	ResLock lock(gResMutex);
+	LoadWholeResourceIndex(GetCurRF());
 	return (short) GetCurRF().resourceMap.size();
 }
 
 void Get1IndType(ResType* theType, short index)
 {
+	ResLock lock(gResMutex);
+
+	LoadWholeResourceIndex(GetCurRF());
 	const auto& resourceMap = GetCurRF().resourceMap;
 
 	for (auto& it : resourceMap)
@@ -246,50 +1685,90 @@ void Get1IndType(ResType* theType, short index)
 
 Handle GetResource(ResType theType, short theID)
 {
+	std::unique_lock<std::recursive_mutex> lock(gResMutex);
+
 	gLastResError = noErr;
 
-	for (int i = gResForkStackIndex; i >= 0; i--)
+	const ResourceMetadata* metaPtr = FindResource(theType, theID);
+
+	if (!metaPtr)
+	{
+		gLastResError = resNotFound;
+		return nil;
+	}
+
+	// A resource that's been changed or added, but not written yet, only exists in its handle
+	if (!gPendingResourceWrites.empty())
 	{
-		const auto& fork = gResForkStack[i];
+		auto it = gPendingResourceWrites.find(metaPtr);
+		if (it != gPendingResourceWrites.end())
+		{
+			return it->second;
+		}
+	}
 
-		if (fork.resourceMap.end() == fork.resourceMap.find(theType))
-			continue;
+	const bool useCache = gResCacheBudget > 0;
 
-		auto& resourcesOfType = fork.resourceMap.at(theType);
-		if (resourcesOfType.end() == resourcesOfType.find(theID))
-			continue;
+	if (useCache)
+	{
+		if (Handle cachedHandle = AcquireCachedResource(metaPtr))
+		{
+			return cachedHandle;
+		}
+	}
+
+	const auto& meta = *metaPtr;
 
-		// Found it!
-		const auto& meta = fork.resourceMap.at(theType).at(theID);
-		auto& forkStream = Pomme::Files::GetStream(gResForkStack[i].fileRefNum);
+	// Claim the data if the resource was prefetched
+	Handle handle = NewHandleFromPrefetchedResource(meta);
 
-		// Allocate handle
-		Handle handle = NewHandle(meta.size);
+	if (!handle)
+	{
+		// Read the data without holding the lock, so that other threads can load resources meanwhile
+		const SInt32 knownSize = meta.size;
 
-		// Set pointer to resource metadata
-		Pomme::Memory::BlockDescriptor::HandleToBlock(handle)->rezMeta = &meta;
+		lock.unlock();
+		handle = LoadResourceData(meta, knownSize);
+		lock.lock();
 
-		forkStream.seekg(meta.dataOffset, std::ios::beg);
-		forkStream.read(*handle, meta.size);
+		meta.size = (SInt32) GetHandleSize(handle);
 
-		return handle;
+		// Another thread may have loaded the same resource in the meantime: hand out its handle instead
+		if (useCache && gResCache.contains(&meta))
+		{
+			DisposeHandle(handle);
+			gResCacheMisses--;
+			return AcquireCachedResource(&meta);
+		}
 	}
 
-	gLastResError = resNotFound;
-	return nil;
+	// Set pointer to resource metadata
+	Pomme::Memory::BlockDescriptor::HandleToBlock(handle)->rezMeta = &meta;
+
+	if (useCache)
+	{
+		AddToResourceCache(&meta, handle);
+	}
+
+	return handle;
 }
 
 Handle Get1IndResource(ResType theType, short index)
 {
+	std::unique_lock<std::recursive_mutex> lock(gResMutex);
+
 	gLastResError = noErr;
 
+	LoadWholeResourceIndex(GetCurRF());
 	const auto& idsToResources = GetCurRF().resourceMap.at(theType);
 
 	for (auto& it : idsToResources)
 	{
 		if (index == 1)			// remember, index is 1-based here
 		{
-			return GetResource(theType, it.second.id);
+			SInt16 theID = it.second.id;
+			lock.unlock();		// let GetResource drop the lock while it reads
+			return GetResource(theType, theID);
 		}
 
 		index--;
@@ -324,52 +1803,180 @@ void GetResInfo(Handle theResource, short* theID, ResType* theType, char* name25
 		*theType = blockDescriptor->rezMeta->type;
 
 	if (name256)
-		snprintf(name256, 256, "%s", blockDescriptor->rezMeta->name.c_str());
+		snprintf(name256, 256, "%s", blockDescriptor->rezMeta->name);
+}
+
+// Returns true if the handle holds changes that haven't been written yet
+static bool IsResourceWritePending(Handle theResource)
+{
+	if (!theResource || gPendingResourceWrites.empty())
+	{
+		return false;
+	}
+
+	auto it = gPendingResourceWrites.find(Pomme::Memory::BlockDescriptor::HandleToBlock(theResource)->rezMeta);
+	return it != gPendingResourceWrites.end() && it->second == theResource;
 }
 
 void ReleaseResource(Handle theResource)
 {
-	DisposeHandle(theResource);
+	ResLock lock(gResMutex);
+
+	gLastResError = noErr;
+
+	// Like on a real Mac, changed resources can't be released until they're written
+	if (IsResourceWritePending(theResource))
+	{
+		gLastResError = resAttrErr;
+		return;
+	}
+
+	if (!ReleaseCachedResource(theResource))
+	{
+		DisposeHandle(theResource);
+	}
 }
 
+// Like on a real Mac, the handle isn't disposed of: it becomes an ordinary handle that belongs to the caller
 void RemoveResource(Handle theResource)
 {
-	DisposeHandle(theResource);
-	TODO();
+	ResLock lock(gResMutex);
+
+	gLastResError = noErr;
+
+	auto* blockDescriptor = Pomme::Memory::BlockDescriptor::HandleToBlock(theResource);
+	const ResourceMetadata* meta = blockDescriptor ? blockDescriptor->rezMeta : nullptr;
+	ResourceFork* fork = FindWritableFork(meta);
+
+	if (!fork)
+	{
+		gLastResError = rmvResFailed;
+		return;
+	}
+
+	gPendingResourceWrites.erase(meta);
+	DropPrefetchedResource(meta);
+	ForgetCachedResource(theResource, meta);
+	UncacheDoomedResource(meta);		// another handle to the same resource may be cached
+	DecodedResources::Forget(meta);
+	blockDescriptor->rezMeta = nullptr;
+
+	RemoveResourceFromFork(*fork, meta);
 }
 
 void AddResource(Handle theData, ResType theType, short theID, const char* name)
 {
-	(void) theData;
-	(void) theType;
-	(void) theID;
-	(void) name;
+	ResLock lock(gResMutex);
 
-	TODO();
+	gLastResError = noErr;
+
+	auto* blockDescriptor = Pomme::Memory::BlockDescriptor::HandleToBlock(theData);
+
+	// Unlike a real Mac, don't let two resources share a type and ID.
+	// Blocks in a memory zone can't become resources either: the zone may be disposed of before the resource is written.
+	if (!blockDescriptor
+		|| blockDescriptor->rezMeta
+		|| blockDescriptor->zone
+		|| gResForkStack.empty()
+		|| !GetCurRF().writable
+		|| GetCurRF().index.Find(ResourceKey(theType, theID)))
+	{
+		gLastResError = addResFailed;
+		return;
+	}
+
+	auto& fork = GetCurRF();
+
+	ResourceMetadata meta;
+	meta.forkRefNum = fork.fileRefNum;
+	meta.type       = theType;
+	meta.id         = theID;
+	meta.flags      = 0;
+	meta.dataOffset = -1;		// not on disk yet
+	meta.size       = (SInt32) GetHandleSize(theData);
+	meta.name       = InternResourceName(name ? name : "");
+
+	AddResourceToFork(fork, meta);
+	fork.mapChanged = true;
+	gResLookupCache.Clear();
+
+	const ResourceMetadata* storedMeta = *fork.index.Find(ResourceKey(theType, theID));
+	blockDescriptor->rezMeta = storedMeta;
+	gPendingResourceWrites[storedMeta] = theData;
 }
 
 void ChangedResource(Handle theResource)
 {
-	(void) theResource;
+	ResLock lock(gResMutex);
 
-	TODO();
+	gLastResError = noErr;
+
+	auto* blockDescriptor = Pomme::Memory::BlockDescriptor::HandleToBlock(theResource);
+	const ResourceMetadata* meta = blockDescriptor ? blockDescriptor->rezMeta : nullptr;
+
+	if (!meta)
+	{
+		gLastResError = resNotFound;
+		return;
+	}
+
+	if (!FindWritableFork(meta))
+	{
+		gLastResError = wrPermErr;
+		return;
+	}
+
+	gPendingResourceWrites[meta] = theResource;
+	DropPrefetchedResource(meta);
+	DecodedResources::Forget(meta);
 }
 
 void WriteResource(Handle theResource)
 {
-	(void) theResource;
+	ResLock lock(gResMutex);
 
-	TODO();
+	gLastResError = noErr;
+
+	if (!IsResourceWritePending(theResource))
+	{
+		return;
+	}
+
+	const ResourceMetadata* meta = Pomme::Memory::BlockDescriptor::HandleToBlock(theResource)->rezMeta;
+	ResourceFork& fork = *FindWritableFork(meta);
+
+	// If the fork must be compacted first, leave the resource to UpdateResFile
+	if (CanAppendResourceData(fork, 4 + GetHandleSize(theResource)))
+	{
+		gLastResError = AppendResourceData(fork, meta, theResource);
+		if (gLastResError == noErr)
+		{
+			gPendingResourceWrites.erase(meta);
+		}
+	}
 }
 
 void DetachResource(Handle theResource)
 {
+	ResLock lock(gResMutex);
+
 	gLastResError = noErr;
 
 	auto* blockDescriptor = Pomme::Memory::BlockDescriptor::HandleToBlock(theResource);
 
 	if (!blockDescriptor->rezMeta)
+	{
 		gLastResError = resNotFound;
+	}
+	else if (IsResourceWritePending(theResource))
+	{
+		gLastResError = resAttrErr;
+		return;
+	}
+	else
+	{
+		ForgetCachedResource(theResource, blockDescriptor->rezMeta);		// the handle belongs to the caller now
+	}
 
 	blockDescriptor->rezMeta = nullptr;
 }
@@ -1,6 +1,9 @@
 #pragma once
 
 #include <memory>
+#include <mutex>
+#include "PommeEnums.h"
+#include "CompilerSupport/filesystem.h"
 #include "Utilities/StringUtils.h"
 
 namespace Pomme::Files
@@ -18,6 +21,9 @@ namespace Pomme::Files
 		char permission;
 		FSSpec spec;
 
+	private:
+		std::mutex readAtMutex;
+
 	protected:
 		ForkHandle(ForkType _forkType, char _permission, const FSSpec& _spec)
 			: forkType(_forkType)
@@ -28,6 +34,80 @@ namespace Pomme::Files
 	public:
 		virtual std::iostream& GetStream() = 0;
 
+		// Maps a range of the fork into memory as a private, copy-on-write view, if the backing storage allows it.
+		// Returns a pointer to the data, or nullptr if the range can't be mapped (read it from the stream instead).
+		// The mapping must be released with Pomme::Platform::Posix::UnmapFileRange(*mappingBase, *mappingLength).
+		virtual char* MapRange(std::streamoff offset, size_t length, void** mappingBase, size_t* mappingLength)
+		{
+			(void) offset;
+			(void) length;
+			(void) mappingBase;
+			(void) mappingLength;
+			return nullptr;
+		}
+
+		// Reads up to `length` bytes at `offset` without moving the stream's position, so that several threads
+		// can read from the same fork. Returns the number of bytes read.
+		// Volumes should override this with a truly positional read; this fallback serializes ReadAt calls
+		// and restores the stream position, so it's only safe if nobody else uses the stream meanwhile.
+		virtual size_t ReadAt(std::streamoff offset, char* buffer, size_t length)
+		{
+			std::lock_guard<std::mutex> lock(readAtMutex);
+
+			auto& stream = GetStream();
+			auto state = stream.rdstate();
+			stream.clear();
+			auto savedPos = stream.tellg();
+
+			stream.seekg(offset, std::ios::beg);
+			stream.read(buffer, length);
+			size_t got = (size_t) stream.gcount();
+
+			stream.clear();
+			stream.seekg(savedPos, std::ios::beg);
+			stream.setstate(state);
+			return got;
+		}
+
+		// Path to the file backing this fork on the host filesystem, or nullptr if there is no such file.
+		virtual const fs::path* GetHostPath() const
+		{
+			return nullptr;
+		}
+
+		// Writes out buffered data. Volumes backed by host files also wait for it to reach the storage device.
+		virtual OSErr Sync()
+		{
+			auto& stream = GetStream();
+			stream.flush();
+			return stream.bad() ? ioErr : noErr;
+		}
+
+		//-----------------------------------------------------------------------------
+		// Resource fork writing. The fork's contents start wherever OpenFork left the stream
+		// (for host resource forks, that's past the AppleDouble header).
+
+		// Whether data may be written past the current end of the contents
+		virtual bool CanGrow() const
+		{
+			return permission & fsWrPerm;
+		}
+
+		// Records the new length of the contents after they've grown (e.g. in an AppleDouble header)
+		virtual OSErr SetContentsLength(std::streamoff length)
+		{
+			(void) length;
+			return (permission & fsWrPerm) ? noErr : wrPermErr;
+		}
+
+		// Atomically replaces the contents. They start at the same stream offset afterwards.
+		virtual OSErr ReplaceContents(const char* data, size_t length)
+		{
+			(void) data;
+			(void) length;
+			return wrPermErr;
+		}
+
 		virtual ~ForkHandle() = default;
 	};
 
@@ -55,6 +135,16 @@ namespace Pomme::Files
 
 		virtual OSErr FSpCreate(const FSSpec* spec, OSType creator, OSType fileType, ScriptCode scriptTag) = 0;
 
+		// Creates an empty (zero-length) resource fork, and the file itself if it doesn't exist yet.
+		// The Resource Manager then writes an empty resource map into it (see FSpCreateResFile).
+		virtual OSErr CreateResourceFork(const FSSpec* spec, OSType creator, OSType fileType)
+		{
+			(void) spec;
+			(void) creator;
+			(void) fileType;
+			return wPrErr;
+		}
+
 		virtual OSErr FSpDelete(const FSSpec* spec) = 0;
 
 		virtual OSErr DirCreate(long parentDirID, const u8string& directoryName, long* createdDirID) = 0;
@@ -0,0 +1,499 @@
+#include "PommeFiles.h"
+#include "Files/WriteBehind.h"
+#include "Files/BackgroundIO.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <streambuf>
+#include <unordered_map>
+#include <vector>
+
+// Once this many bytes are pending, they're handed to the background thread
+#if !defined(POMME_WRITE_BEHIND_THRESHOLD)
+	#define POMME_WRITE_BEHIND_THRESHOLD (64 * 1024)
+#endif
+
+using namespace Pomme::Files;
+using namespace Pomme::Files::WriteBehind;
+
+// Pending writes, keyed by file offset. Extents never overlap or touch each other.
+using Extents = std::map<std::streamoff, std::vector<char>>;
+
+// If `reserve` is set and a new extent is started, it gets room for a full flush's worth of data
+// (for sequential writes at the end of the file, which would otherwise regrow the buffer over and over).
+static void AddExtent(Extents& extents, std::streamoff offset, const char* data, size_t length, bool reserve)
+{
+	const std::streamoff end = offset + (std::streamoff) length;
+
+	// First extent that overlaps or touches [offset, end]
+	auto first = extents.upper_bound(offset);
+	if (first != extents.begin())
+	{
+		auto prev = std::prev(first);
+		if (prev->first + (std::streamoff) prev->second.size() >= offset)
+		{
+			first = prev;
+		}
+	}
+
+	if (first == extents.end() || first->first > end)
+	{
+		std::vector<char> buf;
+		if (reserve)
+		{
+			buf.reserve(std::max<size_t>(length, POMME_WRITE_BEHIND_THRESHOLD));
+		}
+		buf.assign(data, data + length);
+		extents.emplace_hint(first, offset, std::move(buf));
+		return;
+	}
+
+	const std::streamoff start = std::min(offset, first->first);
+	std::streamoff mergedEnd = end;
+	auto last = first;
+	while (last != extents.end() && last->first <= end)
+	{
+		mergedEnd = std::max(mergedEnd, last->first + (std::streamoff) last->second.size());
+		++last;
+	}
+
+	// Common case: sequential writes extending a single extent
+	if (first->first == start && std::next(first) == last)
+	{
+		auto& buf = first->second;
+		if ((std::streamoff) buf.size() < end - start)
+		{
+			buf.resize(end - start);
+		}
+		memcpy(buf.data() + (offset - start), data, length);
+		return;
+	}
+
+	std::vector<char> merged(mergedEnd - start);
+	for (auto it = first; it != last; ++it)
+	{
+		memcpy(merged.data() + (it->first - start), it->second.data(), it->second.size());
+	}
+	memcpy(merged.data() + (offset - start), data, length);
+
+	extents.erase(first, last);
+	extents.emplace(start, std::move(merged));
+}
+
+// Copies the parts of the extents that fall within [pos, pos + length) to dst
+static void OverlayExtents(const Extents& extents, char* dst, std::streamoff pos, std::streamoff length)
+{
+	auto it = extents.upper_bound(pos);
+	if (it != extents.begin())
+	{
+		--it;
+	}
+
+	for (; it != extents.end() && it->first < pos + length; ++it)
+	{
+		std::streamoff from = std::max(pos, it->first);
+		std::streamoff to = std::min(pos + length, it->first + (std::streamoff) it->second.size());
+		if (from < to)
+		{
+			memcpy(dst + (from - pos), it->second.data() + (from - it->first), to - from);
+		}
+	}
+}
+
+// Unbuffered stream buffer in front of the fork's own buffer. Writes land in memory and are written out
+// on the background I/O thread; reads, seeks and the end of file take pending writes into account.
+// Only the position is kept apart from the locks, since a fork's stream is only used by one thread at a time.
+class Pomme::Files::WriteBehind::WriteBehindBuf
+	: public std::streambuf
+	, public std::enable_shared_from_this<WriteBehindBuf>
+{
+	std::mutex innerMutex;			// held while `inner` is in use; taken before pendingMutex
+	std::streambuf* inner;
+
+	std::mutex pendingMutex;		// guards everything below
+	Extents pending;				// not handed to the background thread yet
+	Extents inFlight;				// being written out
+	size_t pendingBytes = 0;
+	std::streamoff logicalEOF = 0;
+	bool flushScheduled = false;
+	long flushToken = 0;
+	OSErr firstError = noErr;
+
+	std::streamoff pos = 0;
+
+public:
+	explicit WriteBehindBuf(std::streambuf* theInner)
+		: inner(theInner)
+	{
+		pos = std::max<std::streamoff>(0, inner->pubseekoff(0, std::ios::cur, std::ios::in));
+		logicalEOF = std::max<std::streamoff>(0, inner->pubseekoff(0, std::ios::end, std::ios::in));
+		inner->pubseekpos(pos, std::ios::in);
+	}
+
+	std::streambuf* GetInner() const { return inner; }
+
+	// Points the buffer at another stream buffer for the same file
+	void Retarget(std::streambuf* newInner)
+	{
+		std::lock_guard<std::mutex> lock(innerMutex);
+		inner = newInner;
+	}
+
+	// Moves the inner buffer to our position, so that the fork's stream carries on where we left off
+	void SyncInnerPosition()
+	{
+		std::lock_guard<std::mutex> lock(innerMutex);
+		inner->pubseekpos(pos, std::ios::in | std::ios::out);
+	}
+
+	void WritePending()
+	{
+		std::lock_guard<std::mutex> innerLock(innerMutex);
+
+		{
+			std::lock_guard<std::mutex> lock(pendingMutex);
+			inFlight.swap(pending);
+			pendingBytes = 0;
+			flushScheduled = false;
+		}
+
+		bool ok = true;
+		for (const auto& [offset, data] : inFlight)
+		{
+			ok = ok
+				&& inner->pubseekpos(offset, std::ios::out) == std::streampos(offset)
+				&& inner->sputn(data.data(), data.size()) == (std::streamsize) data.size();
+		}
+		ok = ok && inner->pubsync() == 0;
+
+		std::lock_guard<std::mutex> lock(pendingMutex);
+		inFlight.clear();
+		if (!ok && firstError == noErr)
+		{
+			firstError = ioErr;
+		}
+	}
+
+	void WaitForFlush()
+	{
+		long token;
+		{
+			std::lock_guard<std::mutex> lock(pendingMutex);
+			token = flushToken;
+		}
+
+		if (token > 0)
+		{
+			BackgroundIO::Wait(token);
+		}
+	}
+
+	OSErr TakeError()
+	{
+		std::lock_guard<std::mutex> lock(pendingMutex);
+		OSErr err = firstError;
+		firstError = noErr;
+		return err;
+	}
+
+protected:
+	virtual std::streamsize xsputn(const char_type* s, std::streamsize n) override
+	{
+		if (n <= 0)
+		{
+			return 0;
+		}
+
+		std::lock_guard<std::mutex> lock(pendingMutex);
+
+		auto last = pending.rbegin();
+		if (last != pending.rend() && last->first + (std::streamoff) last->second.size() == pos)
+		{
+			// Appending to the last extent, as sequential writes do
+			last->second.insert(last->second.end(), s, s + n);
+		}
+		else
+		{
+			AddExtent(pending, pos, s, n, pos == logicalEOF);
+		}
+		pendingBytes += n;
+		pos += n;
+		logicalEOF = std::max(logicalEOF, pos);
+
+		if (pendingBytes >= POMME_WRITE_BEHIND_THRESHOLD && !flushScheduled)
+		{
+			// Submit under the lock, so that WaitForFlush never sees a stale token
+			flushScheduled = true;
+			flushToken = BackgroundIO::SubmitTask([self = shared_from_this()] { self->WritePending(); });
+		}
+
+		return n;
+	}
+
+	virtual int_type overflow(int_type c) override
+	{
+		if (traits_type::eq_int_type(c, traits_type::eof()))
+		{
+			return traits_type::not_eof(c);
+		}
+
+		char_type ch = traits_type::to_char_type(c);
+		return xsputn(&ch, 1) == 1 ? c : traits_type::eof();
+	}
+
+	virtual std::streamsize xsgetn(char_type* s, std::streamsize n) override
+	{
+		std::lock_guard<std::mutex> innerLock(innerMutex);
+		std::lock_guard<std::mutex> lock(pendingMutex);
+
+		std::streamoff length = std::max<std::streamoff>(0, std::min<std::streamoff>(n, logicalEOF - pos));
+		if (length == 0)
+		{
+			return 0;
+		}
+
+		std::streamsize got = 0;
+		if (inner->pubseekpos(pos, std::ios::in) == std::streampos(pos))
+		{
+			got = std::max<std::streamsize>(0, inner->sgetn(s, length));
+		}
+
+		// Past the end of the file on disk, but before the end of pending writes
+		memset(s + got, 0, length - got);
+
+		OverlayExtents(inFlight, s, pos, length);
+		OverlayExtents(pending, s, pos, length);
+
+		pos += length;
+		return length;
+	}
+
+	virtual int_type underflow() override
+	{
+		char_type c;
+		std::streamoff savedPos = pos;
+		if (xsgetn(&c, 1) != 1)
+		{
+			return traits_type::eof();
+		}
+		pos = savedPos;
+		return traits_type::to_int_type(c);
+	}
+
+	virtual int_type uflow() override
+	{
+		char_type c;
+		return xsgetn(&c, 1) == 1 ? traits_type::to_int_type(c) : traits_type::eof();
+	}
+
+	virtual int_type pbackfail(int_type c) override
+	{
+		if (pos <= 0)
+		{
+			return traits_type::eof();
+		}
+		pos--;
+		return traits_type::not_eof(c);
+	}
+
+	virtual pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override
+	{
+		(void) which;
+
+		std::streamoff base = pos;
+		if (dir == std::ios::beg)
+		{
+			base = 0;
+		}
+		else if (dir == std::ios::end)
+		{
+			std::lock_guard<std::mutex> lock(pendingMutex);
+			base = logicalEOF;
+		}
+
+		if (base + off < 0)
+		{
+			return pos_type(off_type(-1));
+		}
+
+		pos = base + off;
+		return pos_type(pos);
+	}
+
+	virtual pos_type seekpos(pos_type p, std::ios_base::openmode which) override
+	{
+		return seekoff(off_type(p), std::ios::beg, which);
+	}
+
+	// Pending writes stay pending (see Flush); this only passes through to the file's own buffer
+	virtual int sync() override
+	{
+		std::lock_guard<std::mutex> lock(innerMutex);
+		return inner->pubsync();
+	}
+};
+
+static std::mutex gBuffersMutex;
+static std::unordered_map<short, std::shared_ptr<WriteBehindBuf>> gBuffers;
+static std::atomic<int> gNumBuffers = 0;			// lets forks without write-behind skip the lookup
+static std::atomic<long> gLastCloseToken = 0;
+
+static std::shared_ptr<WriteBehindBuf> FindBuffer(short refNum)
+{
+	if (gNumBuffers == 0)
+	{
+		return nullptr;
+	}
+
+	std::lock_guard<std::mutex> lock(gBuffersMutex);
+	auto it = gBuffers.find(refNum);
+	return it != gBuffers.end() ? it->second : nullptr;
+}
+
+OSErr WriteBehind::Enable(short refNum, ForkHandle& handle)
+{
+	if (!(handle.permission & fsWrPerm))
+	{
+		return wrPermErr;
+	}
+
+	// The Resource Manager does its own buffering and writes resource forks out of band
+	if (handle.forkType != DataFork)
+	{
+		return paramErr;
+	}
+
+	std::lock_guard<std::mutex> lock(gBuffersMutex);
+
+	if (gBuffers.contains(refNum))
+	{
+		return noErr;
+	}
+
+	auto& stream = handle.GetStream();
+	auto buf = std::make_shared<WriteBehindBuf>(stream.rdbuf());
+
+	auto state = stream.rdstate();
+	stream.rdbuf(buf.get());
+	stream.setstate(state);
+
+	gBuffers.emplace(refNum, std::move(buf));
+	gNumBuffers++;
+	return noErr;
+}
+
+std::shared_ptr<WriteBehindBuf> WriteBehind::Detach(short refNum, ForkHandle& handle)
+{
+	std::shared_ptr<WriteBehindBuf> buf;
+
+	if (gNumBuffers == 0)
+	{
+		return nullptr;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(gBuffersMutex);
+		auto it = gBuffers.find(refNum);
+		if (it == gBuffers.end())
+		{
+			return nullptr;
+		}
+		buf = std::move(it->second);
+		gBuffers.erase(it);
+		gNumBuffers--;
+	}
+
+	// A background flush may still be using the inner buffer, which is about to be exposed again
+	buf->WaitForFlush();
+	buf->SyncInnerPosition();
+
+	auto& stream = handle.GetStream();
+	if (stream.rdbuf() == buf.get())
+	{
+		auto state = stream.rdstate();
+		stream.rdbuf(buf->GetInner());
+		stream.setstate(state);
+	}
+
+	return buf;
+}
+
+OSErr WriteBehind::Disable(short refNum, ForkHandle& handle)
+{
+	auto buf = Detach(refNum, handle);
+	if (!buf)
+	{
+		return noErr;
+	}
+
+	buf->WritePending();
+	buf->SyncInnerPosition();
+	return buf->TakeError();
+}
+
+OSErr WriteBehind::Flush(short refNum)
+{
+	auto buf = FindBuffer(refNum);
+	if (!buf)
+	{
+		return noErr;
+	}
+
+	buf->WaitForFlush();
+	buf->WritePending();
+	return buf->TakeError();
+}
+
+void WriteBehind::CloseAsync(std::shared_ptr<WriteBehindBuf> buf, std::unique_ptr<ForkHandle> handle)
+{
+	buf->Retarget(handle->GetStream().rdbuf());
+
+	std::shared_ptr<ForkHandle> sharedHandle(std::move(handle));
+
+	gLastCloseToken = BackgroundIO::SubmitTask([buf, sharedHandle]() mutable
+	{
+		buf->WritePending();
+
+		if (buf->TakeError() != noErr)
+		{
+			std::cerr << "Write-behind: couldn't write to " << sharedHandle->spec.cName << "\n";
+		}
+
+		sharedHandle.reset();		// closes the file
+	});
+}
+
+void WriteBehind::WaitForPendingCloses()
+{
+	long token = gLastCloseToken;
+	if (token > 0)
+	{
+		BackgroundIO::Wait(token);
+	}
+}
+
+void WriteBehind::Shutdown()
+{
+	std::vector<std::shared_ptr<WriteBehindBuf>> buffers;
+
+	{
+		std::lock_guard<std::mutex> lock(gBuffersMutex);
+		for (auto& [refNum, buf] : gBuffers)
+		{
+			buffers.push_back(buf);
+		}
+	}
+
+	// Forks that are still open keep their buffers, but nothing written so far is lost
+	for (auto& buf : buffers)
+	{
+		buf->WaitForFlush();
+		buf->WritePending();
+	}
+
+	WaitForPendingCloses();
+}
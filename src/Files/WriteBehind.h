@@ -0,0 +1,35 @@
+#pragma once
+
+#include "PommeTypes.h"
+#include "Files/Volume.h"
+
+#include <memory>
+
+namespace Pomme::Files::WriteBehind
+{
+	// Stream buffer that keeps writes in memory and hands them to the background I/O thread
+	class WriteBehindBuf;
+
+	// Starts buffering writes to an open fork (wraps its stream buffer)
+	OSErr Enable(short refNum, ForkHandle& handle);
+
+	// Writes out pending data and unwraps the stream buffer
+	OSErr Disable(short refNum, ForkHandle& handle);
+
+	// Writes out pending data right away, waiting for any background flush in progress.
+	// Returns the first error that occurred while writing, if any.
+	OSErr Flush(short refNum);
+
+	// Unwraps the fork's stream buffer without writing anything out; returns nullptr if write-behind isn't enabled.
+	// The pending data stays in the returned buffer until CloseAsync.
+	std::shared_ptr<WriteBehindBuf> Detach(short refNum, ForkHandle& handle);
+
+	// Writes out the buffer's pending data to the fork's stream on the background thread, then closes the fork
+	void CloseAsync(std::shared_ptr<WriteBehindBuf> buf, std::unique_ptr<ForkHandle> handle);
+
+	// Waits until all forks passed to CloseAsync are closed, so that their files can be opened again
+	void WaitForPendingCloses();
+
+	// Writes out pending data for forks that are still open, and waits for pending closes
+	void Shutdown();
+}
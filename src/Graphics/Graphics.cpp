@@ -3,6 +3,7 @@
 #include "PommeGraphics.h"
 #include "PommeMemory.h"
 #include "SysFont.h"
+#include "Files/DecodedResources.h"
 #include "Utilities/memstream.h"
 
 #include <iostream>
@@ -133,10 +134,8 @@ OSErr QDError(void)
 // ---------------------------------------------------------------------------- -
 // PICT resources
 
-static PicHandle GetPictureFromStream(std::istream& stream, bool skip512)
+static PicHandle NewPicHandle(const ARGBPixmap& pm)
 {
-	ARGBPixmap pm = ReadPICT(stream, skip512);
-
 	// Tack the data onto the end of the Picture struct,
 	// so that DisposeHandle frees both the Picture and the data.
 	PicHandle ph = (PicHandle) NewHandle(int(sizeof(Picture) + pm.data.size()));
@@ -153,16 +152,23 @@ static PicHandle GetPictureFromStream(std::istream& stream, bool skip512)
 	return ph;
 }
 
+static std::shared_ptr<const ARGBPixmap> DecodePicture(Handle rawResource, short, size_t* decodedBytes)
+{
+	memstream stream(*rawResource, GetHandleSize(rawResource));
+	auto pm = std::make_shared<ARGBPixmap>(ReadPICT(stream, false));
+	*decodedBytes = sizeof(ARGBPixmap) + pm->data.size();
+	return pm;
+}
+
+static const Pomme::Files::DecodedResourceType<ARGBPixmap> gPictures('PICT', DecodePicture);
+
 PicHandle GetPicture(short PICTresourceID)
 {
-	Handle rawResource = GetResource('PICT', PICTresourceID);
-	if (rawResource == nil)
+	auto pm = gPictures.Get(PICTresourceID);
+	if (!pm)
 		return nil;
 
-	memstream stream(*rawResource, GetHandleSize(rawResource));
-	PicHandle ph = GetPictureFromStream(stream, false);
-	ReleaseResource(rawResource);
-	return ph;
+	return NewPicHandle(*pm);
 }
 
 PicHandle GetPictureFromFile(const FSSpec* spec)
@@ -174,7 +180,7 @@ PicHandle GetPictureFromFile(const FSSpec* spec)
 		return nil;
 
 	auto& stream = Pomme::Files::GetStream(refNum);
-	PicHandle ph = GetPictureFromStream(stream, true);
+	PicHandle ph = NewPicHandle(ReadPICT(stream, true));
 	FSClose(refNum);
 	return ph;
 }
@@ -2,28 +2,33 @@
 #include "PommeGraphics.h"
 #include "PommeMemory.h"
 #include "Utilities/structpack.h"
+#include "Files/DecodedResources.h"
 
 #include <iostream>
 #include <cstring>
+#include <vector>
 
 // ----------------------------------------------------------------------------
 // Icons
 
-static Handle Get4bitIconAsARGB(Handle colorIcon, Ptr bwMask, int width)
+// Icon pixels, ARGB, row by row
+using ARGBIcon = std::vector<uint32_t>;
+
+static std::shared_ptr<const ARGBIcon> Convert4bitIconToARGB(Handle colorIcon, Ptr bwMask, int width)
 {
 	int height = width;
 
 	if (!colorIcon || !bwMask)
-		return nil;
+		return nullptr;
 
 	if (width*height/2 != GetHandleSize(colorIcon))
-		return nil;
+		return nullptr;
 
-	Handle icon = NewHandle(width * height * 4);
+	auto icon = std::make_shared<ARGBIcon>(width * height);
 
 	for (int y = 0; y < height; y++)
 	{
-		uint32_t* out = (uint32_t*) (*icon + y * width * 4);
+		uint32_t* out = icon->data() + y * width;
 
 		uint32_t scanlineMask = 0xFFFFFFFF;
 		if (!bwMask)
@@ -53,21 +58,21 @@ static Handle Get4bitIconAsARGB(Handle colorIcon, Ptr bwMask, int width)
 	return icon;
 }
 
-static Handle Get8bitIconAsARGB(Handle colorIcon, Ptr bwMask, int width)
+static std::shared_ptr<const ARGBIcon> Convert8bitIconToARGB(Handle colorIcon, Ptr bwMask, int width)
 {
 	int height = width;
 
 	if (!colorIcon || !bwMask)
-		return nil;
+		return nullptr;
 
 	if (width*height != GetHandleSize(colorIcon))
-		return nil;
+		return nullptr;
 
-	Handle icon = NewHandle(width * height * 4);
+	auto icon = std::make_shared<ARGBIcon>(width * height);
 
 	for (int y = 0; y < height; y++)
 	{
-		uint32_t* out = (uint32_t*) (*icon + y * width * 4);
+		uint32_t* out = icon->data() + y * width;
 
 		uint32_t scanlineMask = 0xFFFFFFFF;
 		if (!bwMask)
@@ -93,62 +98,82 @@ static Handle Get8bitIconAsARGB(Handle colorIcon, Ptr bwMask, int width)
 	return icon;
 }
 
-Handle Pomme::Graphics::GetIcl8AsARGB(short id)
+// The mask comes from the B&W icon with the same ID (ICN# for large icons, ics# for small icons)
+static std::shared_ptr<const ARGBIcon> DecodeIcon(
+	Handle colorIcon, short id, ResType bwIconType, int width, int bitDepth, size_t* decodedBytes)
 {
-	Handle colorIcon	= GetResource('icl8', id);
-	Handle bwIcon		= GetResource('ICN#', id);
+	Handle bwIcon = GetResource(bwIconType, id);
+	Pomme::Memory::ReleaseResourceGuard autoReleaseBwIcon(bwIcon);
 
-	Pomme::Memory::DisposeHandleGuard autoDisposeColorIcon(colorIcon);
-	Pomme::Memory::DisposeHandleGuard autoDisposeBwIcon(bwIcon);
+	// A B&W icon is the 1-bit icon followed by its mask
+	const int bwPlaneSize = width * width / 8;
 
 	Ptr mask = nil;
-	if (bwIcon && 256 == GetHandleSize(bwIcon))
-		mask = *bwIcon + 128;		// Mask data for icl8 starts 128 bytes into ICN#
+	if (bwIcon && 2 * bwPlaneSize == GetHandleSize(bwIcon))
+		mask = *bwIcon + bwPlaneSize;
+
+	auto icon = bitDepth == 8
+		? Convert8bitIconToARGB(colorIcon, mask, width)
+		: Convert4bitIconToARGB(colorIcon, mask, width);
 
-	return Get8bitIconAsARGB(colorIcon, mask, 32);
+	if (icon)
+		*decodedBytes = sizeof(ARGBIcon) + icon->size() * sizeof(uint32_t);
+
+	return icon;
 }
 
-Handle Pomme::Graphics::GetIcs8AsARGB(short id)
+static std::shared_ptr<const ARGBIcon> DecodeIcl8(Handle colorIcon, short id, size_t* decodedBytes)
 {
-	Handle colorIcon	= GetResource('ics8', id);
-	Handle bwIcon		= GetResource('ics#', id);
-
-	Pomme::Memory::DisposeHandleGuard autoDisposeColorIcon(colorIcon);
-	Pomme::Memory::DisposeHandleGuard autoDisposeBwIcon(bwIcon);
+	return DecodeIcon(colorIcon, id, 'ICN#', 32, 8, decodedBytes);
+}
 
-	Ptr mask = nil;
-	if (bwIcon && 64 == GetHandleSize(bwIcon))
-		mask = *bwIcon + 32;		// Mask data for ics8 starts 32 bytes into ics#
+static std::shared_ptr<const ARGBIcon> DecodeIcs8(Handle colorIcon, short id, size_t* decodedBytes)
+{
+	return DecodeIcon(colorIcon, id, 'ics#', 16, 8, decodedBytes);
+}
 
-	return Get8bitIconAsARGB(colorIcon, mask, 16);
+static std::shared_ptr<const ARGBIcon> DecodeIcl4(Handle colorIcon, short id, size_t* decodedBytes)
+{
+	return DecodeIcon(colorIcon, id, 'ICN#', 32, 4, decodedBytes);
 }
 
-Handle Pomme::Graphics::GetIcl4AsARGB(short id)
+static std::shared_ptr<const ARGBIcon> DecodeIcs4(Handle colorIcon, short id, size_t* decodedBytes)
 {
-	Handle colorIcon	= GetResource('icl4', id);
-	Handle bwIcon		= GetResource('ICN#', id);
+	return DecodeIcon(colorIcon, id, 'ics#', 16, 4, decodedBytes);
+}
 
-	Pomme::Memory::DisposeHandleGuard autoDisposeColorIcon(colorIcon);
-	Pomme::Memory::DisposeHandleGuard autoDisposeBwIcon(bwIcon);
+static const Pomme::Files::DecodedResourceType<ARGBIcon> gIcl8Icons('icl8', DecodeIcl8);
+static const Pomme::Files::DecodedResourceType<ARGBIcon> gIcs8Icons('ics8', DecodeIcs8);
+static const Pomme::Files::DecodedResourceType<ARGBIcon> gIcl4Icons('icl4', DecodeIcl4);
+static const Pomme::Files::DecodedResourceType<ARGBIcon> gIcs4Icons('ics4', DecodeIcs4);
 
-	Ptr mask = nil;
-	if (bwIcon && 256 == GetHandleSize(bwIcon))
-		mask = *bwIcon + 128;		// Mask data for icl8 starts 128 bytes into ICN#
+// Callers own the handle, so they get a copy of the cached pixels
+static Handle NewHandleFromIcon(const std::shared_ptr<const ARGBIcon>& icon)
+{
+	if (!icon)
+		return nil;
 
-	return Get4bitIconAsARGB(colorIcon, mask, 32);
+	Handle handle = NewHandle(icon->size() * sizeof(uint32_t));
+	memcpy(*handle, icon->data(), icon->size() * sizeof(uint32_t));
+	return handle;
 }
 
-Handle Pomme::Graphics::GetIcs4AsARGB(short id)
+Handle Pomme::Graphics::GetIcl8AsARGB(short id)
 {
-	Handle colorIcon	= GetResource('ics4', id);
-	Handle bwIcon		= GetResource('ics#', id);
+	return NewHandleFromIcon(gIcl8Icons.Get(id));
+}
 
-	Pomme::Memory::DisposeHandleGuard autoDisposeColorIcon(colorIcon);
-	Pomme::Memory::DisposeHandleGuard autoDisposeBwIcon(bwIcon);
+Handle Pomme::Graphics::GetIcs8AsARGB(short id)
+{
+	return NewHandleFromIcon(gIcs8Icons.Get(id));
+}
 
-	Ptr mask = nil;
-	if (bwIcon && 64 == GetHandleSize(bwIcon))
-		mask = *bwIcon + 32;		// Mask data for ics8 starts 32 bytes into ics#
+Handle Pomme::Graphics::GetIcl4AsARGB(short id)
+{
+	return NewHandleFromIcon(gIcl4Icons.Get(id));
+}
 
-	return Get4bitIconAsARGB(colorIcon, mask, 16);
+Handle Pomme::Graphics::GetIcs4AsARGB(short id)
+{
+	return NewHandleFromIcon(gIcs4Icons.Get(id));
 }
@@ -1,8 +1,17 @@
+#include <algorithm>
+#include <atomic>
+#include <bit>
 #include <iostream>
 #include <cstring>
 
 #include "Pomme.h"
 #include "PommeMemory.h"
+#include "PommeFiles.h"
+#include "Memory/SlabAllocator.h"
+#include "Memory/Zones.h"
+#include "Platform/Posix/PommePosix.h"
+
+#include <cstddef>
 
 using namespace Pomme;
 using namespace Pomme::Memory;
@@ -10,8 +19,10 @@ using namespace Pomme::Memory;
 #define LOG POMME_GENLOG(POMME_DEBUG_MEMORY, "MEMO")
 
 #if POMME_PTR_TRACKING
+#include <mutex>
 #include <set>
-static uint32_t gCurrentPtrBatch = 0;
+static std::mutex gPtrTrackingMutex;
+static uint8_t gCurrentPtrBatch = 0;
 static uint32_t gCurrentNumPtrsInBatch = 0;
 static std::set<uint32_t> gLivePtrNums;
 #endif
@@ -19,27 +30,126 @@ static std::set<uint32_t> gLivePtrNums;
 static constexpr int kBlockDescriptorPadding = 32;
 static_assert(sizeof(BlockDescriptor) <= kBlockDescriptorPadding);
 
-static size_t gTotalHeapSize = 0;
-static size_t gNumBlocksAllocated = 0;
+// Where a block's memory comes from (BlockDescriptor::storage)
+enum : uint8_t
+{
+	kStorageZone,		// a memory zone, which frees it
+	kStorageSized,		// the system allocator, with a BlockPrefix (holding the capacity) right before the descriptor
+	kStorageMapping,	// the descriptor alone, with a BlockPrefix (holding the file mapping that has the data) right before it
+
+	// Any other value: a slab chunk of (1 << storage) bytes, with room for data right after the descriptor
+};
+
+// Blocks whose size can't be told from their storage kind keep the rest of their bookkeeping
+// right before the descriptor. Most blocks are small enough to come from slabs, so they don't need this.
+struct alignas(16) BlockPrefix
+{
+	void* mappingBase;			// if non-null, ptrToData points into this file mapping (kStorageMapping)
+	uint32_t mappingLength;
+	uint32_t capacity;			// room for data right after the descriptor (kStorageSized)
+};
+
+// When a handle outgrows its block, its data moves to a buffer of its own.
+// The buffer starts with its capacity, padded so that the data stays 16-byte aligned.
+static constexpr size_t kRelocatedDataHeader = 16;
+
+// Atomic: handles may be allocated and freed on several threads (e.g. resources loaded in parallel)
+static std::atomic<size_t> gTotalHeapSize = 0;
+static std::atomic<size_t> gNumBlocksAllocated = 0;
 
 //-----------------------------------------------------------------------------
 // Implementation-specific stuff
 
-BlockDescriptor* BlockDescriptor::Allocate(uint32_t size)
+static BlockPrefix* GetPrefix(const BlockDescriptor* block)
 {
-	char* buf = new char[kBlockDescriptorPadding + size];
+	return (BlockPrefix*) ((char*) block - sizeof(BlockPrefix));
+}
 
+static bool IsMapped(const BlockDescriptor* block)
+{
+	return block->storage == kStorageMapping && GetPrefix(block)->mappingBase;
+}
+
+static bool IsRelocated(const BlockDescriptor* block)
+{
+	return !IsMapped(block) && block->ptrToData != (Ptr) block + kBlockDescriptorPadding;
+}
+
+// Room for data right after the descriptor
+static size_t GetInlineCapacity(const BlockDescriptor* block)
+{
+	switch (block->storage)
+	{
+		case kStorageZone:
+			// Zones don't keep track of how much they handed out for each block,
+			// but the block is at least as big as it was when it was allocated.
+			return block->size;
+
+		case kStorageSized:
+			return GetPrefix(block)->capacity;
+
+		case kStorageMapping:
+			return 0;
+
+		default:
+			return (size_t(1) << block->storage) - kBlockDescriptorPadding;
+	}
+}
+
+// Once a handle's data has moved to a buffer of its own (see Resize), the room right after its descriptor
+// can't be used by anything else until the data moves back, or the block is freed. It still counts as heap.
+// (Zones free everything at once, so their blocks' stats don't bother with this.)
+static size_t GetStrandedBytes(const BlockDescriptor* block)
+{
+	return block->zone || !IsRelocated(block) ? 0 : GetInlineCapacity(block);
+}
+
+static void FreeStorage(BlockDescriptor* block)
+{
+	switch (block->storage)
+	{
+		case kStorageZone:
+			break;
+
+		case kStorageSized:
+			SlabAllocator::Free(GetPrefix(block), sizeof(BlockPrefix) + kBlockDescriptorPadding + GetPrefix(block)->capacity);
+			break;
+
+		case kStorageMapping:
+			SlabAllocator::Free(GetPrefix(block), sizeof(BlockPrefix) + kBlockDescriptorPadding);
+			break;
+
+		default:
+			SlabAllocator::Free(block, size_t(1) << block->storage);
+			break;
+	}
+}
+
+static BlockDescriptor* InitDescriptor(char* buf, uint32_t size, uint8_t storage, short zone, Ptr data)
+{
 	BlockDescriptor* block = (BlockDescriptor*) buf;
 
 	block->magic = 'LIVE';
 	block->size = size;
-	block->ptrToData = buf + kBlockDescriptorPadding;
+	block->storage = storage;
+	block->zone = zone;
+	block->ptrToData = data;
 	block->rezMeta = nullptr;
+	block->ptrBatch = 0;
+	block->ptrNumInBatch = 0;
+
+	// Blocks in a zone are freed all at once with the zone, so they aren't tracked
+	if (zone)
+	{
+		return block;
+	}
 
-	gTotalHeapSize += kBlockDescriptorPadding + size;
+	// Mapped data isn't counted in the heap size: it's in the file
+	gTotalHeapSize += kBlockDescriptorPadding + (storage == kStorageMapping ? 0 : size);
 	gNumBlocksAllocated++;
 
 #if POMME_PTR_TRACKING
+	std::lock_guard<std::mutex> lock(gPtrTrackingMutex);
 	block->ptrBatch = gCurrentPtrBatch;
 	block->ptrNumInBatch = gCurrentNumPtrsInBatch++;
 	gLivePtrNums.insert(block->ptrNumInBatch);
@@ -48,12 +158,117 @@ BlockDescriptor* BlockDescriptor::Allocate(uint32_t size)
 	return block;
 }
 
+BlockDescriptor* BlockDescriptor::Allocate(uint32_t size)
+{
+	short zone = 0;
+	uint8_t storage = kStorageZone;
+
+	// If a memory zone is open, the block goes there. Otherwise, small blocks come from slabs
+	// (see SlabAllocator.h), which round up the size of the allocation to a power of two.
+	char* buf = (char*) Zones::AllocateInOpenZone(kBlockDescriptorPadding + size, &zone);
+
+	if (!buf && POMME_SLAB_ALLOCATOR && kBlockDescriptorPadding + size <= SlabAllocator::kMaxSlabChunkSize)
+	{
+		size_t chunkSize = 0;
+		buf = (char*) SlabAllocator::Allocate(kBlockDescriptorPadding + size, &chunkSize);
+		storage = (uint8_t) std::countr_zero(chunkSize);		// chunks are at least 64 bytes, so this can't be mistaken for kStorageSized/kStorageMapping
+	}
+	else if (!buf)
+	{
+		size_t storageSize = 0;
+		char* prefixed = (char*) SlabAllocator::Allocate(sizeof(BlockPrefix) + kBlockDescriptorPadding + size, &storageSize);
+		BlockPrefix* prefix = (BlockPrefix*) prefixed;
+		prefix->mappingBase = nullptr;
+		prefix->mappingLength = 0;
+		prefix->capacity = (uint32_t) (storageSize - sizeof(BlockPrefix) - kBlockDescriptorPadding);
+		buf = prefixed + sizeof(BlockPrefix);
+		storage = kStorageSized;
+	}
+
+	return InitDescriptor(buf, size, storage, zone, buf + kBlockDescriptorPadding);
+}
+
+BlockDescriptor* BlockDescriptor::AllocateMapped(Ptr data, uint32_t size, void* mappingBase, size_t mappingLength)
+{
+	// The data lives in the mapping, so the block only needs room for the descriptor.
+	// The mapping must be released when the block is freed, so the block can't live in a zone.
+	size_t storageSize = 0;
+	char* prefixed = (char*) SlabAllocator::Allocate(sizeof(BlockPrefix) + kBlockDescriptorPadding, &storageSize);
+
+	BlockPrefix* prefix = (BlockPrefix*) prefixed;
+	prefix->mappingBase = mappingBase;
+	prefix->mappingLength = (uint32_t) mappingLength;
+	prefix->capacity = 0;
+
+	return InitDescriptor(prefixed + sizeof(BlockPrefix), size, kStorageMapping, 0, data);
+}
+
+// Data relocated from a block in a zone stays in that zone
+static Ptr AllocateRelocatedData(size_t capacity, short zone)
+{
+	size_t storageSize = kRelocatedDataHeader + capacity;
+	char* buf = zone
+		? (char*) Zones::AllocateInZone(zone, storageSize)
+		: (char*) SlabAllocator::Allocate(storageSize, &storageSize);
+	if (!buf)
+		throw std::runtime_error("block's memory zone was disposed of");
+	*(size_t*) buf = storageSize - kRelocatedDataHeader;
+	return buf + kRelocatedDataHeader;
+}
+
+static size_t GetRelocatedDataCapacity(Ptr data)
+{
+	return *(size_t*) (data - kRelocatedDataHeader);
+}
+
+static void FreeRelocatedData(Ptr data)
+{
+	SlabAllocator::Free(data - kRelocatedDataHeader, kRelocatedDataHeader + GetRelocatedDataCapacity(data));
+}
+
+static void UnmapBlock(BlockDescriptor* block)
+{
+	BlockPrefix* prefix = GetPrefix(block);
+#if POMME_MMAP
+	Pomme::Platform::Posix::UnmapFileRange(prefix->mappingBase, prefix->mappingLength);
+#endif
+	prefix->mappingBase = nullptr;
+	prefix->mappingLength = 0;
+}
+
 void BlockDescriptor::Free(BlockDescriptor* block)
 {
 	if (!block)
 		return;
 
-	gTotalHeapSize -= kBlockDescriptorPadding + block->size;
+	if (block->zone)
+	{
+		// The memory goes away with the zone (see Pomme_DisposeMemoryZone)
+		Zones::AdjustStats(block->zone, -1, -(ptrdiff_t) (kBlockDescriptorPadding + block->size));
+		block->magic = 'DEAD';
+		block->size = 0;
+		block->ptrToData = nullptr;
+		return;
+	}
+
+	if (block->rezMeta)
+	{
+		Pomme::Files::OnResourceHandleDisposed(&block->ptrToData, block->rezMeta);
+	}
+
+	if (IsMapped(block))
+	{
+		UnmapBlock(block);
+		gTotalHeapSize -= kBlockDescriptorPadding;
+	}
+	else
+	{
+		gTotalHeapSize -= kBlockDescriptorPadding + block->size + GetStrandedBytes(block);
+		if (IsRelocated(block))
+		{
+			FreeRelocatedData(block->ptrToData);
+		}
+	}
 	gNumBlocksAllocated--;
 
 	block->magic = 'DEAD';
@@ -61,12 +276,79 @@ void BlockDescriptor::Free(BlockDescriptor* block)
 	block->ptrToData = nullptr;
 	block->rezMeta = nullptr;
 #if POMME_PTR_TRACKING
-	if (block->ptrBatch == gCurrentPtrBatch)
-		gLivePtrNums.erase(block->ptrNumInBatch);
+	{
+		std::lock_guard<std::mutex> lock(gPtrTrackingMutex);
+		if (block->ptrBatch == gCurrentPtrBatch)
+			gLivePtrNums.erase(block->ptrNumInBatch);
+	}
 #endif
 
-	char* buf = (char*) block;
-	delete[] buf;
+	FreeStorage(block);
+}
+
+void BlockDescriptor::Resize(uint32_t newSize)
+{
+	const uint32_t oldSize = size;
+	const size_t oldStrandedBytes = GetStrandedBytes(this);
+	const bool mapped = IsMapped(this);
+
+	// Don't let mapped data grow into whatever comes after it in the file
+	size_t roomForData;
+	if (mapped)
+		roomForData = size;
+	else if (IsRelocated(this))
+		roomForData = GetRelocatedDataCapacity(ptrToData);
+	else
+		roomForData = GetInlineCapacity(this);
+
+	if (newSize <= roomForData)
+	{
+		// Relocated data that fits in the room right after the descriptor again moves back there, and its buffer is freed.
+		// Zone blocks stay put: GetInlineCapacity can't tell how much room they had once they've grown.
+		if (!zone && IsRelocated(this) && newSize <= GetInlineCapacity(this))
+		{
+			Ptr inlineData = (Ptr) this + kBlockDescriptorPadding;
+			memcpy(inlineData, ptrToData, newSize);
+			FreeRelocatedData(ptrToData);
+			ptrToData = inlineData;
+		}
+
+		if (zone)
+			Zones::AdjustStats(zone, 0, (ptrdiff_t) newSize - oldSize);
+		else if (!mapped)		// mapped data isn't counted in the heap size (see AllocateMapped)
+			gTotalHeapSize += (size_t) newSize - oldSize + GetStrandedBytes(this) - oldStrandedBytes;
+
+		size = newSize;
+		return;
+	}
+
+	// Grow geometrically so that a handle that keeps growing gets moved O(log n) times
+	Ptr newData = AllocateRelocatedData(std::max<size_t>(newSize, roomForData + roomForData / 2), zone);
+	memcpy(newData, ptrToData, oldSize);
+
+	if (zone)
+	{
+		// The old data goes away with the zone
+		Zones::AdjustStats(zone, 0, (ptrdiff_t) newSize - oldSize);
+	}
+	else if (mapped)
+	{
+		UnmapBlock(this);
+		gTotalHeapSize += newSize;
+	}
+	else if (IsRelocated(this))
+	{
+		FreeRelocatedData(ptrToData);
+		gTotalHeapSize += (size_t) newSize - oldSize;
+	}
+	else
+	{
+		// The data leaves the room right after the descriptor, which is now stranded (see GetStrandedBytes)
+		gTotalHeapSize += (size_t) newSize - oldSize + GetInlineCapacity(this);
+	}
+
+	ptrToData = newData;
+	size = newSize;
 }
 
 void BlockDescriptor::CheckIsLive() const
@@ -82,7 +364,8 @@ BlockDescriptor* BlockDescriptor::HandleToBlock(Handle h)
 {
 	if (!h || !*h)
 		return nullptr;
-	BlockDescriptor* bd = (BlockDescriptor*) (*h - kBlockDescriptorPadding);
+	// A handle points to the descriptor's ptrToData field. Don't go through *h: the data may live elsewhere.
+	BlockDescriptor* bd = (BlockDescriptor*) ((char*) h - offsetof(BlockDescriptor, ptrToData));
 	bd->CheckIsLive();
 	return bd;
 }
@@ -141,9 +424,16 @@ Size GetHandleSize(Handle h)
 
 void SetHandleSize(Handle handle, Size byteCount)
 {
-	(void) handle;
-	(void) byteCount;
-	TODOFATAL();
+	if (byteCount < 0)
+		throw std::invalid_argument("trying to set negative handle size");
+	if (byteCount > 0x7FFFFFFF)
+		throw std::invalid_argument("trying to set massive handle size");
+
+	BlockDescriptor* block = BlockDescriptor::HandleToBlock(handle);
+	if (!block)
+		throw std::invalid_argument("SetHandleSize: invalid handle");
+
+	block->Resize((UInt32) byteCount);
 }
 
 void DisposeHandle(Handle h)
@@ -213,17 +503,27 @@ void DisposePtr(Ptr p)
 
 long Pomme_GetNumAllocs()
 {
-	return (long) gNumBlocksAllocated;
+	long numZoneBlocks = 0;
+	size_t zoneHeapSize = 0;
+	Zones::GetStats(&numZoneBlocks, &zoneHeapSize);
+
+	return (long) gNumBlocksAllocated + numZoneBlocks;
 }
 
 Size Pomme_GetHeapSize()
 {
-	return (Size) gTotalHeapSize;
+	long numZoneBlocks = 0;
+	size_t zoneHeapSize = 0;
+	Zones::GetStats(&numZoneBlocks, &zoneHeapSize);
+
+	return (Size) (gTotalHeapSize + zoneHeapSize);
 }
 
 void Pomme_FlushPtrTracking(bool issueWarnings)
 {
 #if POMME_PTR_TRACKING
+	std::lock_guard<std::mutex> lock(gPtrTrackingMutex);
+
 	if (issueWarnings && !gLivePtrNums.empty())
 	{
 		for (uint32_t ptrNum : gLivePtrNums)
@@ -241,15 +541,14 @@ void Pomme_FlushPtrTracking(bool issueWarnings)
 //-----------------------------------------------------------------------------
 // Memory: BlockMove
 
+// Like on a real Mac, the source and destination may overlap
+
 void BlockMove(const void* srcPtr, void* destPtr, Size byteCount)
 {
-	memcpy(destPtr, srcPtr, byteCount);
+	memmove(destPtr, srcPtr, byteCount);
 }
 
 void BlockMoveData(const void* srcPtr, void* destPtr, Size byteCount)
 {
-	(void) srcPtr;
-	(void) destPtr;
-	(void) byteCount;
-	TODOFATAL();
+	memmove(destPtr, srcPtr, byteCount);
 }
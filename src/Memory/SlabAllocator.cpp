@@ -0,0 +1,222 @@
+#include "Memory/SlabAllocator.h"
+
+#include <bit>
+#include <cstdint>
+#include <mutex>
+#include <new>
+
+using namespace Pomme::Memory;
+
+#if POMME_SLAB_ALLOCATOR
+
+// Chunk sizes are powers of two, from 64 bytes (enough for a block descriptor and a little data) to kMaxSlabChunkSize
+static constexpr int kMinChunkShift = 6;
+static constexpr int kMaxChunkShift = std::countr_zero(SlabAllocator::kMaxSlabChunkSize);
+static constexpr int kNumSizeClasses = kMaxChunkShift - kMinChunkShift + 1;
+static_assert(SlabAllocator::kMaxSlabChunkSize == size_t(1) << kMaxChunkShift);
+
+// Fresh slabs are carved into chunks of a single size class. Slabs are never given back to the system.
+static constexpr size_t kSlabSize = 64 * 1024;
+
+// Chunks move between a thread's cache and the shared pool this many at a time
+static constexpr int kBatchSize = 32;
+
+// A thread's cache hands chunks back to the shared pool past this many free chunks per size class
+static constexpr int kMaxCachedChunks = 2 * kBatchSize;
+
+namespace
+{
+	// Free chunks are chained through their last bytes, so that whatever the owner keeps at the start of
+	// a chunk (e.g. a block descriptor marked as dead) survives until the chunk is reused
+	struct FreeList
+	{
+		void* head = nullptr;
+		int count = 0;
+	};
+
+	struct SharedPool
+	{
+		std::mutex mutex;
+		FreeList freeChunks;
+	};
+
+	struct ThreadCache
+	{
+		FreeList freeChunks[kNumSizeClasses];
+
+		~ThreadCache();
+	};
+}
+
+static SharedPool gSharedPools[kNumSizeClasses];
+
+static thread_local ThreadCache tCache;
+
+// Chunks freed while a thread is exiting (after its cache has been flushed) go straight to the shared pool
+static thread_local bool tCacheGone = false;
+
+static size_t ChunkSize(int sizeClass)
+{
+	return size_t(1) << (sizeClass + kMinChunkShift);
+}
+
+static int SizeClassOf(size_t size)
+{
+	if (size <= ChunkSize(0))
+		return 0;
+
+	return std::bit_width(size - 1) - kMinChunkShift;
+}
+
+static void*& NextChunk(void* chunk, int sizeClass)
+{
+	return *(void**) ((char*) chunk + ChunkSize(sizeClass) - sizeof(void*));
+}
+
+static void Push(FreeList& list, void* chunk, int sizeClass)
+{
+	NextChunk(chunk, sizeClass) = list.head;
+	list.head = chunk;
+	list.count++;
+}
+
+static void* Pop(FreeList& list, int sizeClass)
+{
+	void* chunk = list.head;
+	list.head = NextChunk(chunk, sizeClass);
+	list.count--;
+	return chunk;
+}
+
+// Moves up to n chunks from one list to another
+static void MoveChunks(FreeList& from, FreeList& to, int n, int sizeClass)
+{
+	for (int i = 0; i < n && from.head; i++)
+	{
+		Push(to, Pop(from, sizeClass), sizeClass);
+	}
+}
+
+static void CarveSlab(FreeList& list, int sizeClass)
+{
+	char* slab = (char*) ::operator new(kSlabSize);
+	const size_t chunkSize = ChunkSize(sizeClass);
+
+	// Push in reverse, so that chunks are handed out in address order
+	for (size_t offset = kSlabSize; offset >= chunkSize; offset -= chunkSize)
+	{
+		Push(list, slab + offset - chunkSize, sizeClass);
+	}
+}
+
+static void RefillFromSharedPool(FreeList& cache, int sizeClass)
+{
+	auto& pool = gSharedPools[sizeClass];
+	std::lock_guard<std::mutex> lock(pool.mutex);
+
+	if (!pool.freeChunks.head)
+	{
+		CarveSlab(pool.freeChunks, sizeClass);
+	}
+
+	MoveChunks(pool.freeChunks, cache, kBatchSize, sizeClass);
+}
+
+static void* AllocateFromSharedPool(int sizeClass)
+{
+	auto& pool = gSharedPools[sizeClass];
+	std::lock_guard<std::mutex> lock(pool.mutex);
+
+	if (!pool.freeChunks.head)
+	{
+		CarveSlab(pool.freeChunks, sizeClass);
+	}
+
+	return Pop(pool.freeChunks, sizeClass);
+}
+
+static void ReturnToSharedPool(FreeList& cache, int n, int sizeClass)
+{
+	auto& pool = gSharedPools[sizeClass];
+	std::lock_guard<std::mutex> lock(pool.mutex);
+	MoveChunks(cache, pool.freeChunks, n, sizeClass);
+}
+
+ThreadCache::~ThreadCache()
+{
+	for (int sizeClass = 0; sizeClass < kNumSizeClasses; sizeClass++)
+	{
+		ReturnToSharedPool(freeChunks[sizeClass], freeChunks[sizeClass].count, sizeClass);
+	}
+
+	tCacheGone = true;
+}
+
+void* SlabAllocator::Allocate(size_t size, size_t* usableSize)
+{
+	if (size > kMaxSlabChunkSize)
+	{
+		*usableSize = size;
+		return ::operator new(size);
+	}
+
+	const int sizeClass = SizeClassOf(size);
+	*usableSize = ChunkSize(sizeClass);
+
+	if (tCacheGone)
+	{
+		return AllocateFromSharedPool(sizeClass);
+	}
+
+	FreeList& cache = tCache.freeChunks[sizeClass];
+
+	if (!cache.head)
+	{
+		RefillFromSharedPool(cache, sizeClass);
+	}
+
+	return Pop(cache, sizeClass);
+}
+
+void SlabAllocator::Free(void* storage, size_t usableSize)
+{
+	if (usableSize > kMaxSlabChunkSize)
+	{
+		::operator delete(storage);
+		return;
+	}
+
+	const int sizeClass = SizeClassOf(usableSize);
+
+	if (tCacheGone)
+	{
+		FreeList single;
+		Push(single, storage, sizeClass);
+		ReturnToSharedPool(single, 1, sizeClass);
+		return;
+	}
+
+	FreeList& cache = tCache.freeChunks[sizeClass];
+	Push(cache, storage, sizeClass);
+
+	if (cache.count > kMaxCachedChunks)
+	{
+		ReturnToSharedPool(cache, kBatchSize, sizeClass);
+	}
+}
+
+#else
+
+void* SlabAllocator::Allocate(size_t size, size_t* usableSize)
+{
+	*usableSize = size;
+	return ::operator new(size);
+}
+
+void SlabAllocator::Free(void* storage, size_t usableSize)
+{
+	(void) usableSize;
+	::operator delete(storage);
+}
+
+#endif
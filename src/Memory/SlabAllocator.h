@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+
+// Small blocks are carved out of big slabs instead of going through the system allocator every time.
+// Define POMME_NO_SLAB_ALLOCATOR to get every block from the system allocator,
+// e.g. so that memory checkers can see individual blocks (this is the default under AddressSanitizer).
+#if !defined(POMME_NO_SLAB_ALLOCATOR) && !defined(__SANITIZE_ADDRESS__)
+	#define POMME_SLAB_ALLOCATOR 1
+#else
+	#define POMME_SLAB_ALLOCATOR 0
+#endif
+
+namespace Pomme::Memory::SlabAllocator
+{
+	// Biggest allocation served from slabs. Bigger ones go straight to the system allocator.
+	constexpr size_t kMaxSlabChunkSize = 4096;
+
+	// Returns storage for at least `size` bytes (16-byte aligned), and sets *usableSize to how many bytes
+	// may actually be used. Small sizes are rounded up to a power of two, and served from a cache that
+	// belongs to the calling thread, so that most calls don't take any lock.
+	void* Allocate(size_t size, size_t* usableSize);
+
+	// `usableSize` must be what Allocate returned. Storage may be freed on any thread.
+	void Free(void* storage, size_t usableSize);
+}
@@ -0,0 +1,247 @@
+#include "Pomme.h"
+#include "Memory/Zones.h"
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <new>
+#include <vector>
+
+using namespace Pomme::Memory;
+
+// Zones grab memory from the system in chunks of this size. Blocks bigger than a quarter of a chunk get a chunk of their own.
+static constexpr size_t kZoneChunkSize = 256 * 1024;
+
+namespace
+{
+	struct Zone
+	{
+		std::vector<char*> chunks;
+		char* cursor = nullptr;			// next free byte in the current chunk
+		char* end = nullptr;			// end of the current chunk
+		size_t reservedBytes = 0;		// total size of the chunks
+		size_t usedBytes = 0;			// bytes handed out, including alignment padding
+		long numBlocks = 0;				// live blocks
+		size_t heapSize = 0;			// as counted by Pomme_GetHeapSize
+	};
+}
+
+// Guards everything below
+static std::mutex gZonesMutex;
+
+static std::map<short, Zone> gZones;
+static std::vector<short> gOpenZones;		// innermost last
+
+// IDs that were never handed out go first. After that, IDs of disposed zones are reused, least recently disposed first,
+// so that a block outliving its zone (which is a bug in the caller) is unlikely to skew the stats of a newer zone.
+static int gNextUnusedZoneID = 1;
+static std::deque<short> gDisposedZoneIDs;		// least recently disposed first
+
+// Lets allocations skip the lock when no zone is open (i.e. most of the time)
+static std::atomic<int> gNumOpenZones = 0;
+
+static thread_local int tBypassDepth = 0;
+
+static char* AllocateChunk(Zone& zone, size_t size)
+{
+	char* base = (char*) ::operator new(size);
+	zone.chunks.push_back(base);
+	zone.reservedBytes += size;
+	return base;
+}
+
+static void* Bump(Zone& zone, size_t size)
+{
+	size = (size + 15) & ~size_t(15);
+
+	if (size > kZoneChunkSize / 4)
+	{
+		zone.usedBytes += size;
+		return AllocateChunk(zone, size);
+	}
+
+	if ((size_t) (zone.end - zone.cursor) < size)
+	{
+		zone.cursor = AllocateChunk(zone, kZoneChunkSize);
+		zone.end = zone.cursor + kZoneChunkSize;
+	}
+
+	void* storage = zone.cursor;
+	zone.cursor += size;
+	zone.usedBytes += size;
+	return storage;
+}
+
+void* Zones::AllocateInOpenZone(size_t size, short* zoneID)
+{
+	if (tBypassDepth > 0 || gNumOpenZones.load(std::memory_order_relaxed) == 0)
+	{
+		return nullptr;
+	}
+
+	std::lock_guard<std::mutex> lock(gZonesMutex);
+
+	if (gOpenZones.empty())
+	{
+		return nullptr;
+	}
+
+	*zoneID = gOpenZones.back();
+	Zone& zone = gZones.find(*zoneID)->second;		// open zones can't be disposed of without being closed
+	zone.numBlocks++;
+	zone.heapSize += size;
+	return Bump(zone, size);
+}
+
+void* Zones::AllocateInZone(short zoneID, size_t size)
+{
+	std::lock_guard<std::mutex> lock(gZonesMutex);
+
+	auto it = gZones.find(zoneID);
+	if (it == gZones.end())
+	{
+		return nullptr;
+	}
+
+	return Bump(it->second, size);
+}
+
+void Zones::AdjustStats(short zoneID, long numBlocksDelta, ptrdiff_t heapSizeDelta)
+{
+	std::lock_guard<std::mutex> lock(gZonesMutex);
+
+	auto it = gZones.find(zoneID);
+	if (it == gZones.end())
+	{
+		return;
+	}
+
+	it->second.numBlocks += numBlocksDelta;
+	it->second.heapSize += heapSizeDelta;
+}
+
+void Zones::GetStats(long* numBlocks, size_t* heapSize)
+{
+	std::lock_guard<std::mutex> lock(gZonesMutex);
+
+	*numBlocks = 0;
+	*heapSize = 0;
+
+	for (const auto& [zoneID, zone] : gZones)
+	{
+		*numBlocks += zone.numBlocks;
+		*heapSize += zone.heapSize;
+	}
+}
+
+Zones::BypassScope::BypassScope()
+{
+	tBypassDepth++;
+}
+
+Zones::BypassScope::~BypassScope()
+{
+	tBypassDepth--;
+}
+
+//-----------------------------------------------------------------------------
+// Public API
+
+OSErr Pomme_OpenMemoryZone(short* zoneID)
+{
+	if (!zoneID)
+	{
+		return paramErr;
+	}
+
+	std::lock_guard<std::mutex> lock(gZonesMutex);
+
+	short newZoneID;
+	if (gNextUnusedZoneID <= 0x7FFF)
+	{
+		newZoneID = (short) gNextUnusedZoneID++;
+	}
+	else if (!gDisposedZoneIDs.empty())
+	{
+		newZoneID = gDisposedZoneIDs.front();
+		gDisposedZoneIDs.pop_front();
+	}
+	else
+	{
+		// All 32767 IDs belong to zones that haven't been disposed of
+		return memFullErr;
+	}
+
+	gZones[newZoneID];
+	gOpenZones.push_back(newZoneID);
+	gNumOpenZones++;
+	*zoneID = newZoneID;
+	return noErr;
+}
+
+OSErr Pomme_CloseMemoryZone(short zoneID)
+{
+	std::lock_guard<std::mutex> lock(gZonesMutex);
+
+	if (gOpenZones.empty() || gOpenZones.back() != zoneID)
+	{
+		return paramErr;
+	}
+
+	gOpenZones.pop_back();
+	gNumOpenZones--;
+	return noErr;
+}
+
+OSErr Pomme_DisposeMemoryZone(short zoneID)
+{
+	std::lock_guard<std::mutex> lock(gZonesMutex);
+
+	auto it = gZones.find(zoneID);
+	if (it == gZones.end())
+	{
+		return paramErr;
+	}
+
+	// An open zone may only be disposed of if it's the innermost one (which closes it)
+	if (std::find(gOpenZones.begin(), gOpenZones.end(), zoneID) != gOpenZones.end())
+	{
+		if (gOpenZones.back() != zoneID)
+		{
+			return paramErr;
+		}
+
+		gOpenZones.pop_back();
+		gNumOpenZones--;
+	}
+
+	// Chunks are big and few, so this doesn't depend on how many blocks the zone holds.
+	// Whole chunks go back to the system allocator, which can reuse them for anything (unlike slab chunks).
+	for (char* chunk : it->second.chunks)
+	{
+		::operator delete(chunk);
+	}
+
+	gZones.erase(it);
+	gDisposedZoneIDs.push_back(zoneID);
+	return noErr;
+}
+
+OSErr Pomme_GetMemoryZoneStats(short zoneID, long* numBlocks, Size* usedBytes, Size* reservedBytes)
+{
+	std::lock_guard<std::mutex> lock(gZonesMutex);
+
+	auto it = gZones.find(zoneID);
+	if (it == gZones.end())
+	{
+		return paramErr;
+	}
+
+	const Zone& zone = it->second;
+	if (numBlocks) *numBlocks = zone.numBlocks;
+	if (usedBytes) *usedBytes = (Size) zone.usedBytes;
+	if (reservedBytes) *reservedBytes = (Size) zone.reservedBytes;
+	return noErr;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "PommeTypes.h"
+
+#include <cstddef>
+
+// Memory zones (see Pomme_OpenMemoryZone): bump-pointer arenas whose blocks are all freed at once.
+namespace Pomme::Memory::Zones
+{
+	// Returns storage (16-byte aligned) for a new block in the innermost open zone, sets *zoneID,
+	// and counts the block as live. Returns nullptr if no zone is open, or if zones are bypassed on this thread:
+	// the block must then be allocated normally.
+	void* AllocateInOpenZone(size_t size, short* zoneID);
+
+	// Returns storage (16-byte aligned) in the given zone, whether it's open or not (e.g. to grow a block that lives in it).
+	// Returns nullptr if the zone has been disposed of.
+	void* AllocateInZone(short zoneID, size_t size);
+
+	// Blocks in a zone aren't freed one by one, but the zone keeps count of its live blocks for the heap statistics.
+	// Does nothing if the zone has been disposed of.
+	void AdjustStats(short zoneID, long numBlocksDelta, ptrdiff_t heapSizeDelta);
+
+	void GetStats(long* numBlocks, size_t* heapSize);
+
+	// While in scope, blocks allocated on this thread don't go to zones.
+	// For blocks whose lifetime isn't up to the caller (e.g. resources, which the Resource Manager may keep around).
+	class BypassScope
+	{
+	public:
+		BypassScope();
+
+		~BypassScope();
+
+		BypassScope(const BypassScope&) = delete;
+
+		BypassScope& operator=(const BypassScope&) = delete;
+	};
+}
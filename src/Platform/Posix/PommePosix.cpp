@@ -0,0 +1,397 @@
+#include "Platform/Posix/PommePosix.h"
+
+#if POMME_MMAP || POMME_POSIX_IO
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+
+#if POMME_MMAP
+
+int Pomme::Platform::Posix::OpenFileForMapping(const fs::path& path)
+{
+	return open(path.c_str(), O_RDONLY | O_CLOEXEC);
+}
+
+void Pomme::Platform::Posix::CloseFileForMapping(int fd)
+{
+	if (fd >= 0)
+	{
+		close(fd);
+	}
+}
+
+char* Pomme::Platform::Posix::MapFileRange(int fd, uint64_t offset, size_t length, void** mappingBase, size_t* mappingLength)
+{
+	static const uint64_t pageSize = (uint64_t) sysconf(_SC_PAGESIZE);
+
+	if (fd < 0 || length == 0)
+	{
+		return nullptr;
+	}
+
+	uint64_t alignedOffset = offset - (offset % pageSize);
+	size_t lead = size_t(offset - alignedOffset);
+
+	void* base = mmap(nullptr, lead + length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, (off_t) alignedOffset);
+	if (base == MAP_FAILED)
+	{
+		return nullptr;
+	}
+
+	*mappingBase = base;
+	*mappingLength = lead + length;
+	return (char*) base + lead;
+}
+
+void Pomme::Platform::Posix::UnmapFileRange(void* mappingBase, size_t mappingLength)
+{
+	munmap(mappingBase, mappingLength);
+}
+
+#endif // POMME_MMAP
+
+#if POMME_POSIX_IO
+
+using Pomme::Platform::Posix::FileDescriptorBuf;
+
+static int OpenWithMode(const fs::path& path, std::ios::openmode mode)
+{
+	int flags = O_CLOEXEC;
+
+	if ((mode & std::ios::in) && (mode & std::ios::out))
+		flags |= O_RDWR;
+	else if (mode & std::ios::out)
+		flags |= O_WRONLY | O_CREAT | O_TRUNC;
+	else
+		flags |= O_RDONLY;
+
+	return open(path.c_str(), flags, 0666);
+}
+
+FileDescriptorBuf::FileDescriptorBuf(const fs::path& path, std::ios::openmode mode, size_t theBufferSize)
+	: fd(-1)
+	, buffer(nullptr)
+	, bufferSize(theBufferSize)
+	, readAhead(std::min(kMinReadAhead, theBufferSize))
+{
+	fd = OpenWithMode(path, mode);
+
+	void* alignedBuffer = nullptr;
+
+	if (fd >= 0 && 0 != posix_memalign(&alignedBuffer, 4096, bufferSize))
+	{
+		close(fd);
+		fd = -1;
+	}
+
+	buffer = (char*) alignedBuffer;
+}
+
+FileDescriptorBuf::~FileDescriptorBuf()
+{
+	if (fd >= 0)
+	{
+		FlushWrites();
+		close(fd);
+	}
+
+	free(buffer);
+}
+
+bool FileDescriptorBuf::Reopen(const fs::path& path, std::ios::openmode mode)
+{
+	if (fd >= 0)
+	{
+		FlushWrites();
+		close(fd);
+	}
+
+	setg(nullptr, nullptr, nullptr);
+	setp(nullptr, nullptr);
+	bufferOffset = 0;
+	readAhead = std::min(kMinReadAhead, bufferSize);
+
+	fd = buffer ? OpenWithMode(path, mode) : -1;
+	return fd >= 0;
+}
+
+off_t FileDescriptorBuf::Tell() const
+{
+	if (pbase())
+		return bufferOffset + (pptr() - pbase());
+	else if (eback())
+		return bufferOffset + (gptr() - eback());
+	else
+		return bufferOffset;
+}
+
+size_t FileDescriptorBuf::ReadAt(off_t offset, char* dst, size_t length) const
+{
+	size_t done = 0;
+
+	while (fd >= 0 && done < length)
+	{
+		ssize_t got = pread(fd, dst + done, length - done, offset + done);
+		if (got <= 0)
+			break;
+		done += got;
+	}
+
+	return done;
+}
+
+bool FileDescriptorBuf::FlushWrites()
+{
+	if (!pbase())
+	{
+		return true;
+	}
+
+	const char* p = pbase();
+	size_t remaining = pptr() - pbase();
+	bool ok = true;
+
+	while (remaining > 0)
+	{
+		ssize_t written = pwrite(fd, p, remaining, bufferOffset);
+		if (written <= 0)
+		{
+			ok = false;
+			break;
+		}
+		p += written;
+		remaining -= written;
+		bufferOffset += written;
+	}
+
+	setp(nullptr, nullptr);
+	return ok;
+}
+
+bool FileDescriptorBuf::Prefetch(off_t offset, size_t length) const
+{
+#if defined(POSIX_FADV_WILLNEED)
+	return 0 == posix_fadvise(fd, offset, (off_t) length, POSIX_FADV_WILLNEED);
+#elif defined(F_RDADVISE)
+	struct radvisory advice;
+	advice.ra_offset = offset;
+	advice.ra_count = (int) std::min<size_t>(length, INT_MAX);
+	return -1 != fcntl(fd, F_RDADVISE, &advice);
+#else
+	(void) offset;
+	(void) length;
+	return false;
+#endif
+}
+
+bool FileDescriptorBuf::SyncToStorage()
+{
+	bool ok = FlushWrites();
+	return fsync(fd) == 0 && ok;
+}
+
+bool FileDescriptorBuf::Settle()
+{
+	if (pbase())
+	{
+		return FlushWrites();
+	}
+
+	if (eback())
+	{
+		bufferOffset += gptr() - eback();
+		setg(nullptr, nullptr, nullptr);
+	}
+
+	return true;
+}
+
+FileDescriptorBuf::int_type FileDescriptorBuf::underflow()
+{
+	if (fd < 0 || !Settle())
+	{
+		return traits_type::eof();
+	}
+
+	ssize_t n = pread(fd, buffer, readAhead, bufferOffset);
+
+	if (n <= 0)
+	{
+		return traits_type::eof();
+	}
+
+	readAhead = std::min(readAhead * 2, bufferSize);
+
+	setg(buffer, buffer, buffer + n);
+	return traits_type::to_int_type(*gptr());
+}
+
+std::streamsize FileDescriptorBuf::xsgetn(char_type* s, std::streamsize n)
+{
+	std::streamsize done = 0;
+
+	while (done < n)
+	{
+		std::streamsize available = egptr() - gptr();
+
+		if (available > 0)
+		{
+			std::streamsize chunk = std::min(available, n - done);
+			memcpy(s + done, gptr(), chunk);
+			gbump((int) chunk);
+			done += chunk;
+		}
+		else if (size_t(n - done) >= bufferSize)
+		{
+			// Big read: skip the buffer and read straight into the caller's memory
+			if (fd < 0 || !Settle())
+				break;
+
+			ssize_t got = pread(fd, s + done, n - done, bufferOffset);
+			if (got <= 0)
+				break;
+
+			bufferOffset += got;
+			done += got;
+		}
+		else if (traits_type::eq_int_type(underflow(), traits_type::eof()))
+		{
+			break;
+		}
+	}
+
+	return done;
+}
+
+FileDescriptorBuf::int_type FileDescriptorBuf::overflow(int_type c)
+{
+	if (fd < 0)
+	{
+		return traits_type::eof();
+	}
+
+	if (!pbase() || pptr() == epptr())
+	{
+		if (!Settle())
+			return traits_type::eof();
+		setp(buffer, buffer + bufferSize);
+	}
+
+	if (!traits_type::eq_int_type(c, traits_type::eof()))
+	{
+		*pptr() = traits_type::to_char_type(c);
+		pbump(1);
+	}
+
+	return traits_type::not_eof(c);
+}
+
+std::streamsize FileDescriptorBuf::xsputn(const char_type* s, std::streamsize n)
+{
+	if (size_t(n) < bufferSize)
+	{
+		return std::streambuf::xsputn(s, n);
+	}
+
+	// Big write: skip the buffer
+	if (fd < 0 || !Settle())
+	{
+		return 0;
+	}
+
+	std::streamsize done = 0;
+
+	while (done < n)
+	{
+		ssize_t written = pwrite(fd, s + done, n - done, bufferOffset);
+		if (written <= 0)
+			break;
+
+		bufferOffset += written;
+		done += written;
+	}
+
+	return done;
+}
+
+FileDescriptorBuf::pos_type FileDescriptorBuf::seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which)
+{
+	(void) which;	// a single position is shared by reads and writes, like std::filebuf
+
+	if (fd < 0)
+	{
+		return pos_type(off_type(-1));
+	}
+
+	off_t target;
+
+	switch (dir)
+	{
+		case std::ios_base::beg:
+			target = off;
+			break;
+
+		case std::ios_base::cur:
+			if (off == 0)	// tellg/tellp
+				return pos_type(Tell());
+			target = Tell() + off;
+			break;
+
+		case std::ios_base::end:
+		{
+			struct stat st;
+			if (!FlushWrites() || 0 != fstat(fd, &st))
+				return pos_type(off_type(-1));
+			target = st.st_size + off;
+			break;
+		}
+
+		default:
+			return pos_type(off_type(-1));
+	}
+
+	if (target < 0)
+	{
+		return pos_type(off_type(-1));
+	}
+
+	// Stay within the read-ahead window if possible
+	if (eback() && target >= bufferOffset && target <= bufferOffset + (egptr() - eback()))
+	{
+		setg(eback(), eback() + (target - bufferOffset), egptr());
+		return pos_type(target);
+	}
+
+	if (!Settle())
+	{
+		return pos_type(off_type(-1));
+	}
+
+	// Random access: don't read far ahead until reads prove to be sequential again
+	if (target != bufferOffset)
+	{
+		readAhead = std::min(kMinReadAhead, bufferSize);
+	}
+
+	bufferOffset = target;
+	return pos_type(target);
+}
+
+FileDescriptorBuf::pos_type FileDescriptorBuf::seekpos(pos_type pos, std::ios_base::openmode which)
+{
+	return seekoff(off_type(pos), std::ios_base::beg, which);
+}
+
+int FileDescriptorBuf::sync()
+{
+	return FlushWrites() ? 0 : -1;
+}
+
+#endif // POMME_POSIX_IO
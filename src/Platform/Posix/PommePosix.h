@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <streambuf>
+#include "CompilerSupport/filesystem.h"
+
+#if !defined(POMME_NO_MMAP) && !defined(_WIN32) && !defined(VITA)
+	#define POMME_MMAP 1
+#else
+	#define POMME_MMAP 0
+#endif
+
+#if !defined(POMME_NO_POSIX_IO) && !defined(_WIN32) && !defined(VITA)
+	#define POMME_POSIX_IO 1
+#else
+	#define POMME_POSIX_IO 0
+#endif
+
+#if POMME_MMAP
+namespace Pomme::Platform::Posix
+{
+	// Opens a file so that ranges of it can be mapped with MapFileRange. Returns -1 on failure.
+	int OpenFileForMapping(const fs::path& path);
+
+	void CloseFileForMapping(int fd);
+
+	// Maps `length` bytes at `offset` in the file as a private, copy-on-write view.
+	// Pages are shared with the OS's file cache until they're written to.
+	// Returns a pointer to the data at `offset`, or nullptr if the range couldn't be mapped.
+	// The mapping itself may start a bit before `offset` (it must be page-aligned);
+	// pass `mappingBase` and `mappingLength` to UnmapFileRange to release it.
+	char* MapFileRange(int fd, uint64_t offset, size_t length, void** mappingBase, size_t* mappingLength);
+
+	void UnmapFileRange(void* mappingBase, size_t mappingLength);
+}
+#endif
+
+#if POMME_POSIX_IO
+namespace Pomme::Platform::Posix
+{
+	// Stream buffer over a file descriptor, with a single page-aligned buffer shared by reads and writes.
+	// All I/O goes through pread/pwrite at a tracked offset, so seeking within the buffered window is free.
+	// Reads and writes at least as large as the buffer bypass it and go straight to/from the caller's memory.
+	class FileDescriptorBuf : public std::streambuf
+	{
+		int fd;
+		char* buffer;
+		size_t bufferSize;
+		off_t bufferOffset = 0;		// file offset of the buffer's first byte, or the current position if no area is active
+		size_t readAhead;			// how much the next refill reads; grows while reads stay sequential
+
+		off_t Tell() const;
+
+		bool FlushWrites();
+
+		// Flushes pending writes, drops read-ahead, and leaves bufferOffset at the current position
+		bool Settle();
+
+	public:
+		static constexpr size_t kDefaultBufferSize = 64 * 1024;
+		static constexpr size_t kMinReadAhead = 4 * 1024;
+
+		// Opens `path` with the same semantics as std::fstream with the given openmode
+		// (ios::out alone truncates or creates the file; ios::in|ios::out requires it to exist).
+		FileDescriptorBuf(const fs::path& path, std::ios::openmode mode, size_t bufferSize = kDefaultBufferSize);
+
+		virtual ~FileDescriptorBuf() override;
+
+		FileDescriptorBuf(const FileDescriptorBuf&) = delete;
+		FileDescriptorBuf& operator=(const FileDescriptorBuf&) = delete;
+
+		// Closes the current file and opens `path` in its place (e.g. after the file was atomically replaced).
+		// The position goes back to 0.
+		bool Reopen(const fs::path& path, std::ios::openmode mode);
+
+		bool IsOpen() const { return fd >= 0; }
+
+		int GetFD() const { return fd; }
+
+		// Asks the OS to start reading a range into its page cache, without waiting for it or copying it anywhere.
+		// Returns false if the OS has no way to do that.
+		bool Prefetch(off_t offset, size_t length) const;
+
+		// Writes out the buffer and waits until the file's data reaches the storage device (fsync)
+		bool SyncToStorage();
+
+		// Positional read that bypasses the buffer and leaves the stream position alone; safe to call from any thread.
+		// Doesn't see writes that are still sitting in the buffer.
+		size_t ReadAt(off_t offset, char* dst, size_t length) const;
+
+	protected:
+		virtual int_type underflow() override;
+
+		virtual std::streamsize xsgetn(char_type* s, std::streamsize n) override;
+
+		virtual int_type overflow(int_type c) override;
+
+		virtual std::streamsize xsputn(const char_type* s, std::streamsize n) override;
+
+		virtual pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override;
+
+		virtual pos_type seekpos(pos_type pos, std::ios_base::openmode which) override;
+
+		virtual int sync() override;
+	};
+}
+#endif
@@ -73,4 +73,6 @@ void Pomme::Shutdown()
 #ifndef POMME_NO_SOUND_MIXER
 	Pomme::Sound::ShutdownMixer();
 #endif
+
+	Pomme::Files::Shutdown();
 }
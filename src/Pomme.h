@@ -53,6 +53,10 @@ OSErr FSMakeFSSpec(short vRefNum, long dirID, const char* cstrFileName, FSSpec*
 
 short FSpOpenResFile(const FSSpec* spec, char permission);
 
+// Creates a file with an empty resource fork (the data fork is created too if the file doesn't exist yet).
+// Check ResError for the outcome.
+void FSpCreateResFile(const FSSpec* spec, OSType creator, OSType fileType, ScriptCode scriptTag);
+
 // Open a file's data fork
 OSErr FSpOpenDF(const FSSpec* spec, char permission, short* refNum);
 
@@ -81,6 +85,62 @@ OSErr DirCreate(short vRefNum, long parentDirID, const char* cstrDirectoryName,
 
 OSErr GetVol(char* outVolNameC, short* vRefNum);
 
+// Pomme extension (not part of the original Toolbox API).
+// Mounts a read-only Pomme pack file (built with tools/pommepack) as a new volume.
+// Pass the returned vRefNum to FSMakeFSSpec to reach the files packed inside it.
+OSErr Pomme_MountPackVolume(const char* hostPath, short* vRefNum);
+
+// Pomme extension (not part of the original Toolbox API).
+// Mounts a new, empty volume that lives in RAM. Fill it with Pomme_AddMemoryVolumeFile.
+OSErr Pomme_MountMemoryVolume(short* vRefNum);
+
+// Pomme extension (not part of the original Toolbox API).
+// Copies a file into a volume created by Pomme_MountMemoryVolume, replacing any file at that path.
+// `path` is colon-separated from the root of the volume (e.g. ":Data:Level1"); missing folders are created.
+// Either fork may be null to leave it out. The resource fork is raw (not wrapped in AppleDouble).
+OSErr Pomme_AddMemoryVolumeFile(short vRefNum, const char* path,
+	const void* dataFork, Size dataForkLength,
+	const void* resourceFork, Size resourceForkLength);
+
+// Pomme extension (not part of the original Toolbox API).
+// Starts recording I/O statistics for every fork opened from now on: opens, read/write calls and bytes,
+// seeks, mapped resources and time spent, per open refNum and per file. Reads done by the parsers through
+// the fork's stream are counted too. If dumpPathAtShutdown isn't null, the statistics are written there
+// as JSON when Pomme shuts down.
+void Pomme_StartIOStats(const char* dumpPathAtShutdown);
+
+// Pomme extension (not part of the original Toolbox API).
+// Writes the I/O statistics recorded so far as JSON to a host file (or to stderr if hostPath is null).
+OSErr Pomme_DumpIOStats(const char* hostPath);
+
+// Pomme extension (not part of the original Toolbox API).
+// Starts recording which parts of which host files get read from now on (through fork streams, resource
+// loads and mappings), in order of first access. If savePathAtShutdown isn't null, the trace is saved there
+// when Pomme shuts down. Pair with Pomme_ReplayAccessTrace on the next run.
+void Pomme_StartAccessTrace(const char* savePathAtShutdown);
+
+// Pomme extension (not part of the original Toolbox API).
+// Saves the access trace recorded so far to a host file (e.g. to keep a separate trace per level).
+OSErr Pomme_SaveAccessTrace(const char* hostPath);
+
+// Pomme extension (not part of the original Toolbox API).
+// Reads the files and ranges listed in a trace saved by an earlier run on a background thread,
+// so that they're in the OS's page cache by the time the game reads them. Returns fnfErr if the
+// trace is missing or unreadable. It's fine to record a new trace to the same path during the replay.
+OSErr Pomme_ReplayAccessTrace(const char* hostPath);
+
+// Pomme extension (not part of the original Toolbox API).
+// Turns write-behind on or off for an open data fork. While it's on, FSWrite only copies the data into memory;
+// it's written to the file on a background thread, at the latest when the fork is closed. FSRead, GetEOF, GetFPos
+// and SetFPos see pending writes. FSClose returns without waiting: reopening, creating or deleting a file waits
+// for pending closes. Write errors are reported by Pomme_SyncFile or when write-behind is turned off.
+OSErr Pomme_SetWriteBehind(short refNum, Boolean enable);
+
+// Pomme extension (not part of the original Toolbox API).
+// Writes out everything written to the fork so far, including pending write-behind data,
+// and waits until it reaches the storage device.
+OSErr Pomme_SyncFile(short refNum);
+
 //-----------------------------------------------------------------------------
 // File I/O
 
@@ -109,6 +169,10 @@ void UseResFile(short refNum);
 // Gets the file reference number of the current resource file.
 short CurResFile(void);
 
+// Writes the changed and added resources of a resource file opened with write permission, and its map.
+// CloseResFile does this too.
+void UpdateResFile(short refNum);
+
 void CloseResFile(short refNum);
 
 // Returns total number of resources of the given type
@@ -148,6 +212,46 @@ long GetResourceSizeOnDisk(Handle);
 
 long SizeResource(Handle);
 
+// Pomme extension (not part of the original Toolbox API).
+// Caches a compact index of each resource fork opened from the host filesystem in the given host folder,
+// so that later runs can open the fork without parsing its resource map. Stale indexes are rebuilt
+// transparently. Pass nullptr to disable the cache (default).
+void Pomme_SetResourceIndexFolder(const char* hostPath);
+
+// Pomme extension (not part of the original Toolbox API).
+// Keeps resources loaded after ReleaseResource, like a real Mac does, so that getting the same resource again
+// returns the same handle without touching the disk. GetResource takes a reference on the handle and
+// ReleaseResource drops it; unreferenced resources are purged when the cache exceeds maxBytes.
+// Only enable this if your code doesn't expect a fresh copy of a resource after modifying and releasing it.
+// Pass 0 to disable the cache (default).
+void Pomme_SetResourceCacheBudget(Size maxBytes);
+
+// Pomme extension (not part of the original Toolbox API).
+// Any of the pointers may be null.
+void Pomme_GetResourceCacheStats(long* hits, long* misses, long* purges, Size* cachedBytes);
+
+// Pomme extension (not part of the original Toolbox API).
+// Sets how much memory may be spent on decoded copies of resources (string lists for GetIndStringC,
+// pictures for GetPicture, icons for GetIcl8AsARGB and friends), so that getting them again skips decoding.
+// Least recently used objects are evicted past maxBytes. Pass 0 to disable the cache (default).
+void Pomme_SetDecodedResourceCacheBudget(Size maxBytes);
+
+// Pomme extension (not part of the original Toolbox API).
+// Any of the pointers may be null.
+void Pomme_GetDecodedResourceCacheStats(long* hits, long* misses, Size* cachedBytes);
+
+// Pomme extension (not part of the original Toolbox API).
+// Starts reading the given resources (looked up like GetResource would) on a background thread.
+// Later GetResource calls for these resources are served from memory. Returns a token for
+// Pomme_IsPrefetchDone/Pomme_WaitForPrefetch; 0 if there was nothing to read.
+long Pomme_PrefetchResources(ResType theType, const short* ids, int numIDs);
+
+// Pomme extension (not part of the original Toolbox API).
+Boolean Pomme_IsPrefetchDone(long token);
+
+// Pomme extension (not part of the original Toolbox API).
+void Pomme_WaitForPrefetch(long token);
+
 //-----------------------------------------------------------------------------
 // QuickDraw 2D: Errors
 
@@ -413,7 +517,8 @@ Handle TempNewHandle(Size, OSErr*);
 
 Size GetHandleSize(Handle);
 
-// Change the logical size of the relocatable block corresponding to a handle
+// Change the logical size of the relocatable block corresponding to a handle.
+// Growing the block may move its data (i.e. change *handle), but the handle itself remains valid.
 void SetHandleSize(Handle, Size);
 
 void DisposeHandle(Handle);
@@ -445,6 +550,33 @@ long Pomme_GetNumAllocs(void);
 // Returns lower bound of total heap allocated by application
 Size Pomme_GetHeapSize(void);
 
+//-----------------------------------------------------------------------------
+// Memory: zones
+
+// Pomme extension (not part of the original Toolbox API).
+// Opens a memory zone: until it's closed, all NewPtr/NewHandle calls (on any thread) are served from it.
+// A zone is a bump-pointer arena, so allocating is cheap, and all of its blocks are freed at once by
+// Pomme_DisposeMemoryZone. DisposePtr/DisposeHandle on a block in a zone doesn't free any memory.
+// Zones may be nested: allocations go to the innermost open zone.
+// Resources loaded by the Resource Manager never live in zones, and blocks in a zone can't be passed to AddResource.
+// IDs of disposed zones are reused once all 32767 IDs have been handed out. Returns memFullErr if 32767 zones
+// exist at once.
+OSErr Pomme_OpenMemoryZone(short* zoneID);
+
+// Pomme extension (not part of the original Toolbox API).
+// Stops serving allocations from the zone. Its blocks remain valid. The zone must be the innermost open zone.
+OSErr Pomme_CloseMemoryZone(short zoneID);
+
+// Pomme extension (not part of the original Toolbox API).
+// Frees all blocks in the zone at once (closing it first if it's still the innermost open zone).
+// Any Ptr or Handle into the zone becomes invalid: its blocks must not be touched afterwards, not even to dispose of
+// or resize them.
+OSErr Pomme_DisposeMemoryZone(short zoneID);
+
+// Pomme extension (not part of the original Toolbox API).
+// Any of the pointers may be null. usedBytes includes dead blocks; reservedBytes is what the zone got from the system.
+OSErr Pomme_GetMemoryZoneStats(short zoneID, long* numBlocks, Size* usedBytes, Size* reservedBytes);
+
 //-----------------------------------------------------------------------------
 // Memory: pointer tracking
 
@@ -512,6 +644,16 @@ Boolean Pomme_DecompressSoundResource(SndListHandle* sndHandlePtr, long* offsetT
 // Pomme extension
 SndListHandle Pomme_SndLoadFileAsResource(short fRefNum);
 
+// Pomme extension: when several channels start playing the same uncompressed sound data
+// at the same pitch within the same mix block, mix them as a single voice with their gains combined.
+// maxVoicesPerGroup caps how many channels may be merged together. Pass 0 to turn this off (default).
+void Pomme_SetVoiceCoalescing(short maxVoicesPerGroup);
+
+// Pomme extension: mix audio on a dedicated thread, up to depthBlocks blocks ahead of the audio device
+// (a block is about 6 ms at 44.1 kHz). This protects against dropouts caused by mixing hiccups,
+// at the cost of added latency. Pass 0 to mix in the audio callback instead (default).
+void Pomme_SetMixAhead(short depthBlocks);
+
 #ifdef __cplusplus
 }
 #endif
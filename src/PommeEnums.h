@@ -21,6 +21,19 @@ enum {
 	fsFromMark = 3
 };
 
+//-----------------------------------------------------------------------------
+// Resource attributes
+
+enum
+{
+	resSysHeap = 64,
+	resPurgeable = 32,
+	resLocked = 16,
+	resProtected = 8,
+	resPreload = 4,
+	resChanged = 2,
+};
+
 //-----------------------------------------------------------------------------
 // Folder types
 
@@ -1,9 +1,11 @@
 #pragma once
 
 #include "PommeTypes.h"
+#include "Utilities/FlatHashMap.h"
 
 #include <iostream>
 #include <map>
+#include <memory>
 #include "CompilerSupport/filesystem.h"
 
 namespace Pomme::Files
@@ -14,19 +16,49 @@ namespace Pomme::Files
 		OSType			type;
 		SInt16			id;
 		Byte			flags;
-		SInt32			size;
+		mutable SInt32	size;			// -1 until fetched from the data section on first access
 		std::streamoff	dataOffset;
-		std::string		name;
+		const char*		name;			// interned; never null ("" if the resource has no name)
 	};
 
+	// Key for hashed (type, id) lookups
+	constexpr uint64_t ResourceKey(ResType type, SInt16 id)
+	{
+		return (uint64_t(uint32_t(type)) << 16) | uint16_t(id);
+	}
+
+	// A resource index file that a fork was opened from (see Resources.cpp)
+	struct ResourceIndexMapping;
+
 	struct ResourceFork
 	{
 		SInt16 fileRefNum;
+
+		// Ordered, for the indexed calls (Get1IndType, Get1IndResource...)
 		std::map<ResType, std::map<SInt16, ResourceMetadata> > resourceMap;
+
+		// ResourceKey(type, id) -> metadata node in resourceMap (map nodes never move)
+		FlatHashMap<uint64_t, const ResourceMetadata*> index;
+
+		// Set if the fork was opened from a resource index. Resources that aren't in resourceMap yet are looked up
+		// in the index's entries, and only copied into resourceMap once found (or once the whole map is needed).
+		std::shared_ptr<const ResourceIndexMapping> mappedIndex;
+
+		// Layout of the fork in its stream, kept up to date as the fork is written to (see UpdateResFile)
+		bool			writable = false;
+		bool			mapChanged = false;
+		UInt16			mapAttributes = 0;
+		std::streamoff	forkOffset = 0;			// start of the fork's contents
+		std::streamoff	forkEnd = 0;			// end of the fork's contents; new data is appended here
+		std::streamoff	dataSectionOff = 0;
+		std::streamoff	mapSectionOff = 0;
+		UInt32			mapSectionLen = 0;
 	};
 
 	void Init();
 
+	void Shutdown();
+
 	bool IsRefNumLegal(short refNum);
 
 	bool IsStreamOpen(short refNum);
@@ -35,8 +67,32 @@ namespace Pomme::Files
 
 	std::iostream& GetStream(short refNum);
 
+	char* MapRange(short refNum, std::streamoff offset, size_t length, void** mappingBase, size_t* mappingLength);
+
+	// Reads without touching the stream's position. Unlike GetStream, this may be called
+	// from several threads at once on the same refNum. Returns the number of bytes read.
+	size_t ReadAt(short refNum, std::streamoff offset, char* buffer, size_t length);
+
+	// Resource fork writing; see the matching ForkHandle methods
+	bool CanForkGrow(short refNum);
+
+	OSErr SetForkContentsLength(short refNum, std::streamoff length);
+
+	OSErr ReplaceForkContents(short refNum, const char* data, size_t length);
+
+	OSErr CreateResourceFork(const FSSpec* spec, OSType creator, OSType fileType);
+
 	const FSSpec& GetSpec(short refNum);
 
+	// Returns an empty path if the file isn't backed by a host file
+	fs::path GetHostPath(short refNum);
+
+	void OnResourceHandleDisposed(Handle handle, const ResourceMetadata* meta);
+
+	// Looks up a resource like GetResource would, without loading it.
+	// Sets *writePending if the resource has changes that haven't been written to its fork yet.
+	const ResourceMetadata* FindResourceMetadata(ResType theType, short theID, bool* writePending);
+
 	void CloseStream(short refNum);
 
 	FSSpec HostPathToFSSpec(const fs::path& fullPath);
@@ -15,15 +15,24 @@ namespace Pomme::Memory
 	{
 		uint32_t magic;
 		uint32_t size;
-		uint32_t ptrBatch;
+		uint8_t ptrBatch;
+		uint8_t storage;				// where the block's memory comes from (see Memory.cpp)
+		short zone;						// memory zone the block lives in, or 0 (see Pomme_OpenMemoryZone)
 		uint32_t ptrNumInBatch;
 		Ptr ptrToData;
 		const Pomme::Files::ResourceMetadata* rezMeta;
 
 		static BlockDescriptor* Allocate(uint32_t size);
 
+		// Wraps a file mapping (see ForkHandle::MapRange) in a block. The mapping is released when the block is freed.
+		static BlockDescriptor* AllocateMapped(Ptr data, uint32_t size, void* mappingBase, size_t mappingLength);
+
 		static void Free(BlockDescriptor* block);
 
+		// Changes the logical size of the data. The data stays where it is if it fits, otherwise it's moved
+		// to a bigger buffer (ptrToData changes, but the descriptor, and thus the handle, stays put).
+		void Resize(uint32_t newSize);
+
 		void CheckIsLive() const;
 
 		static BlockDescriptor* HandleToBlock(Handle h);
@@ -47,4 +56,21 @@ namespace Pomme::Memory
 	private:
 		Handle h;
 	};
+
+	class ReleaseResourceGuard
+	{
+	public:
+		ReleaseResourceGuard(Handle theHandle)
+			: h(theHandle)
+		{}
+
+		~ReleaseResourceGuard()
+		{
+			if (h)
+				ReleaseResource(h);
+		}
+
+	private:
+		Handle h;
+	};
 }
@@ -104,7 +104,9 @@ namespace Pomme::Sound
 	void GetSoundInfoFromSndResource(Handle sndHandle, SampledSoundInfo& info);
 
 	SndListHandle LoadAIFFAsResource(std::istream& input);
-	SndListHandle LoadMP3AsResource(std::istream& input);
+	// maxThreads caps how many threads decode the file; 0 means POMME_MP3_DECODE_THREADS.
+	SndListHandle LoadMP3AsResource(std::istream& input, unsigned maxThreads = 0);
 
-	std::unique_ptr<Pomme::Sound::Codec> GetCodec(uint32_t fourCC);
+	// Codecs are stateless, so this returns a shared instance.
+	Pomme::Sound::Codec& GetCodec(uint32_t fourCC);
 }
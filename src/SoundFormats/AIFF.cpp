@@ -1,6 +1,7 @@
 #include "PommeSound.h"
 #include "Utilities/bigendianstreams.h"
 #include <cstdint>
+#include <cstring>
 #include <map>
 
 static void AIFFAssert(bool condition, const char* message)
@@ -154,8 +155,8 @@ static std::streampos GetSoundInfoFromAIFF(std::istream& input, Pomme::Sound::Sa
 			}
 			else
 			{
-				auto codec = Pomme::Sound::GetCodec(info.compressionType);
-				info.decompressedLength = info.nChannels * info.nPackets * codec->SamplesPerPacket() * 2;
+				auto& codec = Pomme::Sound::GetCodec(info.compressionType);
+				info.decompressedLength = info.nChannels * info.nPackets * codec.SamplesPerPacket() * 2;
 			}
 
 			f.Skip(ssndSize);
@@ -186,11 +187,20 @@ SndListHandle Pomme::Sound::LoadAIFFAsResource(std::istream& stream)
 	Pomme::Sound::SampledSoundInfo info = {};
 	std::streampos ssndStart = GetSoundInfoFromAIFF(stream, info);
 
+	// Read the SSND payload straight into the resource, without any intermediate buffer.
+	// The samples are kept in the file's byte order: the mixer swaps them as it reads them.
 	char* dataOffset = nullptr;
 	SndListHandle h = info.MakeStandaloneResource(&dataOffset);
 
 	stream.seekg(ssndStart, std::ios::beg);
 	stream.read(dataOffset, info.compressedLength);
 
+	// MakeStandaloneResource doesn't clear the payload, so pad a truncated file with silence
+	std::streamsize didRead = stream.gcount();
+	if (didRead < info.compressedLength)
+	{
+		memset(dataOffset + didRead, 0, info.compressedLength - didRead);
+	}
+
 	return h;
 }
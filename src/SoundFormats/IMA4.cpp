@@ -20,9 +20,12 @@
 
 #include "PommeSound.h"
 
-#include <vector>
 #include <cassert>
 #include <algorithm>
+#include <stdexcept>
+
+// Decoder state is kept on the stack, so there's an upper bound on the channel count.
+static constexpr int kMaxIMA4Channels = 8;
 
 const int8_t ff_adpcm_index_table[16] = {
 	-1, -1, -1, -1, 2, 4, 6, 8,
@@ -85,7 +88,7 @@ static inline int adpcm_ima_qt_expand_nibble(ADPCMChannelStatus* c, int nibble)
 static void DecodeIMA4Chunk(
 	const uint8_t** input,
 	int16_t** output,
-	std::vector<ADPCMChannelStatus>& ctx)
+	std::span<ADPCMChannelStatus> ctx)
 {
 	const size_t nChannels = ctx.size();
 	const unsigned char* in = *input;
@@ -141,6 +144,9 @@ void Pomme::Sound::IMA4::Decode(
 	if (input.size() % 34 != 0)
 		throw std::invalid_argument("odd input buffer size");
 
+	if (nChannels < 1 || nChannels > kMaxIMA4Channels)
+		throw std::invalid_argument("unsupported channel count");
+
 	const size_t nChunks = input.size() / (34 * nChannels);
 	const size_t nSamples = 64 * nChunks;
 
@@ -149,7 +155,8 @@ void Pomme::Sound::IMA4::Decode(
 
 	const uint8_t* in = reinterpret_cast<const unsigned char*>(input.data());
 	int16_t* out = reinterpret_cast<int16_t*>(output.data());
-	std::vector<ADPCMChannelStatus> ctx(nChannels);
+	ADPCMChannelStatus ctxStorage[kMaxIMA4Channels] = {};
+	auto ctx = std::span(ctxStorage, nChannels);
 
 	for (size_t chunk = 0; chunk < nChunks; chunk++)
 	{
@@ -184,15 +184,15 @@ void Pomme::Sound::GetSoundInfo(const Ptr sndhdr, SampledSoundInfo& info)
 				info.compressionType = 'MAC3';
 			}
 
-			std::unique_ptr<Pomme::Sound::Codec> codec = Pomme::Sound::GetCodec(info.compressionType);
+			auto& codec = Pomme::Sound::GetCodec(info.compressionType);
 
 			info.isCompressed = true;
 			info.bigEndian = kIsBigEndianNative;  // just use the native endianness for this
 			info.nChannels = header.cmpSH_nChannels;
 			info.dataStart = sndhdr + f.Tell();
-			info.codecBitDepth = codec->AIFFBitDepth();
-			info.compressedLength   = info.nChannels * info.nPackets * codec->BytesPerPacket();
-			info.decompressedLength = info.nChannels * info.nPackets * codec->SamplesPerPacket() * 2;
+			info.codecBitDepth = codec.AIFFBitDepth();
+			info.compressedLength   = info.nChannels * info.nPackets * codec.BytesPerPacket();
+			info.decompressedLength = info.nChannels * info.nPackets * codec.SamplesPerPacket() * 2;
 			break;
 		}
 
@@ -237,8 +237,12 @@ SndListHandle Pomme::Sound::SampledSoundInfo::MakeStandaloneResource(char** data
 
 	SampledSoundInfo info = *this;
 
-	Handle h = NewHandleClear(2 + 4 + sizeof(info) + compressedLength);
+	// Only the header is cleared: the payload is either copied from `data` below,
+	// or filled in by the caller through dataOffsetOut (e.g. straight from a file),
+	// so there's no point in zeroing it first.
+	Handle h = NewHandle(2 + 4 + sizeof(info) + compressedLength);
 	Ptr p = *h;
+	memset(p, 0, 2 + 4 + sizeof(info));
 
 	memcpy(p, "poPOMM", 6);		// "po": see kSoundResourceType_Pomme; "POMM": see GetSoundInfo
 	p += 6;
@@ -333,10 +337,10 @@ Boolean Pomme_DecompressSoundResource(SndListHandle* sndHandlePtr, long* offsetT
 	}
 	else
 	{
-		auto codec   = Pomme::Sound::GetCodec(inInfo.compressionType);
+		auto& codec  = Pomme::Sound::GetCodec(inInfo.compressionType);
 		auto spanIn  = std::span(inDataStart, inInfo.compressedLength);
 		auto spanOut = std::span(outDataStart, inInfo.decompressedLength);
-		codec->Decode(inInfo.nChannels, spanIn, spanOut);
+		codec.Decode(inInfo.nChannels, spanIn, spanOut);
 
 #if __BIG_ENDIAN__
 		outInfo.compressionType		= 'twos';
@@ -346,7 +350,7 @@ Boolean Pomme_DecompressSoundResource(SndListHandle* sndHandlePtr, long* offsetT
 		outInfo.bigEndian			= false;		// convert to native endianness
 #endif
 		outInfo.codecBitDepth		= 16;
-		outInfo.nPackets			= codec->SamplesPerPacket() * inInfo.nPackets;
+		outInfo.nPackets			= codec.SamplesPerPacket() * inInfo.nPackets;
 	}
 
 	// Write header
@@ -371,18 +375,24 @@ Boolean Pomme_DecompressSoundResource(SndListHandle* sndHandlePtr, long* offsetT
 
 //-----------------------------------------------------------------------------
 
-std::unique_ptr<Pomme::Sound::Codec> Pomme::Sound::GetCodec(uint32_t fourCC)
+Pomme::Sound::Codec& Pomme::Sound::GetCodec(uint32_t fourCC)
 {
+	static Pomme::Sound::MACE mace;
+	static Pomme::Sound::IMA4 ima4;
+	static Pomme::Sound::xlaw alaw('alaw');
+	static Pomme::Sound::xlaw ulaw('ulaw');
+
 	switch (fourCC)
 	{
 		case 0: // Assume MACE-3 by default.
 		case 'MAC3':
-			return std::make_unique<Pomme::Sound::MACE>();
+			return mace;
 		case 'ima4':
-			return std::make_unique<Pomme::Sound::IMA4>();
+			return ima4;
 		case 'alaw':
+			return alaw;
 		case 'ulaw':
-			return std::make_unique<Pomme::Sound::xlaw>(fourCC);
+			return ulaw;
 		default:
 			throw std::runtime_error("Unknown audio codec: " + Pomme::FourCCString(fourCC));
 	}
@@ -1,9 +1,14 @@
 #ifndef POMME_NO_MP3
 
+#include "PommeDebug.h"
 #include "PommeSound.h"
 
-#include <vector>
 #include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <vector>
 
 #define MINIMP3_IMPLEMENTATION
 #include "SoundFormats/minimp3.h"
@@ -11,56 +16,189 @@
 #define MINIMP3_IO_SIZE (128*1024) // io buffer size for streaming functions, must be greater than MINIMP3_BUF_SIZE
 #define MINIMP3_BUF_SIZE (16*1024) // buffer which can hold minimum 10 consecutive mp3 frames (~16KB) worst case
 
-SndListHandle Pomme::Sound::LoadMP3AsResource(std::istream& stream)
+#define LOG POMME_GENLOG(POMME_DEBUG_SOUND, "MP3 ")
+
+// Max number of threads used to decode a single MP3 file. 0 = as many as there are hardware threads.
+#if !defined(POMME_MP3_DECODE_THREADS)
+	#define POMME_MP3_DECODE_THREADS 0
+#endif
+
+// Files shorter than this (in frames per thread) aren't worth splitting up.
+static constexpr size_t kMinFramesPerSegment = 256;
+
+// Each segment (except the first) starts decoding this many frames before its actual start,
+// and throws away the audio for these frames.
+// Layer III frames may pull their main data from up to 511 bytes in previous frames (the "bit reservoir"),
+// and the synthesis filterbank carries over state from one frame to the next. So, a decoder that starts
+// cold in the middle of a file only produces correct output once it has seen enough frames to refill
+// the reservoir. 511 bytes span at most 8 frames at the lowest bitrates (MPEG-2.5 8 kbps), so after
+// the warm-up frames, the output of each segment is identical to that of a serial decode.
+static constexpr size_t kWarmupFrames = 16;
+
+namespace
 {
-	mp3dec_t context = {};
-	mp3dec_init(&context);
+	// One call to mp3dec_decode_frame, as made by a serial decoder walking through the whole file.
+	struct DecodeStep
+	{
+		uint32_t offset;		// where the serial decoder's input window starts
+		uint32_t windowSize;	// size of the input window
+	};
 
-	mp3dec_frame_info_t frameInfo = {};
+	struct Segment
+	{
+		size_t firstStep;
+		size_t endStep;
+		std::vector<mp3d_sample_t> pcm;
+		mp3dec_frame_info_t lastFrameInfo;
+		int numSamples;
+	};
+}
 
-	std::vector<uint8_t> fileBuf;
-	std::vector<mp3d_sample_t> songPCM;
-	std::vector<mp3d_sample_t> tempPCM(MINIMP3_MAX_SAMPLES_PER_FRAME);
+static std::vector<uint8_t> ReadRestOfStream(std::istream& stream)
+{
+	std::vector<uint8_t> data;
 
-	int totalSamples = 0;
+	auto start = stream.tellg();
+	stream.seekg(0, std::ios::end);
+	auto end = stream.tellg();
+	stream.seekg(start, std::ios::beg);
 
-	while (!stream.eof() || !fileBuf.empty())
+	if (start >= 0 && end >= start)
+	{
+		// Seekable stream: get it all in one go
+		data.resize(size_t(end - start));
+		stream.read((char*) data.data(), (std::streamsize) data.size());
+		data.resize(size_t(stream.gcount()));
+	}
+	else
 	{
-		// Refill the buffer as long as data is available in the input stream.
-		// Once the stream is depleted, keep feeding the buffer to mp3dec until the buffer is empty.
-		if (fileBuf.size() < MINIMP3_BUF_SIZE
-			&& !stream.eof())
+		stream.clear();
+		while (stream.good())
 		{
-			auto oldSize = fileBuf.size();
-			auto toRead = MINIMP3_BUF_SIZE - oldSize;
+			auto oldSize = data.size();
+			data.resize(oldSize + MINIMP3_IO_SIZE);
+			stream.read((char*) (data.data() + oldSize), MINIMP3_IO_SIZE);
+			data.resize(oldSize + size_t(stream.gcount()));
+		}
+	}
 
-			fileBuf.resize(MINIMP3_BUF_SIZE);
-			stream.read((char*) (fileBuf.data() + oldSize), (int) toRead);
+	return data;
+}
 
-			auto didRead = stream.gcount();
-			fileBuf.resize(oldSize + didRead);
-		}
+// Walks through the file like a serial decoder would, but only parses frame headers.
+static std::vector<DecodeStep> ScanFrames(const std::vector<uint8_t>& file)
+{
+	std::vector<DecodeStep> steps;
+	steps.reserve(file.size() / 256);
+
+	mp3dec_t scanner = {};
+	mp3dec_init(&scanner);
 
-		if (fileBuf.empty())
+	size_t pos = 0;
+
+	while (pos < file.size())
+	{
+		DecodeStep step;
+		step.offset = (uint32_t) pos;
+		step.windowSize = (uint32_t) std::min<size_t>(MINIMP3_BUF_SIZE, file.size() - pos);
+
+		mp3dec_frame_info_t frameInfo = {};
+		mp3dec_decode_frame(&scanner, file.data() + step.offset, (int) step.windowSize, nullptr, &frameInfo);
+
+		if (frameInfo.frame_bytes <= 0)
 		{
 			break;
 		}
 
-		int numDecodedSamples = mp3dec_decode_frame(&context, fileBuf.data(), (int) fileBuf.size(), tempPCM.data(), &frameInfo);
+		steps.push_back(step);
+		pos += frameInfo.frame_bytes;
+	}
+
+	return steps;
+}
+
+static void DecodeSegment(const std::vector<uint8_t>& file, const std::vector<DecodeStep>& steps, Segment& segment)
+{
+	mp3dec_t context = {};
+	mp3dec_init(&context);
+
+	segment.lastFrameInfo = {};
+	segment.numSamples = 0;
+
+	std::vector<mp3d_sample_t> tempPCM(MINIMP3_MAX_SAMPLES_PER_FRAME);
 
-		if (numDecodedSamples > 0)
+	size_t warmupStart = segment.firstStep - std::min(segment.firstStep, kWarmupFrames);
+
+	for (size_t i = warmupStart; i < segment.endStep; i++)
+	{
+		const auto& step = steps[i];
+
+		mp3dec_frame_info_t frameInfo = {};
+		int numDecodedSamples = mp3dec_decode_frame(&context, file.data() + step.offset, (int) step.windowSize, tempPCM.data(), &frameInfo);
+
+		if (i < segment.firstStep || numDecodedSamples <= 0)
 		{
-			size_t minCapacity = songPCM.size() + (numDecodedSamples * frameInfo.channels);
-			if (songPCM.capacity() < minCapacity)
-			{
-				songPCM.reserve(2 * minCapacity);
-			}
-
-			songPCM.insert(songPCM.end(), tempPCM.begin(), tempPCM.begin() + (numDecodedSamples * frameInfo.channels));
-			totalSamples += numDecodedSamples;
+			continue;
 		}
 
-		fileBuf.erase(fileBuf.begin(), fileBuf.begin() + frameInfo.frame_bytes);
+		segment.pcm.insert(segment.pcm.end(), tempPCM.begin(), tempPCM.begin() + (numDecodedSamples * frameInfo.channels));
+		segment.numSamples += numDecodedSamples;
+		segment.lastFrameInfo = frameInfo;
+	}
+}
+
+static unsigned GetNumDecodeThreads(size_t numSteps, unsigned maxThreads)
+{
+	unsigned numThreads = maxThreads != 0 ? maxThreads : POMME_MP3_DECODE_THREADS;
+
+	if (numThreads == 0)
+	{
+		numThreads = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	return (unsigned) std::clamp<size_t>(numSteps / kMinFramesPerSegment, 1, numThreads);
+}
+
+SndListHandle Pomme::Sound::LoadMP3AsResource(std::istream& stream, unsigned maxThreads)
+{
+	auto startTime = std::chrono::steady_clock::now();
+
+	const std::vector<uint8_t> file = ReadRestOfStream(stream);
+	const std::vector<DecodeStep> steps = ScanFrames(file);
+
+	// Split the file into contiguous segments of frames, one per thread
+	unsigned numThreads = GetNumDecodeThreads(steps.size(), maxThreads);
+	std::vector<Segment> segments(numThreads);
+
+	for (unsigned i = 0; i < numThreads; i++)
+	{
+		segments[i].firstStep = steps.size() * i / numThreads;
+		segments[i].endStep = steps.size() * (i + 1) / numThreads;
+		segments[i].pcm.reserve((segments[i].endStep - segments[i].firstStep) * MINIMP3_MAX_SAMPLES_PER_FRAME);
+	}
+
+	// Decode the segments. The first segment is decoded on the calling thread.
+	std::vector<std::thread> workers;
+	for (unsigned i = 1; i < numThreads; i++)
+	{
+		workers.emplace_back(DecodeSegment, std::cref(file), std::cref(steps), std::ref(segments[i]));
+	}
+
+	DecodeSegment(file, steps, segments[0]);
+
+	for (auto& worker : workers)
+	{
+		worker.join();
+	}
+
+	// Stitch the segments together
+	mp3dec_frame_info_t frameInfo = {};
+	int totalSamples = 0;
+	for (const auto& segment : segments)
+	{
+		totalSamples += segment.numSamples;
+		if (segment.numSamples > 0)
+			frameInfo = segment.lastFrameInfo;
 	}
 
 	Pomme::Sound::SampledSoundInfo info = {};
@@ -79,8 +217,22 @@ SndListHandle Pomme::Sound::LoadMP3AsResource(std::istream& stream)
 	info.nPackets			= totalSamples;
 	info.decompressedLength	= totalSamples * info.nChannels * sizeof(mp3d_sample_t);
 	info.compressedLength	= info.decompressedLength;
-	info.dataStart			= (char*) songPCM.data();
-	return info.MakeStandaloneResource();
+	info.dataStart			= nullptr;
+
+	char* out = nullptr;
+	SndListHandle h = info.MakeStandaloneResource(&out);
+
+	for (const auto& segment : segments)
+	{
+		size_t segmentBytes = segment.pcm.size() * sizeof(mp3d_sample_t);
+		memcpy(out, segment.pcm.data(), segmentBytes);
+		out += segmentBytes;
+	}
+
+	auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime);
+	LOG << steps.size() << " frames decoded by " << numThreads << " threads in " << elapsed.count() / 1000.0 << " ms\n";
+
+	return h;
 }
 
 #endif // POMME_NO_MP3
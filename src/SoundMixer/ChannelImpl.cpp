@@ -12,10 +12,15 @@ namespace Pomme::Sound
 	extern int gNumManagedChans;
 }
 
-ChannelImpl::ChannelImpl(SndChannelPtr _macChannel, bool transferMacChannelOwnership)
-	: macChannel(_macChannel)
-	, macChannelStructAllocatedByPomme(transferMacChannelOwnership)
+ChannelImpl::ChannelImpl()
+	: prev(nullptr)
+	, next(nullptr)
+	, macChannel(nullptr)
+	, pommeMacChannel{}
 	, source()
+	, adoptedSoundHandle(nullptr)
+	, pcmBuffer()
+	, filePlayCompletion(nullptr)
 	, pan(0.0)
 	, gain(1.0)
 	, baseNote(kMiddleC)
@@ -24,20 +29,13 @@ ChannelImpl::ChannelImpl(SndChannelPtr _macChannel, bool transferMacChannelOwner
 	, loop(false)
 	, interpolate(false)
 {
-	macChannel->channelImpl = (Ptr) this;
-
-	Link();  // Link chan into our list of managed chans
 }
 
 ChannelImpl::~ChannelImpl()
 {
-	Unlink();  // Unlink chan from list of managed chans
-
-	macChannel->channelImpl = nullptr;
-
-	if (macChannelStructAllocatedByPomme)
+	if (IsAttached())
 	{
-		delete macChannel;
+		Detach();
 	}
 
 	// Make sure we've stopped mixing the source before we allow its destructor
@@ -46,9 +44,70 @@ ChannelImpl::~ChannelImpl()
 	source.RemoveFromMixer();
 }
 
+void ChannelImpl::Attach(SndChannelPtr _macChannel)
+{
+	assert(!IsAttached());
+
+	if (!_macChannel)
+	{
+		pommeMacChannel = {};
+		_macChannel = &pommeMacChannel;
+	}
+
+	macChannel = _macChannel;
+	macChannel->channelImpl = (Ptr) this;
+
+	pan = 0.0;
+	gain = 1.0;
+	baseNote = kMiddleC;
+	playbackNote = kMiddleC;
+	pitchMult = 1.0;
+	loop = false;
+	interpolate = false;
+
+	Link();  // Link chan into our list of managed chans
+}
+
+void ChannelImpl::Detach()
+{
+	assert(IsAttached());
+
+	// Make sure we've stopped mixing the source before we free the data it's reading from
+	source.RemoveFromMixer();
+	Recycle();
+
+	Unlink();  // Unlink chan from list of managed chans
+
+	macChannel->channelImpl = nullptr;
+	macChannel = nullptr;
+}
+
 void ChannelImpl::Recycle()
 {
 	source.Clear();
+	filePlayCompletion = nullptr;
+
+	// The source has let go of the data, so we can free it now
+	if (adoptedSoundHandle)
+	{
+		DisposeHandle((Handle) adoptedSoundHandle);
+		adoptedSoundHandle = nullptr;
+	}
+
+	Pomme::Sound::ReleasePCMBuffer(pcmBuffer);
+}
+
+void ChannelImpl::AdoptSoundHandle(SndListHandle sndHandle)
+{
+	assert(!adoptedSoundHandle);
+	adoptedSoundHandle = sndHandle;
+}
+
+std::span<char> ChannelImpl::AcquirePCMBuffer(size_t size)
+{
+	assert(!pcmBuffer.data);
+	pcmBuffer = Pomme::Sound::AcquirePCMBuffer(size);
+	return std::span(pcmBuffer.data, size);
 }
 
 void ChannelImpl::SetInitializationParameters(long initBits)
@@ -2,6 +2,7 @@
 
 #include "Pomme.h"
 #include "SoundMixer/cmixer.h"
+#include "SoundMixer/PCMBufferPool.h"
 
 enum ApplyParametersMask
 {
@@ -22,9 +23,21 @@ public:
 	// Pointer to application-facing interface
 	SndChannelPtr macChannel;
 
-	bool macChannelStructAllocatedByPomme;
+	// Mac channel record used if the application didn't supply its own
+	SndChannel pommeMacChannel;
+
 	cmixer::WavStream source;
 
+	// Sound resource owned by the channel. The source reads its sampled data in place,
+	// so it must outlive playback. Disposed when the channel is recycled.
+	SndListHandle adoptedSoundHandle;
+
+	// Decoded PCM data that the source is reading from. Returned to the pool when the channel is recycled.
+	Pomme::Sound::PCMBuffer pcmBuffer;
+
+	// Callback for SndStartFilePlay
+	FilePlayCompletionUPP filePlayCompletion;
+
 	// Parameters coming from Mac sound commands, passed back to cmixer source
 	double pan;
 	double gain;
@@ -34,12 +47,27 @@ public:
 	bool loop;
 	bool interpolate;
 
-	ChannelImpl(SndChannelPtr _macChannel, bool transferMacChannelOwnership);
+	ChannelImpl();
 
 	~ChannelImpl();
 
+	// Hooks up the channel to a Mac channel record (or our own if nullptr) and resets its parameters.
+	void Attach(SndChannelPtr _macChannel);
+
+	// Stops playback and unhooks the channel from its Mac channel record, so the channel can be reused.
+	void Detach();
+
+	bool IsAttached() const
+	{
+		return macChannel != nullptr;
+	}
+
 	void Recycle();
 
+	void AdoptSoundHandle(SndListHandle sndHandle);
+
+	std::span<char> AcquirePCMBuffer(size_t size);
+
 	void SetInitializationParameters(long initBits);
 
 	void ApplyParametersToSource(int mask);
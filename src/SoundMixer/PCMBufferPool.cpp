@@ -0,0 +1,126 @@
+#include "SoundMixer/PCMBufferPool.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace Pomme::Sound;
+
+// Max bytes of free buffers kept in each size class, and in the whole pool.
+// Released buffers that don't fit are freed, so a long sound (e.g. music) doesn't stay pinned after it's done.
+#if !defined(POMME_PCM_BUFFER_POOL_CLASS_BUDGET)
+	#define POMME_PCM_BUFFER_POOL_CLASS_BUDGET (2 * 1024 * 1024)
+#endif
+#if !defined(POMME_PCM_BUFFER_POOL_BUDGET)
+	#define POMME_PCM_BUFFER_POOL_BUDGET (8 * 1024 * 1024)
+#endif
+
+// Log2 of the largest power of two that doesn't exceed the given size
+static constexpr int FloorLog2(size_t size)
+{
+	int bits = 0;
+	while (size >>= 1)
+	{
+		bits++;
+	}
+	return bits;
+}
+
+// Smallest size class is 4 KB. The largest is the biggest that a size class may keep (2 MB by default):
+// bigger buffers could never be pooled anyway, so they're allocated at their exact size instead of being rounded up.
+static constexpr int kMinSizeClassBits = 12;
+static constexpr int kMaxSizeClassBits = std::max(kMinSizeClassBits, FloorLog2(POMME_PCM_BUFFER_POOL_CLASS_BUDGET));
+static constexpr int kNumSizeClasses = kMaxSizeClassBits - kMinSizeClassBits + 1;
+
+// Free buffers in each size class form a singly-linked list.
+// The link to the next free buffer is stored in the first bytes of each buffer.
+static char* gFreeLists[kNumSizeClasses];
+
+// Bytes of free buffers in each size class, and in total
+static size_t gPooledBytes[kNumSizeClasses];
+static size_t gTotalPooledBytes = 0;
+
+static int GetSizeClass(size_t capacity)
+{
+	int sizeClass = 0;
+	while ((size_t(1) << (kMinSizeClassBits + sizeClass)) < capacity)
+	{
+		sizeClass++;
+	}
+	return sizeClass < kNumSizeClasses ? sizeClass : -1;
+}
+
+static size_t GetClassCapacity(int sizeClass)
+{
+	return size_t(1) << (kMinSizeClassBits + sizeClass);
+}
+
+static char* PopFreeBuffer(int sizeClass)
+{
+	char* buffer = gFreeLists[sizeClass];
+	if (buffer)
+	{
+		memcpy(&gFreeLists[sizeClass], buffer, sizeof(char*));
+		gPooledBytes[sizeClass] -= GetClassCapacity(sizeClass);
+		gTotalPooledBytes -= GetClassCapacity(sizeClass);
+	}
+	return buffer;
+}
+
+PCMBuffer Pomme::Sound::AcquirePCMBuffer(size_t minCapacity)
+{
+	PCMBuffer buffer;
+	buffer.sizeClass = GetSizeClass(minCapacity);
+
+	if (buffer.sizeClass < 0)
+	{
+		// Too big to pool
+		buffer.capacity = minCapacity;
+		buffer.data = new char[buffer.capacity];
+	}
+	else
+	{
+		buffer.capacity = GetClassCapacity(buffer.sizeClass);
+		buffer.data = PopFreeBuffer(buffer.sizeClass);
+		if (!buffer.data)
+		{
+			buffer.data = new char[buffer.capacity];
+		}
+	}
+
+	return buffer;
+}
+
+void Pomme::Sound::ReleasePCMBuffer(PCMBuffer& buffer)
+{
+	if (!buffer.data)
+	{
+		return;
+	}
+
+	if (buffer.sizeClass < 0
+		|| gPooledBytes[buffer.sizeClass] + buffer.capacity > POMME_PCM_BUFFER_POOL_CLASS_BUDGET
+		|| gTotalPooledBytes + buffer.capacity > POMME_PCM_BUFFER_POOL_BUDGET)
+	{
+		delete[] buffer.data;
+	}
+	else
+	{
+		memcpy(buffer.data, &gFreeLists[buffer.sizeClass], sizeof(char*));
+		gFreeLists[buffer.sizeClass] = buffer.data;
+		gPooledBytes[buffer.sizeClass] += buffer.capacity;
+		gTotalPooledBytes += buffer.capacity;
+	}
+
+	buffer = {};
+}
+
+void Pomme::Sound::TrimPCMBufferPool()
+{
+	for (int sizeClass = 0; sizeClass < kNumSizeClasses; sizeClass++)
+	{
+		while (char* buffer = PopFreeBuffer(sizeClass))
+		{
+			delete[] buffer;
+		}
+	}
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstddef>
+
+namespace Pomme::Sound
+{
+	// A buffer of decoded PCM data, checked out of the PCM buffer pool.
+	struct PCMBuffer
+	{
+		char* data = nullptr;
+		size_t capacity = 0;
+		int sizeClass = -1;
+	};
+
+	// Hands out buffers for decoded sounds, rounded up to power-of-two size classes.
+	// Released buffers are kept around for reuse by any channel, so once the game has
+	// played each of its sounds once, playing them again doesn't touch the heap.
+	// The pool only keeps a bounded amount of free buffers (see POMME_PCM_BUFFER_POOL_BUDGET).
+	PCMBuffer AcquirePCMBuffer(size_t minCapacity);
+
+	void ReleasePCMBuffer(PCMBuffer& buffer);
+
+	// Frees all pooled buffers that aren't checked out.
+	void TrimPCMBufferPool();
+}
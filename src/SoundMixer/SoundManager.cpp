@@ -7,11 +7,13 @@
 #include "Utilities/IEEEExtended.h"
 #include "Utilities/memstream.h"
 
+#include <atomic>
 #include <thread>
 #include <chrono>
 #include <iostream>
 #include <cassert>
 #include <cstring>
+#include <vector>
 
 #define LOG POMME_GENLOG(POMME_DEBUG_SOUND, "SOUN")
 #define LOG_NOPREFIX POMME_GENLOG_NOPREFIX(POMME_DEBUG_SOUND)
@@ -25,6 +27,16 @@ namespace Pomme::Sound
 	int gNumManagedChans = 0;
 }
 
+// Disposed channels are kept here for reuse by SndNewChannel.
+static std::vector<ChannelImpl*> gSpareChans;
+
+// Room for this many spare channels is reserved up front.
+static constexpr size_t kSpareChansReserve = 64;
+
+// Compressed sounds are only fingerprinted while voice coalescing is on (see Pomme_SetVoiceCoalescing),
+// so that games that don't use it don't pay for hashing every sound they play.
+static std::atomic<bool> gFingerprintCompressedSounds = false;
+
 //-----------------------------------------------------------------------------
 // Internal utilities
 
@@ -65,22 +77,28 @@ OSErr SndNewChannel(SndChannelPtr* macChanPtr, short synth, long init, SndCallBa
 	}
 
 	//---------------------------
-	// Allocate Mac channel record if needed
+	// Reuse a disposed channel if possible
 
-	bool transferMacChannelOwnership = false;
+	ChannelImpl* channelImpl;
 
-	if (!*macChanPtr)
+	if (!gSpareChans.empty())
 	{
-		*macChanPtr = new SndChannel;
-		(**macChanPtr) = {};
-		transferMacChannelOwnership = true;
+		channelImpl = gSpareChans.back();
+		gSpareChans.pop_back();
+	}
+	else
+	{
+		channelImpl = new ChannelImpl();
 	}
 
 	//---------------------------
 	// Set up
+	// (If the app didn't give us a Mac channel record, the channel provides its own)
+
+	channelImpl->Attach(*macChanPtr);
+	*macChanPtr = channelImpl->macChannel;
 
 	(**macChanPtr).callBack = userRoutine;
-	auto channelImpl = new ChannelImpl(*macChanPtr, transferMacChannelOwnership);
 
 	channelImpl->SetInitializationParameters(init);
 
@@ -100,7 +118,9 @@ OSErr SndDisposeChannel(SndChannelPtr macChanPtr, Boolean quietNow)
 	{
 		TODO2("SndDisposeChannel: quietNow == false is not implemented");
 	}
-	delete &GetChannelImpl(macChanPtr);
+	auto& impl = GetChannelImpl(macChanPtr);
+	impl.Detach();
+	gSpareChans.push_back(&impl);
 	return noErr;
 }
 
@@ -124,8 +144,37 @@ OSErr SndChannelStatus(SndChannelPtr chan, short theLength, SCStatusPtr theStatu
 	return noErr;
 }
 
+// Identifies compressed sound data by its contents (FNV-1a), so that channels that decoded
+// the same sound into separate buffers can still be coalesced by the mixer.
+// Going by contents rather than by address means a buffer that was freed and reused for another sound
+// can't be mistaken for the sound that a channel is still playing.
+static uint64_t FingerprintCompressedSound(const Pomme::Sound::SampledSoundInfo& info, std::span<const char> data)
+{
+	uint64_t hash = 0xCBF29CE484222325ull;
+
+	auto mix = [&hash](uint8_t byte)
+	{
+		hash = (hash ^ byte) * 0x100000001B3ull;
+	};
+
+	for (int shift = 24; shift >= 0; shift -= 8)
+	{
+		mix(uint8_t(info.compressionType >> shift));
+	}
+	mix(uint8_t(info.nChannels));
+
+	for (char byte : data)
+	{
+		mix(uint8_t(byte));
+	}
+
+	return hash != 0 ? hash : 1;
+}
+
 // Install a sampled sound as a voice in a channel.
-static void InstallSoundInChannel(SndChannelPtr chan, const Ptr sampledSoundHeader, bool forceCopy=false)
+// If sndHandleToAdopt is given, the channel takes ownership of that sound resource
+// (which must contain sampledSoundHeader) and plays raw PCM data in place.
+static void InstallSoundInChannel(SndChannelPtr chan, const Ptr sampledSoundHeader, SndListHandle sndHandleToAdopt=nullptr)
 {
 	//---------------------------------
 	// Get internal channel
@@ -146,23 +195,27 @@ static void InstallSoundInChannel(SndChannelPtr chan, const Ptr sampledSoundHead
 
 	if (info.isCompressed)
 	{
-		auto spanOut = impl.source.GetBuffer(info.decompressedLength);
+		auto spanOut = impl.AcquirePCMBuffer(info.decompressedLength);
 
-		std::unique_ptr<Pomme::Sound::Codec> codec = Pomme::Sound::GetCodec(info.compressionType);
-		codec->Decode(info.nChannels, spanIn, spanOut);
+		auto& codec = Pomme::Sound::GetCodec(info.compressionType);
+		codec.Decode(info.nChannels, spanIn, spanOut);
 		impl.source.Init(info.sampleRate, 16, info.nChannels, kIsBigEndianNative, spanOut);
-	}
-	else if (forceCopy)
-	{
-		auto spanOut = impl.source.GetBuffer(info.decompressedLength);
-		memcpy(spanOut.data(), spanIn.data(), spanIn.size());
-		impl.source.Init(info.sampleRate, info.codecBitDepth, info.nChannels, info.bigEndian, spanOut);
+		if (gFingerprintCompressedSounds.load(std::memory_order_relaxed))
+			impl.source.SetDecodedFrom(FingerprintCompressedSound(info, spanIn));
 	}
 	else
 	{
 		impl.source.Init(info.sampleRate, info.codecBitDepth, info.nChannels, info.bigEndian, spanIn);
 	}
 
+	if (sndHandleToAdopt)
+	{
+		if (info.isCompressed)
+			DisposeHandle((Handle) sndHandleToAdopt);		// we've got a decoded copy, don't need it anymore
+		else
+			impl.AdoptSoundHandle(sndHandleToAdopt);		// source is reading from it
+	}
+
 	//---------------------------------
 	// Base note
 
@@ -353,16 +406,23 @@ OSErr SndStartFilePlay(
 		return badFileFormat;
 	}
 
+	// Hand the resource over to the channel so it can play the samples in place
+	// instead of copying them. The channel will dispose of it when it's recycled.
 	long offset = 0;
 	GetSoundHeaderOffset(sndListHandle, &offset);
-	InstallSoundInChannel(chan, ((Ptr) *sndListHandle) + offset, true);
-	DisposeHandle((Handle) sndListHandle);
+	InstallSoundInChannel(chan, ((Ptr) *sndListHandle) + offset, sndListHandle);
 	sndListHandle = nullptr;
 
 	auto& impl = GetChannelImpl(chan);
 	if (theCompletion)
 	{
-		impl.source.onComplete = [=]() { theCompletion(chan); };
+		impl.filePlayCompletion = theCompletion;
+		impl.source.onCompleteUserData = &impl;
+		impl.source.onComplete = [](void* userData)
+		{
+			auto* completedImpl = (ChannelImpl*) userData;
+			completedImpl->filePlayCompletion(completedImpl->macChannel);
+		};
 	}
 	impl.source.Play();
 
@@ -395,6 +455,17 @@ OSErr SndStopFilePlay(SndChannelPtr chan, Boolean quietNow)
 	return noErr;
 }
 
+void Pomme_SetVoiceCoalescing(short maxVoicesPerGroup)
+{
+	gFingerprintCompressedSounds = maxVoicesPerGroup >= 2;
+	cmixer::SetVoiceCoalescing(maxVoicesPerGroup);
+}
+
+void Pomme_SetMixAhead(short depthBlocks)
+{
+	cmixer::SetMixAhead(depthBlocks);
+}
+
 NumVersion SndSoundManagerVersion()
 {
 	NumVersion v = {};
@@ -410,6 +481,7 @@ NumVersion SndSoundManagerVersion()
 
 void Pomme::Sound::InitMixer()
 {
+	gSpareChans.reserve(kSpareChansReserve);
 	cmixer::InitWithSDL();
 }
 
@@ -419,5 +491,11 @@ void Pomme::Sound::ShutdownMixer()
 	{
 		SndDisposeChannel(Pomme::Sound::gHeadChan->macChannel, true);
 	}
+	for (auto* spareChan : gSpareChans)
+	{
+		delete spareChan;
+	}
+	gSpareChans.clear();
 	cmixer::ShutdownWithSDL();
+	Pomme::Sound::TrimPCMBufferPool();
 }
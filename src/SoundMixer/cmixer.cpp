@@ -26,9 +26,11 @@
 #include "Utilities/structpack.h"
 #include <SDL.h>
 
+#include <atomic>
+#include <cstdlib>
 #include <vector>
 #include <fstream>
-#include <list>
+#include <thread>
 
 using namespace cmixer;
 
@@ -45,6 +47,39 @@ using namespace cmixer;
 
 #define BUFFER_MASK (BUFFER_SIZE - 1)
 
+//-----------------------------------------------------------------------------
+// Load governor tuning
+
+// Callback cost (as a fraction of the device deadline) above which the governor lowers quality
+static constexpr double kGovernorDowngradeLoad = 0.75;
+
+// Callback cost below which the governor considers raising quality again
+static constexpr double kGovernorUpgradeLoad = 0.45;
+
+// The load must stay below kGovernorUpgradeLoad for this many consecutive callbacks
+// (about a second with the default device buffer) before quality is raised
+static constexpr int kGovernorUpgradeCallbacks = 50;
+
+// After changing the quality level, wait this many callbacks for the smoothed load to
+// reflect the new level before lowering quality any further
+static constexpr int kGovernorSettleCallbacks = 8;
+
+// Weight of each new measurement in the smoothed load
+static constexpr double kGovernorSmoothing = 1.0 / 8.0;
+
+// At CM_QUALITY_REDUCED, sources quieter than this lose interpolation
+static constexpr int kQuietGain = FX_UNIT / 2;
+
+// At CM_QUALITY_MINIMAL, sources quieter than this (about -48 dB) aren't mixed at all
+static constexpr int kSubAudibleGain = FX_UNIT / 256;
+
+//-----------------------------------------------------------------------------
+// Voice coalescing
+
+// Ceiling for the combined gain of a coalesced voice group, so that a full-scale
+// sample times the gain still fits in an int32 (the mix would clip long before that anyway)
+static constexpr int kMaxCoalescedGain = 16 * FX_UNIT;
+
 //-----------------------------------------------------------------------------
 // Global mixer
 
@@ -52,22 +87,77 @@ static struct Mixer
 {
 	SDL_mutex* sdlAudioMutex;
 
-	std::list<Source*> sources;   // Linked list of active (playing) sources
+	Source* sources;              // Linked list of active (playing) sources
 	int32_t pcmmixbuf[BUFFER_SIZE]; // Internal master buffer
 	int samplerate;               // Master samplerate
 	int gain;                     // Master gain (fixed point)
 
+	bool adaptiveQuality;         // Whether the load governor may change qualityLevel
+	int qualityLevel;             // Current resampling quality (CM_QUALITY_*)
+	int governorCooldown;         // Callbacks left before the governor may lower quality again
+	int governorHeadroomStreak;   // Consecutive callbacks with enough headroom to raise quality
+	int maxVoicesPerGroup;        // Max sources merged into a single voice (coalescing is off if < 2)
+	int numFollowers;             // Total number of sources riding along with a leader
+	MixerStats stats;
+
 	void Init(int samplerate);
 
+	void AudioCallback(int16_t* dst, int len);
+
 	void Process(int16_t* dst, int len);
 
+	void UpdateGovernor(double callbackLoad);
+
+	void CoalesceVoices();
+
+	void SyncFollowers();
+
 	void Lock();
 
 	void Unlock();
 
 	void SetMasterGain(double newGain);
+
+	void LinkSource(Source* source);
+
+	void UnlinkSource(Source* source);
 } gMixer = {};
 
+//-----------------------------------------------------------------------------
+// Mix-ahead: a dedicated thread renders blocks of BUFFER_SIZE samples ahead of time
+// into a lock-free single-producer/single-consumer ring, and the audio callback only
+// copies blocks out of the ring. This way, a slow mix pass only eats into the ring's
+// lead time instead of causing a dropout right away.
+
+static struct MixAhead
+{
+	std::vector<int16_t> ring;              // depth * BUFFER_SIZE samples
+	int depth;                              // Capacity of the ring in blocks (0 if mix-ahead is off)
+	std::atomic<uint32_t> head;             // Total blocks written (only advanced by the mixer thread)
+	std::atomic<uint32_t> tail;             // Total blocks consumed (only advanced by the audio callback)
+	std::atomic<uint32_t> wakeCounter;      // Bumped to wake up the mixer thread when it's waiting for room
+	std::atomic<bool> running;
+	int readOffset;                         // Samples already consumed from the block at `tail` (audio callback only)
+	std::thread thread;
+
+	std::atomic<int> lastFill;
+	std::atomic<int> minFill;
+	std::atomic<uint64_t> underruns;
+
+	void Start(int depthBlocks);
+
+	void Stop();
+
+	void ThreadLoop();
+
+	void Read(int16_t* dst, int len);
+
+	void WakeMixerThread();
+} gMixAhead;
+
+// Mix-ahead depth requested by the application (applied when the audio device is open)
+static int gRequestedMixAheadDepth = 0;
+
 //-----------------------------------------------------------------------------
 // Global init/shutdown
 
@@ -93,7 +183,10 @@ void cmixer::InitWithSDL()
 	fmt.callback = [](void* udata, Uint8* stream, int size)
 	{
 		(void) udata;
-		gMixer.Process((int16_t*) stream, size / 2);
+		if (gMixAhead.depth > 0)
+			gMixAhead.Read((int16_t*) stream, size / 2);
+		else
+			gMixer.AudioCallback((int16_t*) stream, size / 2);
 	};
 
 	SDL_AudioSpec got;
@@ -105,6 +198,12 @@ void cmixer::InitWithSDL()
 	gMixer.Init(got.freq);
 	gMixer.SetMasterGain(0.5);
 
+	// Start mixer thread if the application asked for it
+	if (gRequestedMixAheadDepth > 0)
+	{
+		gMixAhead.Start(gRequestedMixAheadDepth);
+	}
+
 	// Start audio
 	SDL_PauseAudioDevice(sdlDeviceID, 0);
 }
@@ -113,6 +212,11 @@ void cmixer::ShutdownWithSDL()
 {
 	if (sdlDeviceID)
 	{
+		// Stop the mixer thread before the device goes away
+		SDL_LockAudioDevice(sdlDeviceID);
+		gMixAhead.Stop();
+		SDL_UnlockAudioDevice(sdlDeviceID);
+
 		SDL_CloseAudioDevice(sdlDeviceID);
 		sdlDeviceID = 0;
 	}
@@ -138,6 +242,169 @@ void cmixer::SetMasterGain(double newGain)
 	gMixer.SetMasterGain(newGain);
 }
 
+void cmixer::SetAdaptiveQuality(bool enable)
+{
+	gMixer.Lock();
+	gMixer.adaptiveQuality = enable;
+	if (!enable)
+	{
+		gMixer.qualityLevel = CM_QUALITY_FULL;
+		gMixer.stats.qualityLevel = CM_QUALITY_FULL;
+	}
+	gMixer.Unlock();
+}
+
+void cmixer::SetVoiceCoalescing(int maxVoicesPerGroup)
+{
+	gMixer.Lock();
+	gMixer.maxVoicesPerGroup = maxVoicesPerGroup;
+	gMixer.Unlock();
+}
+
+void cmixer::SetMixAhead(int depthBlocks)
+{
+	gRequestedMixAheadDepth = MAX(depthBlocks, 0);
+
+	if (!sdlDeviceID)
+	{
+		// Will be applied in InitWithSDL
+		return;
+	}
+
+	// Keep the audio callback out of the ring while we're swapping it out
+	SDL_LockAudioDevice(sdlDeviceID);
+	gMixAhead.Stop();
+	if (gRequestedMixAheadDepth > 0)
+	{
+		gMixAhead.Start(gRequestedMixAheadDepth);
+	}
+	SDL_UnlockAudioDevice(sdlDeviceID);
+}
+
+MixerStats cmixer::GetStats()
+{
+	gMixer.Lock();
+	MixerStats stats = gMixer.stats;
+	gMixer.Unlock();
+
+	stats.mixAheadDepth = gMixAhead.depth;
+	if (gMixAhead.depth > 0)
+	{
+		stats.mixAheadFill = gMixAhead.lastFill.load(std::memory_order_relaxed);
+		stats.mixAheadMinFill = gMixAhead.minFill.load(std::memory_order_relaxed);
+		stats.mixAheadUnderruns = gMixAhead.underruns.load(std::memory_order_relaxed);
+	}
+	return stats;
+}
+
+//-----------------------------------------------------------------------------
+// Mix-ahead impl
+
+void MixAhead::Start(int depthBlocks)
+{
+	ring.assign(size_t(depthBlocks) * BUFFER_SIZE, 0);
+	depth = depthBlocks;
+	head.store(0, std::memory_order_relaxed);
+	tail.store(0, std::memory_order_relaxed);
+	readOffset = 0;
+	lastFill.store(0, std::memory_order_relaxed);
+	minFill.store(depthBlocks, std::memory_order_relaxed);
+	underruns.store(0, std::memory_order_relaxed);
+	running.store(true, std::memory_order_release);
+	thread = std::thread(&MixAhead::ThreadLoop, this);
+}
+
+void MixAhead::Stop()
+{
+	if (!thread.joinable())
+	{
+		return;
+	}
+
+	running.store(false, std::memory_order_release);
+	WakeMixerThread();
+	thread.join();
+
+	depth = 0;
+	ring.clear();
+	ring.shrink_to_fit();
+}
+
+void MixAhead::WakeMixerThread()
+{
+	wakeCounter.fetch_add(1, std::memory_order_release);
+	wakeCounter.notify_one();
+}
+
+void MixAhead::ThreadLoop()
+{
+	while (running.load(std::memory_order_acquire))
+	{
+		// Sample the wake counter before checking for room, so that we can't miss a wakeup
+		uint32_t wake = wakeCounter.load(std::memory_order_acquire);
+
+		uint32_t writeBlock = head.load(std::memory_order_relaxed);
+		uint32_t readBlock = tail.load(std::memory_order_acquire);
+
+		if (writeBlock - readBlock >= (uint32_t) depth)
+		{
+			// Ring is full; sleep until the audio callback consumes a block (or we're stopped)
+			wakeCounter.wait(wake, std::memory_order_acquire);
+			continue;
+		}
+
+		int16_t* block = &ring[size_t(writeBlock % depth) * BUFFER_SIZE];
+		gMixer.AudioCallback(block, BUFFER_SIZE);
+
+		// Publish the block to the audio callback
+		head.store(writeBlock + 1, std::memory_order_release);
+	}
+}
+
+void MixAhead::Read(int16_t* dst, int len)
+{
+	uint32_t readBlock = tail.load(std::memory_order_relaxed);
+	uint32_t writeBlock = head.load(std::memory_order_acquire);
+
+	int fill = int(writeBlock - readBlock);
+	lastFill.store(fill, std::memory_order_relaxed);
+	if (fill < minFill.load(std::memory_order_relaxed))
+	{
+		minFill.store(fill, std::memory_order_relaxed);
+	}
+
+	while (len > 0)
+	{
+		if (readBlock == writeBlock)
+		{
+			writeBlock = head.load(std::memory_order_acquire);
+			if (readBlock == writeBlock)
+			{
+				// The mixer thread couldn't keep up; play silence for the rest of this callback
+				memset(dst, 0, len * sizeof(dst[0]));
+				underruns.fetch_add(1, std::memory_order_relaxed);
+				break;
+			}
+		}
+
+		const int16_t* block = &ring[size_t(readBlock % depth) * BUFFER_SIZE];
+		int n = MIN(len, BUFFER_SIZE - readOffset);
+		memcpy(dst, block + readOffset, n * sizeof(dst[0]));
+		dst += n;
+		len -= n;
+		readOffset += n;
+
+		if (readOffset == BUFFER_SIZE)
+		{
+			// Hand the block back to the mixer thread
+			readOffset = 0;
+			readBlock++;
+			tail.store(readBlock, std::memory_order_release);
+			WakeMixerThread();
+		}
+	}
+}
+
 //-----------------------------------------------------------------------------
 // Global mixer impl
 
@@ -157,6 +424,14 @@ void Mixer::Init(int newSamplerate)
 
 	samplerate = newSamplerate;
 	gain = FX_UNIT;
+
+	adaptiveQuality = true;
+	qualityLevel = CM_QUALITY_FULL;
+	governorCooldown = 0;
+	governorHeadroomStreak = 0;
+	maxVoicesPerGroup = 0;
+	numFollowers = 0;
+	stats = {};
 }
 
 void Mixer::SetMasterGain(double newGain)
@@ -166,6 +441,70 @@ void Mixer::SetMasterGain(double newGain)
 	gain = (int) FX_FROM_FLOAT(newGain);
 }
 
+void Mixer::AudioCallback(int16_t* dst, int len)
+{
+	uint64_t startTime = SDL_GetPerformanceCounter();
+
+	Process(dst, len);
+
+	uint64_t elapsed = SDL_GetPerformanceCounter() - startTime;
+
+	// We must produce len/2 stereo frames before the device runs dry
+	double deadline = (len / 2) / (double) samplerate;
+	double callbackLoad = (elapsed / (double) SDL_GetPerformanceFrequency()) / deadline;
+
+	Lock();
+	UpdateGovernor(callbackLoad);
+	Unlock();
+}
+
+void Mixer::UpdateGovernor(double callbackLoad)
+{
+	stats.callbacks++;
+	stats.load += (callbackLoad - stats.load) * kGovernorSmoothing;
+	stats.peakLoad = MAX(stats.peakLoad, callbackLoad);
+
+	if (governorCooldown > 0)
+	{
+		governorCooldown--;
+	}
+
+	if (!adaptiveQuality)
+	{
+		return;
+	}
+
+	if (stats.load > kGovernorDowngradeLoad)
+	{
+		governorHeadroomStreak = 0;
+
+		if (qualityLevel < CM_QUALITY_MINIMAL && governorCooldown == 0)
+		{
+			qualityLevel++;
+			governorCooldown = kGovernorSettleCallbacks;
+			stats.qualityDowngrades++;
+		}
+	}
+	else if (stats.load < kGovernorUpgradeLoad && qualityLevel > CM_QUALITY_FULL)
+	{
+		governorHeadroomStreak++;
+
+		if (governorHeadroomStreak >= kGovernorUpgradeCallbacks)
+		{
+			qualityLevel--;
+			governorHeadroomStreak = 0;
+			governorCooldown = kGovernorSettleCallbacks;
+			stats.qualityUpgrades++;
+		}
+	}
+	else
+	{
+		governorHeadroomStreak = 0;
+	}
+
+	stats.qualityLevel = qualityLevel;
+}
+
 void Mixer::Process(int16_t* dst, int len)
 {
 	// Process in chunks of BUFFER_SIZE if `len` is larger than BUFFER_SIZE
@@ -181,21 +520,31 @@ void Mixer::Process(int16_t* dst, int len)
 
 	// Process active sources
 	Lock();
-	for (auto si = sources.begin(); si != sources.end();)
+	stats.activeVoices = 0;
+	stats.nearestVoices = 0;
+	stats.skippedVoices = 0;
+	stats.coalescedVoices = 0;
+	CoalesceVoices();
+	for (Source* s = sources; s; )
 	{
-		auto& s = **si;
-		s.Process(len);
-		// Remove source from list if it is no longer playing
-		if (s.state != CM_STATE_PLAYING)
+		Source* next = s->nextActive;
+		// Followers are mixed by their leader
+		if (s->coalesceLeader)
 		{
-			s.active = false;
-			si = sources.erase(si);
+			stats.coalescedVoices++;
+			s = next;
+			continue;
 		}
-		else
+		s->Process(len);
+		// Remove source from list if it is no longer playing
+		// (unless its completion callback has removed it already)
+		if (s->active && s->state != CM_STATE_PLAYING)
 		{
-			++si;
+			UnlinkSource(s);
 		}
+		s = next;
 	}
+	SyncFollowers();
 	Unlock();
 
 	// Copy internal buffer to destination and clip
@@ -206,6 +555,117 @@ void Mixer::Process(int16_t* dst, int len)
 	}
 }
 
+// Merges sources that start playing the same data in the same mix pass into a single voice.
+// This also splits off any followers whose parameters have drifted away from their leader's.
+void Mixer::CoalesceVoices()
+{
+	// Split off followers that can't ride along with their leader anymore
+	if (numFollowers > 0)
+	{
+		for (Source* s = sources; s; s = s->nextActive)
+		{
+			Source* leader = s->coalesceLeader;
+			if (leader && !leader->CanCarryFollower(*s))
+			{
+				leader->DetachFollower(s);
+				// Unless it's been stopped, the follower picks up from wherever the leader currently is
+				if (s->state != CM_STATE_STOPPED)
+					s->CopyPlaybackState(*leader);
+			}
+		}
+	}
+
+	if (maxVoicesPerGroup < 2)
+	{
+		return;
+	}
+
+	// Sources that haven't started yet (rewind is set) are all at the very beginning of their data,
+	// so identical sources among them will produce the exact same output
+	for (Source* s = sources; s; s = s->nextActive)
+	{
+		if (!s->rewind || s->state != CM_STATE_PLAYING || s->coalesceLeader || s->firstFollower)
+		{
+			continue;
+		}
+
+		for (Source* leader = sources; leader != s; leader = leader->nextActive)
+		{
+			if (leader->rewind
+				&& !leader->coalesceLeader
+				&& leader->numFollowers + 1 < maxVoicesPerGroup
+				&& leader->CanCoalesceWith(*s))
+			{
+				leader->AttachFollower(s);
+				stats.coalescedStarts++;
+				break;
+			}
+		}
+	}
+}
+
+// Keeps followers' playback state in step with their leader after a mix pass,
+// so that status queries on a follower report the same thing as if it were mixed on its own.
+void Mixer::SyncFollowers()
+{
+	if (numFollowers == 0)
+	{
+		return;
+	}
+
+	for (Source* s = sources; s; )
+	{
+		Source* next = s->nextActive;
+		Source* leader = s->coalesceLeader;
+
+		if (leader)
+		{
+			s->position = leader->position;
+			s->end = leader->end;
+			s->nextfill = leader->nextfill;
+			s->rewind = leader->rewind;
+
+			if (leader->state != CM_STATE_PLAYING)
+			{
+				// The leader has reached the end of the sound, and so has the follower
+				leader->DetachFollower(s);
+				s->state = leader->state;
+				if (s->onComplete != nullptr)
+					s->onComplete(s->onCompleteUserData);
+				if (s->active && s->state != CM_STATE_PLAYING)
+					UnlinkSource(s);
+			}
+		}
+
+		s = next;
+	}
+}
+
+void Mixer::LinkSource(Source* source)
+{
+	source->active = true;
+	source->prevActive = nullptr;
+	source->nextActive = sources;
+	if (sources)
+		sources->prevActive = source;
+	sources = source;
+}
+
+void Mixer::UnlinkSource(Source* source)
+{
+	if (source->prevActive)
+		source->prevActive->nextActive = source->nextActive;
+	else
+		sources = source->nextActive;
+
+	if (source->nextActive)
+		source->nextActive->prevActive = source->prevActive;
+
+	source->prevActive = nullptr;
+	source->nextActive = nullptr;
+	source->active = false;
+}
+
 //-----------------------------------------------------------------------------
 // Source implementation
 
@@ -213,6 +673,12 @@ Source::Source()
 {
 	ClearPrivate();
 	active = false;
+	prevActive = nullptr;
+	nextActive = nullptr;
+	coalesceLeader = nullptr;
+	firstFollower = nullptr;
+	nextFollower = nullptr;
+	numFollowers = 0;
 }
 
 void Source::ClearPrivate()
@@ -233,11 +699,15 @@ void Source::ClearPrivate()
 	gain		= 0;
 	pan			= 0;
 	onComplete	= nullptr;
+	onCompleteUserData = nullptr;
 }
 
 void Source::Clear()
 {
 	gMixer.Lock();
+	ReleaseFollowers();
+	if (coalesceLeader)
+		coalesceLeader->DetachFollower(this);
 	ClearPrivate();
 	ClearImplementation();
 	gMixer.Unlock();
@@ -258,10 +728,14 @@ void Source::Init(int theSampleRate, int theLength)
 void Source::RemoveFromMixer()
 {
 	gMixer.Lock();
+	ReleaseFollowers();
+	if (coalesceLeader)
+	{
+		coalesceLeader->DetachFollower(this);
+	}
 	if (active)
 	{
-		gMixer.sources.remove(this);
-		active = false;
+		gMixer.UnlinkSource(this);
 	}
 	gMixer.Unlock();
 }
@@ -308,6 +782,40 @@ void Source::Process(int len)
 		return;
 	}
 
+	// If other sources are riding along with this one, mix them all in one go
+	int mixLGain = lgain;
+	int mixRGain = rgain;
+	for (Source* follower = firstFollower; follower; follower = follower->nextFollower)
+	{
+		mixLGain += follower->lgain;
+		mixRGain += follower->rgain;
+	}
+	mixLGain = CLAMP(mixLGain, -kMaxCoalescedGain, kMaxCoalescedGain);
+	mixRGain = CLAMP(mixRGain, -kMaxCoalescedGain, kMaxCoalescedGain);
+
+	// Let the load governor lower the quality of this source if the mixer is struggling
+	int peakGain = MAX(abs(mixLGain), abs(mixRGain));
+	bool useInterpolation = interpolate;
+	bool skipMix = false;
+
+	switch (gMixer.qualityLevel)
+	{
+		case CM_QUALITY_REDUCED:
+			useInterpolation &= peakGain >= kQuietGain;
+			break;
+
+		case CM_QUALITY_MINIMAL:
+			useInterpolation = false;
+			skipMix = peakGain < kSubAudibleGain;
+			break;
+	}
+
+	gMixer.stats.activeVoices++;
+	if (skipMix)
+		gMixer.stats.skippedVoices++;
+	else if (interpolate && !useInterpolation && rate != FX_UNIT)
+		gMixer.stats.nearestVoices++;
+
 	// Process audio
 	while (len > 0)
 	{
@@ -333,7 +841,7 @@ void Source::Process(int len)
 			{
 				state = CM_STATE_STOPPED;
 				if (onComplete != nullptr)
-					onComplete();
+					onComplete(onCompleteUserData);
 				break;
 			}
 		}
@@ -346,20 +854,26 @@ void Source::Process(int len)
 		len -= count * 2;
 
 		// Add audio to master buffer
-		if (rate == FX_UNIT)
+		if (skipMix)
+		{
+			// Sub-audible: keep the playhead moving, but don't bother mixing
+			position += (int64_t) count * rate;
+			dst += count * 2;
+		}
+		else if (rate == FX_UNIT)
 		{
 			// Add audio to buffer -- basic
 			n = frame * 2;
 			for (int i = 0; i < count; i++)
 			{
-				dst[0] += (pcmbuf[(n    ) & BUFFER_MASK] * lgain) >> FX_BITS;
-				dst[1] += (pcmbuf[(n + 1) & BUFFER_MASK] * rgain) >> FX_BITS;
+				dst[0] += (pcmbuf[(n    ) & BUFFER_MASK] * mixLGain) >> FX_BITS;
+				dst[1] += (pcmbuf[(n + 1) & BUFFER_MASK] * mixRGain) >> FX_BITS;
 				n += 2;
 				dst += 2;
 			}
 			this->position += count * FX_UNIT;
 		}
-		else if (interpolate)
+		else if (useInterpolation)
 		{
 			// Resample audio (with linear interpolation) and add to buffer
 			for (int i = 0; i < count; i++)
@@ -368,11 +882,11 @@ void Source::Process(int len)
 				int p = position & FX_MASK;
 				int a = pcmbuf[(n    ) & BUFFER_MASK];
 				int b = pcmbuf[(n + 2) & BUFFER_MASK];
-				dst[0] += (FX_LERP(a, b, p) * lgain) >> FX_BITS;
+				dst[0] += (FX_LERP(a, b, p) * mixLGain) >> FX_BITS;
 				n++;
 				a = pcmbuf[(n    ) & BUFFER_MASK];
 				b = pcmbuf[(n + 2) & BUFFER_MASK];
-				dst[1] += (FX_LERP(a, b, p) * rgain) >> FX_BITS;
+				dst[1] += (FX_LERP(a, b, p) * mixRGain) >> FX_BITS;
 				position += rate;
 				dst += 2;
 			}
@@ -383,8 +897,8 @@ void Source::Process(int len)
 			for (int i = 0; i < count; i++)
 			{
 				n = int(position >> FX_BITS) * 2;
-				dst[0] += (pcmbuf[(n    ) & BUFFER_MASK] * lgain) >> FX_BITS;
-				dst[1] += (pcmbuf[(n + 1) & BUFFER_MASK] * rgain) >> FX_BITS;
+				dst[0] += (pcmbuf[(n    ) & BUFFER_MASK] * mixLGain) >> FX_BITS;
+				dst[1] += (pcmbuf[(n + 1) & BUFFER_MASK] * mixRGain) >> FX_BITS;
 				position += rate;
 				dst += 2;
 			}
@@ -392,6 +906,83 @@ void Source::Process(int len)
 	}
 }
 
+bool Source::CanCoalesceWith(const Source& other) const
+{
+	return state == CM_STATE_PLAYING
+		&& other.state == CM_STATE_PLAYING
+		&& samplerate == other.samplerate
+		&& length == other.length
+		&& sustainOffset == other.sustainOffset
+		&& rate == other.rate
+		&& loop == other.loop
+		&& interpolate == other.interpolate
+		&& SharesDataWith(other);
+}
+
+bool Source::CanCarryFollower(const Source& follower) const
+{
+	return active
+		&& state == CM_STATE_PLAYING
+		&& follower.state == CM_STATE_PLAYING
+		&& rate == follower.rate
+		&& loop == follower.loop
+		&& interpolate == follower.interpolate;
+}
+
+void Source::AttachFollower(Source* follower)
+{
+	follower->coalesceLeader = this;
+	follower->nextFollower = firstFollower;
+	firstFollower = follower;
+	numFollowers++;
+	gMixer.numFollowers++;
+}
+
+void Source::DetachFollower(Source* follower)
+{
+	Source** link = &firstFollower;
+	while (*link != follower)
+	{
+		link = &(*link)->nextFollower;
+	}
+	*link = follower->nextFollower;
+
+	follower->coalesceLeader = nullptr;
+	follower->nextFollower = nullptr;
+	numFollowers--;
+	gMixer.numFollowers--;
+}
+
+// Hands the followers over to the first one among them, so they keep playing
+// when this source stops being their leader (e.g. it's getting cleared or removed from the mixer).
+void Source::ReleaseFollowers()
+{
+	Source* newLeader = firstFollower;
+	if (!newLeader)
+	{
+		return;
+	}
+
+	DetachFollower(newLeader);
+	newLeader->CopyPlaybackState(*this);
+
+	while (Source* follower = firstFollower)
+	{
+		DetachFollower(follower);
+		newLeader->AttachFollower(follower);
+	}
+}
+
+void Source::CopyPlaybackState(const Source& other)
+{
+	memcpy(pcmbuf, other.pcmbuf, sizeof(pcmbuf));
+	position = other.position;
+	end = other.end;
+	nextfill = other.nextfill;
+	rewind = other.rewind;
+	CopyImplementationState(other);
+}
+
 double Source::GetLength() const
 {
 	return length / (double) samplerate;
@@ -464,8 +1055,7 @@ void Source::Play()
 	state = CM_STATE_PLAYING;
 	if (!active)
 	{
-		active = true;
-		gMixer.sources.push_front(this);
+		gMixer.LinkSource(this);
 	}
 	gMixer.Unlock();
 }
@@ -485,8 +1075,12 @@ void Source::TogglePause()
 
 void Source::Stop()
 {
+	gMixer.Lock();
+	// Let followers carry on from the current position before we rewind
+	ReleaseFollowers();
 	state = CM_STATE_STOPPED;
 	rewind = true;
+	gMixer.Unlock();
 }
 
 //-----------------------------------------------------------------------------
@@ -513,6 +1107,7 @@ void WavStream::ClearImplementation()
 	bigEndian = kIsBigEndianNative;
 	idx = 0;
 	userBuffer.clear();
+	decodedFrom = 0;
 }
 
 void WavStream::Init(
@@ -544,11 +1139,37 @@ std::span<char> WavStream::SetBuffer(std::vector<char>&& data)
 	return std::span(userBuffer.data(), userBuffer.size());
 }
 
+void WavStream::SetDecodedFrom(uint64_t fingerprint)
+{
+	decodedFrom = fingerprint;
+}
+
 void WavStream::RewindImplementation()
 {
 	idx = 0;
 }
 
+bool WavStream::SharesDataWith(const Source& other) const
+{
+	auto& otherWav = static_cast<const WavStream&>(other);
+
+	// Each channel decodes compressed sounds into a buffer of its own, so look at where the data came from
+	bool sameData = (decodedFrom != 0 || otherWav.decodedFrom != 0)
+		? decodedFrom == otherWav.decodedFrom
+		: span.data() == otherWav.span.data();
+
+	return sameData
+		&& span.size() == otherWav.span.size()
+		&& bitdepth == otherWav.bitdepth
+		&& channels == otherWav.channels
+		&& bigEndian == otherWav.bigEndian;
+}
+
+void WavStream::CopyImplementationState(const Source& other)
+{
+	idx = static_cast<const WavStream&>(other).idx;
+}
+
 void WavStream::FillBuffer(int16_t* dst, int fillLength)
 {
 	int x, n;
@@ -25,7 +25,6 @@
 #pragma once
 
 #include <vector>
-#include <functional>
 #include <cstdint>
 #include "CompilerSupport/span.h"
 
@@ -56,10 +55,17 @@ namespace cmixer
 		bool loop;                      // Whether the source will loop when `end` is reached
 		bool rewind;                    // Whether the source will rewind before playing
 		bool active;                    // Whether the source is part of `sources` list
+		Source* prevActive;             // Previous source in `sources` list
+		Source* nextActive;             // Next source in `sources` list
+		Source* coalesceLeader;         // If set, this source isn't mixed on its own; it rides along with its leader
+		Source* firstFollower;          // Sources riding along with this one
+		Source* nextFollower;           // Next source riding along with the same leader
+		int numFollowers;               // Number of sources riding along with this one
 		bool interpolate;               // Interpolated resampling when played back at a non-native rate
 		double gain;                    // Gain set by `cm_set_gain()`
 		double pan;                     // Pan set by `cm_set_pan()`
-		std::function<void()> onComplete;        // Callback
+		void (*onComplete)(void*);      // Callback
+		void* onCompleteUserData;       // Argument passed to onComplete
 
 	private:
 		void ClearPrivate();
@@ -70,6 +76,8 @@ namespace cmixer
 		virtual void RewindImplementation() = 0;
 		virtual void ClearImplementation() = 0;
 		virtual void FillBuffer(int16_t* buffer, int length) = 0;
+		virtual bool SharesDataWith(const Source& other) const = 0;
+		virtual void CopyImplementationState(const Source& other) = 0;
 
 	public:
 		virtual ~Source();
@@ -79,6 +87,12 @@ namespace cmixer
 		void RecalcGains();
 		void FillBuffer(int offset, int length);
 		void Process(int len);
+		bool CanCoalesceWith(const Source& other) const;
+		bool CanCarryFollower(const Source& follower) const;
+		void AttachFollower(Source* follower);
+		void DetachFollower(Source* follower);
+		void ReleaseFollowers();
+		void CopyPlaybackState(const Source& other);
 		double GetLength() const;
 		double GetPosition() const;
 		int GetState() const;
@@ -101,10 +115,13 @@ namespace cmixer
 		int idx;
 		std::span<char> span;
 		std::vector<char> userBuffer;
+		uint64_t decodedFrom;		// Fingerprint of the compressed data that was decoded into span (0: not decoded)
 
 		void ClearImplementation() override;
 		void RewindImplementation() override;
 		void FillBuffer(int16_t* buffer, int length) override;
+		bool SharesDataWith(const Source& other) const override;
+		void CopyImplementationState(const Source& other) override;
 
 		inline uint8_t* data8() const { return reinterpret_cast<uint8_t*>(span.data()); }
 		inline int16_t* data16() const { return reinterpret_cast<int16_t*>(span.data()); }
@@ -114,6 +131,10 @@ namespace cmixer
 		void Init(int theSampleRate, int theBitDepth, int nChannels, bool bigEndian, std::span<char> data);
 		std::span<char> GetBuffer(int nBytesOut);
 		std::span<char> SetBuffer(std::vector<char>&& data);
+
+		// Tells the mixer that span holds data decoded from compressed data with this (nonzero) fingerprint.
+		// Streams decoded from the same data may then be coalesced even though they don't share a buffer.
+		void SetDecodedFrom(uint64_t fingerprint);
 	};
 
 	// Guard class that safely removes the source from the mixer when the guard object is destroyed.
@@ -126,8 +147,39 @@ namespace cmixer
 		~SourceMixGuard() { source.RemoveFromMixer(); }
 	};
 
+	// Resampling quality levels picked by the load governor
+	enum
+	{
+		CM_QUALITY_FULL,                // Honor each source's interpolation setting
+		CM_QUALITY_REDUCED,             // Quiet sources use nearest-neighbor resampling
+		CM_QUALITY_MINIMAL,             // All sources use nearest-neighbor resampling; sub-audible sources aren't mixed
+	};
+
+	struct MixerStats
+	{
+		uint64_t callbacks;             // Number of audio callbacks serviced
+		double load;                    // Smoothed callback cost, as a fraction of the device deadline
+		double peakLoad;                // Highest callback cost seen so far, as a fraction of the deadline
+		int qualityLevel;               // Current resampling quality level (CM_QUALITY_*)
+		uint64_t qualityDowngrades;     // Number of times the governor lowered the quality level
+		uint64_t qualityUpgrades;       // Number of times the governor raised the quality level
+		int activeVoices;               // Sources mixed in the last pass
+		int nearestVoices;              // Sources that asked for interpolation but got nearest-neighbor in the last pass
+		int skippedVoices;              // Sub-audible sources that weren't mixed in the last pass
+		int coalescedVoices;            // Sources that rode along with an identical source in the last pass
+		uint64_t coalescedStarts;       // Number of times a starting source was merged into an identical one
+		int mixAheadDepth;              // Capacity of the mix-ahead ring in blocks of BUFFER_SIZE samples (0: mix-ahead is off)
+		int mixAheadFill;               // Blocks in the mix-ahead ring at the last audio callback
+		int mixAheadMinFill;            // Lowest fill level seen by the audio callback since mix-ahead was turned on
+		uint64_t mixAheadUnderruns;     // Audio callbacks that found the mix-ahead ring empty
+	};
+
 	void InitWithSDL();
 	void ShutdownWithSDL();
 	double GetMasterGain();
 	void SetMasterGain(double);
+	void SetAdaptiveQuality(bool);
+	void SetVoiceCoalescing(int maxVoicesPerGroup);
+	void SetMixAhead(int depthBlocks);
+	MixerStats GetStats();
 }
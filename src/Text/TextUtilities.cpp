@@ -1,10 +1,13 @@
 #include "Pomme.h"
 #include "PommeTypes.h"
 #include "PommeDebug.h"
+#include "PommeMemory.h"
+#include "Files/DecodedResources.h"
 
+#include <algorithm>
 #include <cstring>
-#include <Utilities/memstream.h>
-#include <Utilities/bigendianstreams.h>
+#include <string>
+#include <vector>
 
 void NumToString(long theNum, Str255 theString)
 {
@@ -17,38 +20,92 @@ int NumToStringC(long theNum, Str255 theString)
 	return snprintf(theString, 256, "%ld", theNum);
 }
 
-void GetIndStringC(Str255 theStringC, short strListID, short index)
+// Decoded 'STR#' resource, so that getting any string from it is a plain lookup
+using StringList = std::vector<std::string>;
+
+static std::shared_ptr<const StringList> DecodeStringList(Handle strListHandle, short, size_t* decodedBytes)
 {
-	theStringC[0] = '\0';
+	const auto* data = (const uint8_t*) *strListHandle;
+	const size_t size = GetHandleSize(strListHandle);
 
-	Handle strListHandle = GetResource('STR#', strListID);
+	if (size < 2)
+		return nullptr;
+
+	auto list = std::make_shared<StringList>();
+	int nStrings = int16_t((data[0] << 8) | data[1]);
+	list->reserve(std::max(nStrings, 0));
+
+	// Stop at the end of the data if the list is truncated
+	size_t offset = 2;
+	for (int i = 0; i < nStrings && offset < size; i++)
+	{
+		size_t pstrlen = std::min<size_t>(data[offset], size - offset - 1);
+		list->emplace_back((const char*) data + offset + 1, pstrlen);
+		offset += 1 + pstrlen;
+	}
+
+	*decodedBytes = sizeof(StringList) + size + list->size() * sizeof(std::string);
+	return list;
+}
+
+static const Pomme::Files::DecodedResourceType<StringList> gStringLists('STR#', DecodeStringList);
 
+// Copies a string out of a 'STR#' resource without decoding the rest of the list
+static void CopyIndStringFromResource(Str255 theStringC, short strListID, short index)
+{
+	Handle strListHandle = GetResource('STR#', strListID);
 	if (!strListHandle)
 		return;
 
-	memstream substream(*strListHandle, GetHandleSize(strListHandle));
-	Pomme::BigEndianIStream f(substream);
+	Pomme::Memory::ReleaseResourceGuard autoRelease(strListHandle);
 
-	int16_t nStrings = f.Read<int16_t>();
+	const auto* data = (const uint8_t*) *strListHandle;
+	const size_t size = GetHandleSize(strListHandle);
 
-	if (index > nStrings)		// index starts at 1, hence '>' rather than '>='
-	{
-		ReleaseResource(strListHandle);
+	if (size < 2)
+		return;
+
+	int nStrings = int16_t((data[0] << 8) | data[1]);
+	if (nStrings <= 0 || index > nStrings)		// index starts at 1, hence '>' rather than '>='
 		return;
-	}
 
-	// Skip to requested string
-	uint8_t pstrlen = 0;
-	for (int i = 1; i < index; i++)		// index starts at 1
+	// Skip to the requested string, stopping at the end of the data if the list is truncated
+	size_t offset = 2;
+	for (int i = 1; i < index; i++)
 	{
-		pstrlen = f.Read<uint8_t>();
-		f.Skip(pstrlen);
+		if (offset >= size)
+			return;
+		offset += 1 + data[offset];
 	}
 
-	pstrlen = f.Read<uint8_t>();
-	f.Read(theStringC, pstrlen);
+	if (offset >= size)
+		return;
+
+	size_t pstrlen = std::min<size_t>(data[offset], size - offset - 1);
+	memcpy(theStringC, data + offset + 1, pstrlen);
 	theStringC[pstrlen] = '\0';
-	static_assert(sizeof(Str255) == 256);
+}
 
-	ReleaseResource(strListHandle);
+void GetIndStringC(Str255 theStringC, short strListID, short index)
+{
+	theStringC[0] = '\0';
+
+	if (!Pomme::Files::DecodedResources::IsEnabled())
+	{
+		CopyIndStringFromResource(theStringC, strListID, index);
+		return;
+	}
+
+	auto strList = gStringLists.Get(strListID);
+
+	if (!strList || strList->empty())
+		return;
+
+	if (index > (short) strList->size())		// index starts at 1, hence '>' rather than '>='
+		return;
+
+	const std::string& str = (*strList)[std::max<short>(index, 1) - 1];
+	memcpy(theStringC, str.data(), str.size());
+	theStringC[str.size()] = '\0';
+	static_assert(sizeof(Str255) == 256);
 }
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace Pomme {
+
+// Open-addressing hash map with linear probing, for small trivially-copyable keys and values.
+// All entries live in a single flat array, so a lookup usually touches just one cache line.
+// Pointers to values are invalidated by Insert (the table may grow) and by Erase.
+template<typename TKey, typename TValue>
+class FlatHashMap
+{
+	struct Slot
+	{
+		TKey key;
+		TValue value;
+		bool occupied;
+	};
+
+	std::vector<Slot> slots;
+	size_t count = 0;
+	size_t mask = 0;
+
+	static size_t Hash(TKey key)
+	{
+		// Fibonacci hashing: spreads consecutive keys (e.g. resource IDs) over the whole table
+		uint64_t h = uint64_t(key) * 0x9E3779B97F4A7C15ull;
+		return size_t(h ^ (h >> 32));
+	}
+
+	void Rehash(size_t capacity)
+	{
+		std::vector<Slot> oldSlots(capacity);
+		oldSlots.swap(slots);
+		mask = slots.size() - 1;
+		count = 0;
+
+		for (const auto& slot : oldSlots)
+		{
+			if (slot.occupied)
+				Insert(slot.key, slot.value);
+		}
+	}
+
+public:
+	// Makes room for `n` entries without further rehashing
+	void Reserve(size_t n)
+	{
+		size_t capacity = slots.empty() ? 16 : slots.size();
+		while (n * 4 > capacity * 3)
+			capacity *= 2;
+
+		if (capacity != slots.size())
+			Rehash(capacity);
+	}
+
+	// Inserts or overwrites the value for `key`
+	void Insert(TKey key, TValue value)
+	{
+		if ((count + 1) * 4 > slots.size() * 3)		// keep load factor under 3/4
+			Rehash(slots.empty() ? 16 : slots.size() * 2);
+
+		for (size_t i = Hash(key) & mask; ; i = (i + 1) & mask)
+		{
+			Slot& slot = slots[i];
+
+			if (!slot.occupied)
+			{
+				slot = {key, value, true};
+				count++;
+				return;
+			}
+
+			if (slot.key == key)
+			{
+				slot.value = value;
+				return;
+			}
+		}
+	}
+
+	// Returns nullptr if the key isn't in the map
+	const TValue* Find(TKey key) const
+	{
+		if (count == 0)
+			return nullptr;
+
+		for (size_t i = Hash(key) & mask; ; i = (i + 1) & mask)
+		{
+			const Slot& slot = slots[i];
+
+			if (!slot.occupied)
+				return nullptr;
+
+			if (slot.key == key)
+				return &slot.value;
+		}
+	}
+
+	bool Erase(TKey key)
+	{
+		if (count == 0)
+			return false;
+
+		size_t i = Hash(key) & mask;
+
+		while (!(slots[i].occupied && slots[i].key == key))
+		{
+			if (!slots[i].occupied)
+				return false;
+			i = (i + 1) & mask;
+		}
+
+		// Backward-shift deletion: pull later entries of the probe run into the hole
+		// so that lookups never need tombstones.
+		size_t hole = i;
+		for (size_t j = (i + 1) & mask; slots[j].occupied; j = (j + 1) & mask)
+		{
+			size_t home = Hash(slots[j].key) & mask;
+
+			// Move the entry unless its home slot lies cyclically in (hole, j]
+			bool homeBetween = (hole <= j) ? (hole < home && home <= j) : (hole < home || home <= j);
+			if (!homeBetween)
+			{
+				slots[hole] = slots[j];
+				hole = j;
+			}
+		}
+
+		slots[hole].occupied = false;
+		count--;
+		return true;
+	}
+
+	void Clear()
+	{
+		if (count == 0)
+			return;
+
+		for (auto& slot : slots)
+			slot.occupied = false;
+		count = 0;
+	}
+
+	size_t Size() const
+	{
+		return count;
+	}
+};
+
+}
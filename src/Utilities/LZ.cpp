@@ -0,0 +1,167 @@
+#include "Utilities/LZ.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+// Compressed data is a series of sequences:
+//
+//   token        1 byte: high nibble = literal count, low nibble = match length - kMinMatch.
+//                A nibble of 15 means the count continues in extra bytes: add bytes until one isn't 255.
+//   [literals]   literal bytes, copied as-is
+//   offset       2 bytes (little-endian) to go back in the output to find the match (1..65535)
+//   [extra]      match length continuation bytes
+//
+// The last sequence only has literals: it ends right after them.
+
+static constexpr size_t kMinMatch = 4;
+static constexpr size_t kMaxOffset = 65535;
+static constexpr int kHashBits = 14;
+
+static uint32_t Read32(const uint8_t* p)
+{
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+static uint32_t Hash(uint32_t v)
+{
+	return (v * 2654435761u) >> (32 - kHashBits);
+}
+
+static void WriteCount(std::vector<char>& out, size_t count)
+{
+	while (count >= 255)
+	{
+		out.push_back((char) 255);
+		count -= 255;
+	}
+	out.push_back((char) count);
+}
+
+static void WriteSequence(std::vector<char>& out, const uint8_t* literals, size_t numLiterals, size_t offset, size_t matchLength)
+{
+	size_t matchCode = matchLength ? matchLength - kMinMatch : 0;
+
+	uint8_t token = (uint8_t) ((std::min<size_t>(numLiterals, 15) << 4) | std::min<size_t>(matchCode, 15));
+	out.push_back((char) token);
+
+	if (numLiterals >= 15)
+		WriteCount(out, numLiterals - 15);
+
+	out.insert(out.end(), literals, literals + numLiterals);
+
+	if (matchLength == 0)		// last sequence
+		return;
+
+	out.push_back((char) (offset & 0xFF));
+	out.push_back((char) (offset >> 8));
+
+	if (matchCode >= 15)
+		WriteCount(out, matchCode - 15);
+}
+
+std::vector<char> Pomme::LZ::Compress(const char* srcChars, size_t srcLength)
+{
+	const uint8_t* src = (const uint8_t*) srcChars;
+
+	std::vector<char> out;
+	out.reserve(srcLength / 2 + 16);
+
+	std::vector<uint32_t> table(size_t(1) << kHashBits, UINT32_MAX);
+
+	size_t anchor = 0;		// start of pending literals
+	size_t pos = 0;
+
+	while (srcLength >= kMinMatch && pos <= srcLength - kMinMatch)
+	{
+		uint32_t sequence = Read32(src + pos);
+		uint32_t h = Hash(sequence);
+		uint32_t candidate = table[h];
+		table[h] = (uint32_t) pos;
+
+		if (candidate == UINT32_MAX
+			|| pos - candidate > kMaxOffset
+			|| Read32(src + candidate) != sequence)
+		{
+			pos++;
+			continue;
+		}
+
+		size_t matchLength = kMinMatch;
+		while (pos + matchLength < srcLength && src[candidate + matchLength] == src[pos + matchLength])
+			matchLength++;
+
+		WriteSequence(out, src + anchor, pos - anchor, pos - candidate, matchLength);
+
+		pos += matchLength;
+		anchor = pos;
+	}
+
+	WriteSequence(out, src + anchor, srcLength - anchor, 0, 0);
+
+	return out;
+}
+
+static bool ReadCount(const uint8_t*& p, const uint8_t* end, size_t& count)
+{
+	uint8_t b;
+	do
+	{
+		if (p >= end)
+			return false;
+		b = *p++;
+		count += b;
+	} while (b == 255);
+	return true;
+}
+
+bool Pomme::LZ::Decompress(const char* srcChars, size_t srcLength, char* dstChars, size_t dstLength)
+{
+	const uint8_t* p = (const uint8_t*) srcChars;
+	const uint8_t* const end = p + srcLength;
+	uint8_t* dst = (uint8_t*) dstChars;
+	size_t out = 0;
+
+	while (p < end)
+	{
+		uint8_t token = *p++;
+
+		size_t numLiterals = token >> 4;
+		if (numLiterals == 15 && !ReadCount(p, end, numLiterals))
+			return false;
+
+		if (numLiterals > size_t(end - p) || numLiterals > dstLength - out)
+			return false;
+
+		memcpy(dst + out, p, numLiterals);
+		p += numLiterals;
+		out += numLiterals;
+
+		if (p == end)		// last sequence
+			break;
+
+		if (end - p < 2)
+			return false;
+
+		size_t offset = p[0] | (p[1] << 8);
+		p += 2;
+
+		size_t matchLength = (token & 15);
+		if (matchLength == 15 && !ReadCount(p, end, matchLength))
+			return false;
+		matchLength += kMinMatch;
+
+		if (offset == 0 || offset > out || matchLength > dstLength - out)
+			return false;
+
+		// Byte by byte: the match may overlap the bytes it produces
+		const uint8_t* match = dst + out - offset;
+		for (size_t i = 0; i < matchLength; i++)
+			dst[out + i] = match[i];
+		out += matchLength;
+	}
+
+	return out == dstLength;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// Small LZ77 codec (byte-oriented, in the spirit of LZ4) used by Pomme pack files.
+// Favors decompression speed over compression ratio.
+namespace Pomme::LZ
+{
+	std::vector<char> Compress(const char* src, size_t srcLength);
+
+	// Returns false if the compressed data is corrupted or doesn't decompress to exactly dstLength bytes.
+	bool Decompress(const char* src, size_t srcLength, char* dst, size_t dstLength);
+}
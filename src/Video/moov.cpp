@@ -283,10 +283,10 @@ static void Parse_mdia_soun(Pomme::BigEndianIStream& f, Movie& movie)
 	// EXTRACT AUDIO
 
 	bool isRawPCM = movie.audioFormat == 'twos' || movie.audioFormat == 'swot';
-	std::unique_ptr<Pomme::Sound::Codec> codec = nullptr;
+	Pomme::Sound::Codec* codec = nullptr;
 	if (!isRawPCM)
 	{
-		codec = Pomme::Sound::GetCodec(movie.audioFormat);
+		codec = &Pomme::Sound::GetCodec(movie.audioFormat);
 	}
 
 	// Set up position guard for rest of function
@@ -0,0 +1,190 @@
+// handles: checks that SetHandleSize keeps the data and the heap statistics right, whichever way a handle's data is stored.
+//
+// Grows handles one byte at a time, shrinks them back into their block, grows a big resource handle
+// (which may be mapped straight from its resource fork), and resizes a handle that lives in a memory zone.
+// Pomme_GetHeapSize and Pomme_GetNumAllocs must be back to where they started once everything is disposed of.
+
+#include "Pomme.h"
+#include "PommeFiles.h"
+
+#include <cstdio>
+#include <cstring>
+
+#define CHECK(condition) \
+	do \
+	{ \
+		if (!(condition)) \
+		{ \
+			printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+			return false; \
+		} \
+	} while (0)
+
+// Heap size counted for a fresh handle of this size
+static Size GetFreshHandleHeapSize(Size size)
+{
+	Size before = Pomme_GetHeapSize();
+	Handle h = NewHandle(size);
+	Size heapSize = Pomme_GetHeapSize() - before;
+	DisposeHandle(h);
+	return heapSize;
+}
+
+static bool TestAppends()
+{
+	const Size heapBefore = Pomme_GetHeapSize();
+	const int numBytes = 100000;
+
+	Handle h = NewHandle(0);
+	for (int i = 0; i < numBytes; i++)
+	{
+		Size n = GetHandleSize(h);
+		SetHandleSize(h, n + 1);
+		(*h)[n] = (char) (i * 13);
+	}
+
+	CHECK(GetHandleSize(h) == numBytes);
+	for (int i = 0; i < numBytes; i++)
+	{
+		CHECK((*h)[i] == (char) (i * 13));
+	}
+
+	// The spare room that geometric growth keeps past the end of the data isn't counted, but the data is
+	CHECK(Pomme_GetHeapSize() - heapBefore >= numBytes);
+
+	DisposeHandle(h);
+	CHECK(Pomme_GetHeapSize() == heapBefore);
+	return true;
+}
+
+static bool TestShrinkBackIntoBlock()
+{
+	const Size heapBefore = Pomme_GetHeapSize();
+	const Size freshHeapSize = GetFreshHandleHeapSize(16);
+
+	Handle h = NewHandle(20);
+	Ptr inlineData = *h;
+	memset(*h, 7, 20);
+
+	// Too big for the block: the data moves out
+	SetHandleSize(h, 5000);
+	CHECK(*h != inlineData);
+	CHECK((*h)[19] == 7);
+	CHECK(Pomme_GetHeapSize() - heapBefore >= 5000);
+
+	// Fits in the block again: the data moves back, and the relocated buffer is freed
+	SetHandleSize(h, 16);
+	CHECK(*h == inlineData);
+	CHECK((*h)[15] == 7);
+	CHECK(Pomme_GetHeapSize() - heapBefore == freshHeapSize);
+
+	// Doesn't fit in the block: stays in its relocated buffer
+	SetHandleSize(h, 4000);
+	(*h)[3999] = 9;
+	SetHandleSize(h, 3000);
+	CHECK(*h != inlineData);
+	CHECK((*h)[0] == 7);
+
+	DisposeHandle(h);
+	CHECK(Pomme_GetHeapSize() == heapBefore);
+	return true;
+}
+
+static bool TestGrowResource()
+{
+	const Size heapBefore = Pomme_GetHeapSize();
+	const Size resourceSize = 256 * 1024;		// big enough to be mapped from the fork, where mapping is available
+
+	FSSpec spec;
+	FSMakeFSSpec(0, 0, ":PommeTestHandles", &spec);
+	FSpDelete(&spec);
+	FSpCreateResFile(&spec, 'PomM', 'rsrc', 0);
+
+	short refNum = FSpOpenResFile(&spec, fsRdWrPerm);
+	CHECK(refNum > 0);
+	Handle data = NewHandle(resourceSize);
+	for (Size i = 0; i < resourceSize; i++)
+	{
+		(*data)[i] = (char) i;
+	}
+	AddResource(data, 'Test', 128, "");
+	CloseResFile(refNum);
+	DisposeHandle(data);
+
+	refNum = FSpOpenResFile(&spec, fsRdPerm);
+	CHECK(refNum > 0);
+
+	Handle h = GetResource('Test', 128);
+	CHECK(h && GetHandleSize(h) == resourceSize);
+	DetachResource(h);
+
+	SetHandleSize(h, resourceSize - 10);
+	CHECK(GetHandleSize(h) == resourceSize - 10);
+
+	SetHandleSize(h, resourceSize + 100);
+	CHECK(GetHandleSize(h) == resourceSize + 100);
+	CHECK((*h)[255] == (char) 255);
+	CHECK((*h)[resourceSize - 11] == (char) (resourceSize - 11));
+	(*h)[resourceSize + 99] = 5;
+
+	DisposeHandle(h);
+	CloseResFile(refNum);
+	FSpDelete(&spec);
+
+	CHECK(Pomme_GetHeapSize() == heapBefore);
+	return true;
+}
+
+static bool TestZoneBlock()
+{
+	const Size heapBefore = Pomme_GetHeapSize();
+
+	short zoneID = 0;
+	CHECK(Pomme_OpenMemoryZone(&zoneID) == noErr);
+	Handle h = NewHandle(10);
+	CHECK(Pomme_CloseMemoryZone(zoneID) == noErr);
+
+	for (int i = 0; i < 20000; i++)
+	{
+		Size n = GetHandleSize(h);
+		SetHandleSize(h, n + 1);
+		(*h)[n] = (char) i;
+	}
+	CHECK((*h)[10 + 19999] == (char) 19999);
+	CHECK(Pomme_GetHeapSize() - heapBefore >= 10 + 20000);
+
+	SetHandleSize(h, 16);
+	CHECK(GetHandleSize(h) == 16);
+	CHECK((*h)[10] == 0);
+
+	long numBlocks = 0;
+	CHECK(Pomme_GetMemoryZoneStats(zoneID, &numBlocks, nullptr, nullptr) == noErr);
+	CHECK(numBlocks == 1);
+
+	DisposeHandle(h);
+	CHECK(Pomme_GetMemoryZoneStats(zoneID, &numBlocks, nullptr, nullptr) == noErr);
+	CHECK(numBlocks == 0);
+	CHECK(Pomme_GetHeapSize() == heapBefore);
+
+	CHECK(Pomme_DisposeMemoryZone(zoneID) == noErr);
+	CHECK(Pomme_GetHeapSize() == heapBefore);
+	return true;
+}
+
+int main()
+{
+	Pomme::Files::Init();
+
+	bool ok = TestAppends()
+		&& TestShrinkBackIntoBlock()
+		&& TestGrowResource()
+		&& TestZoneBlock();
+
+	if (ok && (Pomme_GetHeapSize() != 0 || Pomme_GetNumAllocs() != 0))
+	{
+		printf("Heap size %ld, %ld blocks still alive\n", (long) Pomme_GetHeapSize(), Pomme_GetNumAllocs());
+		ok = false;
+	}
+
+	return ok ? 0 : 1;
+}
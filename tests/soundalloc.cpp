@@ -0,0 +1,138 @@
+// soundalloc: checks that playing sounds doesn't allocate once every sound has been played once.
+//
+// Plays a compressed (IMA4) sound and a raw 8-bit sound on 4 channels, 10000 times in total,
+// and counts calls to operator new in the meantime. Needs an audio device (SDL_AUDIODRIVER=dummy will do).
+
+#include "Pomme.h"
+#include "PommeSound.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <vector>
+
+static std::atomic<long> gNumAllocations = 0;
+
+void* operator new(size_t size)
+{
+	gNumAllocations++;
+	void* p = malloc(size ? size : 1);
+	if (!p)
+	{
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void* p) noexcept
+{
+	free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+	free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+	free(p);
+}
+
+static SndListHandle MakeIMA4Sound()
+{
+	Pomme::Sound::SampledSoundInfo info = {};
+	info.compressionType = 'ima4';
+	info.isCompressed = true;
+	info.nChannels = 1;
+	info.nPackets = 100;
+	info.codecBitDepth = 16;
+	info.sampleRate = 22050;
+	info.compressedLength = info.nPackets * 34;
+	info.decompressedLength = info.nPackets * 64 * 2;
+	info.baseNote = 60;
+
+	char* data = nullptr;
+	SndListHandle sound = info.MakeStandaloneResource(&data);
+	memset(data, 0x11, info.compressedLength);
+	return sound;
+}
+
+// Standard sound header (stdSH) followed by 8-bit samples, as bufferCmd takes it
+static std::vector<char> MakeRawSoundHeader()
+{
+	const int numSamples = 5000;
+
+	std::vector<char> header(22 + numSamples, (char) 0x80);
+	memset(header.data(), 0, 22);
+	header[6] = (char) (numSamples >> 8);		// length
+	header[7] = (char) (numSamples & 0xFF);
+	header[8] = 0x56;							// sampleRate: 22254.5 Hz
+	header[9] = 0x22;
+	header[21] = 60;							// baseFrequency
+	return header;
+}
+
+int main()
+{
+	Pomme::Sound::InitMixer();
+
+	SndListHandle ima4Sound = MakeIMA4Sound();
+	long ima4HeaderOffset = 0;
+	GetSoundHeaderOffset(ima4Sound, &ima4HeaderOffset);
+
+	std::vector<char> rawSound = MakeRawSoundHeader();
+
+	SndChannelPtr channels[4] = {};
+	for (auto& channel : channels)
+	{
+		SndNewChannel(&channel, sampledSynth, initMono, nullptr);
+	}
+
+	auto play = [&](int i)
+	{
+		SndCommand cmd = {};
+		cmd.cmd = bufferCmd;
+		cmd.ptr = (i & 1) ? rawSound.data() : (Ptr) *ima4Sound + ima4HeaderOffset;
+		SndDoImmediate(channels[i & 3], &cmd);
+	};
+
+	// Warm up: fill the PCM buffer pool and the spare channel list
+	for (int i = 0; i < 100; i++)
+	{
+		play(i);
+	}
+	SndDisposeChannel(channels[3], true);
+	SndNewChannel(&channels[3], sampledSynth, initMono, nullptr);
+
+	const long allocationsBefore = gNumAllocations;
+
+	for (int i = 0; i < 10000; i++)
+	{
+		play(i);
+	}
+
+	const long allocations = gNumAllocations - allocationsBefore;
+	printf("Allocations during 10000 plays: %ld\n", allocations);
+
+	for (auto& channel : channels)
+	{
+		SndDisposeChannel(channel, true);
+	}
+	DisposeHandle((Handle) ima4Sound);
+	Pomme::Sound::ShutdownMixer();
+
+	return allocations == 0 ? 0 : 1;
+}
@@ -0,0 +1,203 @@
+// writebehind: checks that a data fork with write-behind on (see Pomme_SetWriteBehind) reads back like a plain one.
+//
+// Runs 30000 random writes, seeks, reads and GetEOF calls against a reference buffer, writes past the end of the file,
+// and turns write-behind off and on again. Then saves files and reopens them right after FSClose (which finishes
+// writing in the background) to check that reopening waits for the data.
+
+#include "Pomme.h"
+#include "PommeFiles.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#define CHECK(condition) \
+	do \
+	{ \
+		if (!(condition)) \
+		{ \
+			printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+			return false; \
+		} \
+	} while (0)
+
+static bool ReadWholeFile(const FSSpec* spec, std::vector<char>& contents)
+{
+	short refNum = 0;
+	CHECK(FSpOpenDF(spec, fsRdPerm, &refNum) == noErr);
+
+	long eof = 0;
+	GetEOF(refNum, &eof);
+	contents.resize(eof);
+
+	long count = eof;
+	CHECK(FSRead(refNum, &count, contents.data()) == noErr);
+	CHECK(count == eof);
+
+	// Write-behind is for writable forks only
+	CHECK(Pomme_SetWriteBehind(refNum, true) == wrPermErr);
+
+	FSClose(refNum);
+	return true;
+}
+
+static bool TestRandomOperations(const FSSpec* spec)
+{
+	FSpDelete(spec);
+	CHECK(FSpCreate(spec, 'PomM', 'BINA', 0) == noErr);
+
+	short refNum = 0;
+	CHECK(FSpOpenDF(spec, fsRdWrPerm, &refNum) == noErr);
+
+	// Data written before write-behind is turned on
+	std::vector<char> expected = {'A', 'B', 'C', 'D', 'E'};
+	long count = 5;
+	FSWrite(refNum, &count, expected.data());
+
+	CHECK(Pomme_SetWriteBehind(refNum, true) == noErr);
+
+	long pos = 0;
+	GetFPos(refNum, &pos);
+	CHECK(pos == 5);
+
+	std::mt19937 rng(1);
+	std::vector<char> buffer;
+
+	for (int i = 0; i < 30000; i++)
+	{
+		long eof = 0;
+		GetEOF(refNum, &eof);
+		CHECK(eof == (long) expected.size());
+
+		GetFPos(refNum, &pos);
+		int op = rng() % 10;
+
+		if (op < 6)
+		{
+			// Write (possibly past the end of the file, after a seek there)
+			long length = 1 + rng() % 200;
+			buffer.resize(length);
+			for (char& c : buffer)
+				c = (char) rng();
+
+			count = length;
+			CHECK(FSWrite(refNum, &count, buffer.data()) == noErr);
+			CHECK(count == length);
+
+			if ((size_t) (pos + length) > expected.size())
+				expected.resize(pos + length, 0);
+			memcpy(expected.data() + pos, buffer.data(), length);
+
+			long newPos = 0;
+			GetFPos(refNum, &newPos);
+			CHECK(newPos == pos + length);
+		}
+		else if (op < 8)
+		{
+			// Seek anywhere, including a bit past the end of the file
+			long to = rng() % (expected.size() + 100);
+			SetFPos(refNum, fsFromStart, to);
+			GetFPos(refNum, &pos);
+			CHECK(pos == to);
+		}
+		else
+		{
+			// Read up to the end of the file
+			long length = std::min<long>(1 + rng() % 300, (long) expected.size() - pos);
+			if (length <= 0)
+				continue;
+
+			buffer.resize(length);
+			count = length;
+			FSRead(refNum, &count, buffer.data());
+			CHECK(count == length);
+			CHECK(!memcmp(buffer.data(), expected.data() + pos, length));
+		}
+	}
+
+	// Seek past the end of the file and write: the gap reads back as zeros
+	long eof = 0;
+	GetEOF(refNum, &eof);
+	SetFPos(refNum, fsFromStart, eof + 10);
+	count = 3;
+	FSWrite(refNum, &count, (Ptr) "XYZ");
+	expected.resize(eof + 13, 0);
+	memcpy(expected.data() + eof + 10, "XYZ", 3);
+
+	GetEOF(refNum, &eof);
+	CHECK(eof == (long) expected.size());
+
+	// Turning write-behind off flushes everything, and keeps the position
+	CHECK(Pomme_SyncFile(refNum) == noErr);
+	CHECK(Pomme_SetWriteBehind(refNum, false) == noErr);
+	GetFPos(refNum, &pos);
+	CHECK(pos == eof);
+
+	count = 2;
+	FSWrite(refNum, &count, (Ptr) "!!");
+	expected.insert(expected.end(), {'!', '!'});
+
+	CHECK(Pomme_SetWriteBehind(refNum, true) == noErr);
+	count = 1;
+	FSWrite(refNum, &count, (Ptr) "#");
+	expected.push_back('#');
+
+	FSClose(refNum);
+
+	std::vector<char> contents;
+	CHECK(ReadWholeFile(spec, contents));
+	CHECK(contents == expected);
+	return true;
+}
+
+static bool TestReopenAfterClose(const FSSpec* spec)
+{
+	for (int round = 0; round < 20; round++)
+	{
+		FSpDelete(spec);
+		CHECK(FSpCreate(spec, 'PomM', 'BINA', 0) == noErr);
+
+		short refNum = 0;
+		CHECK(FSpOpenDF(spec, fsRdWrPerm, &refNum) == noErr);
+		CHECK(Pomme_SetWriteBehind(refNum, true) == noErr);
+
+		std::vector<char> expected;
+		char record[48];
+		for (int i = 0; i < 2000 + round * 100; i++)
+		{
+			for (int j = 0; j < (int) sizeof(record); j++)
+				record[j] = (char) (i * 7 + j);
+
+			long count = sizeof(record);
+			FSWrite(refNum, &count, record);
+			expected.insert(expected.end(), record, record + sizeof(record));
+		}
+
+		// Returns before the data is written out
+		FSClose(refNum);
+
+		std::vector<char> contents;
+		CHECK(ReadWholeFile(spec, contents));
+		CHECK(contents == expected);
+	}
+
+	return true;
+}
+
+int main()
+{
+	Pomme::Files::Init();
+
+	FSSpec spec;
+	FSMakeFSSpec(0, 0, ":PommeTestWriteBehind", &spec);
+
+	bool ok = TestRandomOperations(&spec)
+		&& TestReopenAfterClose(&spec);
+
+	FSpDelete(&spec);
+	Pomme::Files::Shutdown();
+
+	return ok ? 0 : 1;
+}
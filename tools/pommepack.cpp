@@ -0,0 +1,236 @@
+// pommepack: builds a Pomme pack file (see src/Files/PackFormat.h) out of a game's data folder.
+// Mount the result at runtime with Pomme_MountPackVolume.
+//
+// Usage: pommepack [-0] <input folder> <output pack>
+//   -0    store every entry uncompressed
+//
+// Resource forks are expected as AppleDouble "<name>.rsrc" files, like HostVolume does.
+
+#include "Files/PackFormat.h"
+#include "Utilities/LZ.h"
+#include "CompilerSupport/filesystem.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace Pomme::Files;
+
+struct InputFork
+{
+	fs::path hostPath;
+	std::string packPath;
+	bool isResourceFork;
+};
+
+static std::vector<char> ReadWholeFile(const fs::path& path)
+{
+	std::ifstream in(path, std::ios::binary);
+	std::vector<char> data(fs::file_size(path));
+	in.read(data.data(), data.size());
+	if (!in.good())
+	{
+		throw std::runtime_error("can't read " + path.string());
+	}
+	return data;
+}
+
+static uint32_t ReadBE32(const char* p)
+{
+	const uint8_t* b = (const uint8_t*) p;
+	return (uint32_t(b[0]) << 24) | (uint32_t(b[1]) << 16) | (uint32_t(b[2]) << 8) | uint32_t(b[3]);
+}
+
+// Returns the raw resource fork stored in an AppleDouble file (entry ID 2)
+static std::vector<char> ExtractADFResourceFork(const std::vector<char>& adf)
+{
+	static const char kADFMagic[8] = {0x00, 0x05, 0x16, 0x07, 0x00, 0x02, 0x00, 0x00};
+
+	if (adf.size() < 26 || 0 != memcmp(adf.data(), kADFMagic, 8))
+	{
+		throw std::runtime_error("No ADF magic");
+	}
+
+	size_t numEntries = (uint8_t(adf[24]) << 8) | uint8_t(adf[25]);
+
+	for (size_t i = 0; i < numEntries && 26 + 12 * (i + 1) <= adf.size(); i++)
+	{
+		const char* entry = &adf[26 + 12 * i];
+		uint32_t entryID = ReadBE32(entry);
+		uint32_t offset = ReadBE32(entry + 4);
+		uint32_t length = ReadBE32(entry + 8);
+
+		if (entryID == 2)
+		{
+			if (uint64_t(offset) + length > adf.size())
+			{
+				throw std::runtime_error("ADF resource fork out of bounds");
+			}
+			return std::vector<char>(adf.begin() + offset, adf.begin() + offset + length);
+		}
+	}
+
+	throw std::runtime_error("Didn't find entry ID=2 in ADF");
+}
+
+static std::vector<InputFork> ListInputForks(const fs::path& root)
+{
+	std::vector<InputFork> forks;
+
+	for (const auto& item : fs::recursive_directory_iterator(root))
+	{
+		if (!item.is_regular_file())
+		{
+			continue;
+		}
+
+		fs::path relative = fs::relative(item.path(), root);
+
+		// Skip hidden files, e.g. .DS_Store and macOS "._" AppleDouble companions
+		bool hidden = false;
+		for (const auto& element : relative)
+		{
+			hidden |= element.string().rfind(".", 0) == 0;
+		}
+		if (hidden)
+		{
+			continue;
+		}
+
+		InputFork fork = {item.path(), relative.generic_string(), false};
+
+		if (relative.extension() == ".rsrc")
+		{
+			fork.isResourceFork = true;
+			fork.packPath = relative.replace_extension("").generic_string();
+		}
+
+		forks.push_back(fork);
+	}
+
+	// Deterministic output; keeps files from the same folder next to each other
+	std::sort(forks.begin(), forks.end(),
+		[](const InputFork& a, const InputFork& b) { return std::tie(a.packPath, a.isResourceFork) < std::tie(b.packPath, b.isResourceFork); });
+
+	return forks;
+}
+
+int main(int argc, char** argv)
+{
+	bool allowCompression = true;
+	int argi = 1;
+
+	if (argi < argc && std::string(argv[argi]) == "-0")
+	{
+		allowCompression = false;
+		argi++;
+	}
+
+	if (argc - argi != 2)
+	{
+		std::cerr << "Usage: " << argv[0] << " [-0] <input folder> <output pack>\n";
+		return 1;
+	}
+
+	const fs::path inputRoot = argv[argi];
+	const fs::path outputPath = argv[argi + 1];
+
+	try
+	{
+		std::ofstream out(outputPath, std::ios::binary | std::ios::trunc);
+		if (!out.good())
+		{
+			throw std::runtime_error("can't create " + outputPath.string());
+		}
+
+		// Placeholder header; rewritten once the index has been written
+		Pack::PackHeader header = {};
+		memcpy(header.magic, Pack::kMagic, sizeof(Pack::kMagic));
+		header.version = Pack::kVersion;
+		out << Pack::EncodeHeader(header);
+
+		uint64_t pos = Pack::PackHeader::kSize;
+		uint64_t totalLength = 0;
+		std::string index;
+
+		for (const auto& fork : ListInputForks(inputRoot))
+		{
+			std::vector<char> data = ReadWholeFile(fork.hostPath);
+
+			if (fork.isResourceFork)
+			{
+				try
+				{
+					data = ExtractADFResourceFork(data);
+				}
+				catch (const std::exception& e)
+				{
+					std::cerr << "Skipping " << fork.hostPath << ": " << e.what() << "\n";
+					continue;
+				}
+			}
+
+			Pack::PackIndexRecord record = {};
+			record.length = data.size();
+			record.flags = fork.isResourceFork ? uint32_t(Pack::kEntryResourceFork) : 0;
+			record.pathLength = (uint32_t) fork.packPath.size();
+
+			// Only keep the compressed version if it saves at least 1/8; otherwise, store the entry
+			// page-aligned so that it can be mapped straight from the pack.
+			std::vector<char> compressed;
+			if (allowCompression)
+			{
+				compressed = Pomme::LZ::Compress(data.data(), data.size());
+			}
+
+			const std::vector<char>* stored = &data;
+
+			if (allowCompression && compressed.size() < data.size() - data.size() / 8)
+			{
+				record.flags |= Pack::kEntryCompressed;
+				stored = &compressed;
+			}
+			else
+			{
+				uint64_t padding = (Pack::kAlignment - pos % Pack::kAlignment) % Pack::kAlignment;
+				out << std::string(padding, '\0');
+				pos += padding;
+			}
+
+			record.offset = pos;
+			record.storedLength = stored->size();
+
+			out.write(stored->data(), stored->size());
+			pos += stored->size();
+			totalLength += data.size();
+
+			Pack::AppendIndexRecord(index, record);
+			index += fork.packPath;
+			header.numEntries++;
+		}
+
+		header.indexOffset = pos;
+		header.indexLength = index.size();
+		out << index;
+
+		out.seekp(0);
+		out << Pack::EncodeHeader(header);
+
+		if (!out.good())
+		{
+			throw std::runtime_error("can't write " + outputPath.string());
+		}
+
+		std::cout << outputPath.string() << ": " << header.numEntries << " forks, "
+			<< totalLength << " bytes -> " << (pos + index.size()) << " bytes\n";
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << "pommepack: " << e.what() << "\n";
+		return 1;
+	}
+
+	return 0;
+}